@@ -0,0 +1,158 @@
+// headless benchmark runner
+#include "checks.hpp"
+#include "extras.hpp"
+#include "harness.hpp"
+#include "scenes.hpp"
+
+using namespace vivabench;
+
+void print_usage() {
+  std::cerr << "usage: bench.out [--scene name|all] "
+               "[--size n] [--steps n] [--warmup n] "
+               "[--threads n] [--iterations n] "
+               "[--tolerance e] [--dt s] "
+               "[--trace file] [--stats] [--perf] "
+               "[--save file] [--extra name] "
+               "[--theta a] [--list] [--check]"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  std::string trace_path;
+  std::string save_path;
+  std::string extra;
+  bool print_stats = false;
+  bool print_perf = false;
+  auto catalog = scene_catalog();
+  auto extras = extra_catalog();
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--stats") {
+      print_stats = true;
+      continue;
+    }
+    if (arg == "--perf") {
+      print_perf = true;
+      continue;
+    }
+    if (arg == "--check")
+      return run_checks(std::cout) == 0 ? 0 : 1;
+    if (arg == "--list") {
+      for (auto &entry : catalog)
+        std::cout << entry.name << " " << entry.default_size
+                  << std::endl;
+      for (auto &entry : extras)
+        std::cout << "--extra " << entry.name << " "
+                  << entry.default_size << std::endl;
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      print_usage();
+      return 1;
+    }
+    std::string value = argv[++i];
+    if (arg == "--scene") {
+      config.scene = value;
+    } else if (arg == "--size") {
+      config.size = std::stoul(value);
+    } else if (arg == "--steps") {
+      config.steps = std::stoul(value);
+    } else if (arg == "--warmup") {
+      config.warmup = std::stoul(value);
+    } else if (arg == "--threads") {
+      config.threads = std::stoul(value);
+    } else if (arg == "--iterations") {
+      config.iterations = std::stoul(value);
+    } else if (arg == "--tolerance") {
+      config.tolerance = std::stof(value);
+    } else if (arg == "--save") {
+      save_path = value;
+    } else if (arg == "--trace") {
+      trace_path = value;
+    } else if (arg == "--dt") {
+      config.duration = std::stof(value);
+    } else if (arg == "--extra") {
+      extra = value;
+    } else if (arg == "--theta") {
+      config.theta = std::stof(value);
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+
+  if (!extra.empty()) {
+    for (auto &entry : extras) {
+      if (entry.name != extra)
+        continue;
+      auto size = config.size == 0 ? entry.default_size
+                                   : config.size;
+      entry.run(size, config, std::cout);
+      return 0;
+    }
+    std::cerr << "unknown extra: " << extra << std::endl;
+    return 1;
+  }
+
+  bool found = false;
+  bool all_finite = true;
+  for (auto &entry : catalog) {
+    if (config.scene != "all" && config.scene != entry.name)
+      continue;
+    found = true;
+    BenchConfig scene_config = config;
+    if (scene_config.size == 0)
+      scene_config.size = entry.default_size;
+    auto scene = entry.describe(scene_config.size);
+    scene.iterations = scene_config.iterations;
+    if (!save_path.empty()) {
+      // the generated scene, loadable by main.out
+      save_scene(scene, save_path);
+    }
+    auto world = std::make_shared<ParticleWorld>(
+        1, scene_config.iterations);
+    build_world(scene, *world);
+    auto result =
+        run_bench(entry.name, *world, scene_config);
+    result.write_json(std::cout);
+    if (!result.finite) {
+      std::cerr << entry.name << ": state is not finite"
+                << std::endl;
+      all_finite = false;
+    }
+    if (print_perf) {
+      std::cout << "{\"scene\":\"" << entry.name
+                << "\",\"perf\":";
+      PerfRecorder::get().write_json(std::cout);
+      std::cout << "}" << std::endl;
+    }
+  }
+  if (!found) {
+    std::cerr << "unknown scene: " << config.scene
+              << std::endl;
+    return 1;
+  }
+  if ((print_stats || !trace_path.empty()) &&
+      !VP_PROFILE_ENABLED) {
+    std::cerr << "profiling zones are compiled out, "
+                 "configure with -DVIVAPHYSICS_PROFILE=ON"
+              << std::endl;
+  }
+  if (print_perf && !VP_PERF_ENABLED) {
+    std::cerr << "counter sampling is compiled out, "
+                 "configure with "
+                 "-DVIVAPHYSICS_PERF_COUNTERS=ON"
+              << std::endl;
+  }
+  if (print_stats) {
+    auto &profiler = Profiler::get();
+    profiler.collect();
+    profiler.write_stats(std::cerr);
+  }
+  if (!trace_path.empty()) {
+    std::ofstream trace(trace_path);
+    Profiler::get().write_chrome_trace(trace);
+  }
+  return all_finite ? 0 : 1;
+}
@@ -0,0 +1,479 @@
+#pragma once
+// correctness checks run by bench.out --check
+#include "cloth.hpp"
+#include "harness.hpp"
+#include "scenes.hpp"
+#include <cstring>
+#include <sstream>
+#include <vivaphysics/ppipeline.hpp>
+#include <vivaphysics/psph.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**
+  \brief a check that passes or says why it did not
+
+  run() returns an empty string when the check holds,
+  otherwise what went wrong.
+ */
+struct CheckEntry {
+  std::string name;
+  std::function<std::string()> run;
+};
+
+/**
+  text and binary forms read back to the scene that was
+  written, for every catalog scene and for an immovable
+  particle
+ */
+inline std::string check_scene_round_trip() {
+  auto scenes = scene_catalog();
+  SceneDescription anchored;
+  anchored.add_particle(
+      v3(0, 1, 0), std::numeric_limits<real>::infinity());
+  anchored.add_particle(v3(0, 0, 0), 1);
+  anchored.add_rod(0, 1);
+  scenes.push_back(
+      {"immovable", 0, [anchored](unsigned int) {
+         return anchored;
+       }});
+  for (auto &entry : scenes) {
+    auto scene = entry.describe(16);
+    try {
+      std::ostringstream out;
+      write_scene_text(scene, out);
+      auto text = out.str();
+      std::istringstream in(text);
+      auto back = read_scene_text(in);
+      std::ostringstream again;
+      write_scene_text(back, again);
+      if (again.str() != text)
+        return entry.name + ": text form changed";
+      for (std::size_t i = 0; i < back.particles.size();
+           i++)
+        if ((back.particles[i].inverse_mass == 0) !=
+            (scene.particles[i].inverse_mass == 0))
+          return entry.name + ": immovable particle " +
+                 std::to_string(i) + " changed";
+      std::ostringstream bout;
+      write_scene_binary(scene, bout);
+      auto binary = bout.str();
+      std::istringstream bin(binary);
+      std::ostringstream bagain;
+      write_scene_binary(read_scene_binary(bin), bagain);
+      if (bagain.str() != binary)
+        return entry.name + ": binary form changed";
+    } catch (const std::exception &e) {
+      return entry.name + ": " + e.what();
+    }
+  }
+
+  // a header counting more records than the file holds is
+  // rejected before anything is allocated
+  std::ostringstream out;
+  write_scene_binary(anchored, out);
+  auto corrupt = out.str();
+  SceneHeader h;
+  std::memcpy(&h, corrupt.data(), sizeof(h));
+  h.nb_forces = std::uint64_t(1) << 40;
+  std::memcpy(&corrupt[0], &h, sizeof(h));
+  std::istringstream in(corrupt);
+  try {
+    read_scene_binary(in);
+    return "oversized force count accepted";
+  } catch (const std::runtime_error &) {
+  }
+  return "";
+}
+
+/**every catalog scene stays finite at the default step*/
+inline std::string check_scenes_finite() {
+  BenchConfig config;
+  config.warmup = 0;
+  config.steps = 300;
+  for (auto &entry : scene_catalog()) {
+    auto scene = entry.describe(16);
+    ParticleWorld world(1, 0);
+    build_world(scene, world);
+    if (!run_bench(entry.name, world, config).finite)
+      return entry.name + ": state is not finite";
+  }
+  return "";
+}
+
+/**
+  deterministic stepping gives every catalog scene the
+  same state checksum on one thread as on four
+ */
+inline std::string check_thread_determinism() {
+  for (auto &entry : scene_catalog()) {
+    auto scene = entry.describe(16);
+    std::uint64_t checksums[2];
+    unsigned int threads[2] = {1, 4};
+    for (int t = 0; t < 2; t++) {
+      ParticleWorld world(1, 0);
+      world.set_threads(threads[t]);
+      build_world(scene, world);
+      world.set_deterministic(true);
+      world.start();
+      for (unsigned int s = 0; s < 200; s++)
+        world.run(1.0f / 60.0f);
+      checksums[t] = world.state_checksum;
+    }
+    if (checksums[0] != checksums[1])
+      return entry.name + ": checksum differs on " +
+             std::to_string(threads[1]) + " threads";
+  }
+  return "";
+}
+
+/**distance from a to b relative to the size of b, b
+ * counting as floor when smaller*/
+inline double relative_error(const v3 &a, const v3 &b,
+                             double floor) {
+  v3 d = a - b;
+  double size = b.magnitude();
+  return std::sqrt(static_cast<double>(d.dot(d))) /
+         std::max(size, floor);
+}
+
+/**
+  SPH forces on a jittered block of moving particles match
+  a direct double precision sum over all pairs with the
+  same kernels, and do not change with the thread count
+ */
+inline std::string check_sph_forces() {
+  const real h = 0.1f, rest = 1000.0f, spacing = h / 2;
+  const real stiffness = 50.0f, viscosity = 0.5f;
+  SceneRandom rnd(11);
+  auto make = [&]() {
+    auto fluid = std::make_shared<ParticleSPHFluid>(
+        h, rest, stiffness, viscosity);
+    SceneRandom jitter(11);
+    for (unsigned int i = 0; i < 1000; i++) {
+      v3 cell(real(i % 10), real((i / 10) % 10),
+              real(i / 100));
+      auto p = std::make_shared<Particle>();
+      p->set_position((cell + jitter.uniform(v3(0.3f),
+                                             v3(0.7f))) *
+                      spacing);
+      p->set_velocity(jitter.uniform(v3(-1), v3(1)));
+      p->set_mass(rest * spacing * spacing * spacing);
+      p->clear_accumulator();
+      fluid->bodies.push_back(p);
+    }
+    return fluid;
+  };
+  auto fluid = make();
+  fluid->update_forces(0);
+
+  // the kernels of ParticleSPHFluid, in double
+  const double pi = 3.14159265358979;
+  const double hd = h, h2 = hd * hd;
+  const double poly6 = 315 / (64 * pi * std::pow(hd, 9));
+  const double grad = 45 / (pi * std::pow(hd, 6));
+  const auto &bodies = fluid->bodies;
+  auto n = bodies.size();
+  std::vector<double> density(n, 0), pressure(n), vol(n);
+  for (std::size_t i = 0; i < n; i++) {
+    v3 pi_ = bodies[i]->get_position();
+    for (std::size_t j = 0; j < n; j++) {
+      v3 d = bodies[j]->get_position() - pi_;
+      double q = h2 - static_cast<double>(d.dot(d));
+      if (q > 0)
+        density[i] += bodies[j]->get_mass() * q * q * q;
+    }
+    density[i] *= poly6;
+    pressure[i] = std::max(0.0, stiffness * (density[i] -
+                                             rest));
+    vol[i] = bodies[i]->get_mass() / density[i];
+  }
+  double worst = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    v3 xi = bodies[i]->get_position();
+    v3 ui = bodies[i]->get_velocity();
+    double f[3] = {0, 0, 0};
+    for (std::size_t j = 0; j < n; j++) {
+      v3 d = xi - bodies[j]->get_position();
+      double r2 = d.dot(d);
+      if (r2 >= h2 || r2 <= 1e-12)
+        continue;
+      double r = std::sqrt(r2), w = hd - r;
+      double fp = grad / 2 * vol[j] *
+                  (pressure[i] + pressure[j]) * w * w / r;
+      double fv = viscosity * grad * vol[j] * w;
+      v3 dv = bodies[j]->get_velocity() - ui;
+      for (int c = 0; c < 3; c++)
+        f[c] += fp * d[c] + fv * dv[c];
+    }
+    v3 expected(real(f[0] * vol[i]), real(f[1] * vol[i]),
+                real(f[2] * vol[i]));
+    // pressure forces are of the order of the weight
+    double floor = 9.81 * bodies[i]->get_mass();
+    worst = std::max(
+        worst,
+        relative_error(bodies[i]->get_accumulated_force(),
+                       expected, floor));
+  }
+  if (!(worst < 1e-3))
+    return "force off the direct sum by " +
+           std::to_string(worst);
+
+  ThreadPool pool(4);
+  auto threaded = make();
+  threaded->update_forces(0, &pool);
+  for (std::size_t i = 0; i < n; i++) {
+    v3 a = bodies[i]->get_accumulated_force();
+    v3 b = threaded->bodies[i]->get_accumulated_force();
+    if (std::memcmp(&a, &b, sizeof(v3)) != 0)
+      return "force of body " + std::to_string(i) +
+             " changes with the thread count";
+  }
+  return "";
+}
+
+/**
+  the stiff cloth of --extra cloth stays finite and
+  stretches less than 5% at 60 Hz with implicit springs,
+  the conjugate gradient converging every step
+ */
+inline std::string check_implicit_springs() {
+  ParticleWorld world(1, 1);
+  auto net = build_cloth(world, 12, true);
+  world.start();
+  for (unsigned int s = 0; s < 300; s++) {
+    world.run(1.0f / 60.0f);
+    if (net->get_iterations() >= net->max_iterations)
+      return "step " + std::to_string(s) +
+             " did not converge";
+  }
+  if (!world_is_finite(world))
+    return "state is not finite";
+  double stretch = max_spring_stretch(*net);
+  if (!(stretch < 1.05))
+    return "springs stretched to " +
+           std::to_string(stretch);
+  return "";
+}
+
+/**largest link error of the scene links in world,
+ * relative to their length. Cables only count when too
+ * long*/
+inline double max_link_error(const SceneDescription &scene,
+                             const ParticleWorld &world) {
+  typedef ParticleContactGeneratorType Type;
+  double worst = 0;
+  for (const auto &l : scene.links) {
+    auto type = static_cast<Type>(l.type);
+    v3 a = world.particles[l.a]->get_position();
+    bool anchored = type == Type::CABLE_CONSTRAINT ||
+                    type == Type::ROD_CONSTRAINT;
+    v3 b = anchored ? ParticleRecord::load(l.anchor)
+                    : world.particles[l.b]->get_position();
+    double error = (a - b).magnitude() - l.length;
+    if (type == Type::CABLE ||
+        type == Type::CABLE_CONSTRAINT)
+      error = std::max(error, 0.0);
+    worst = std::max(worst, std::abs(error) / l.length);
+  }
+  return worst;
+}
+
+/**
+  the direct chain and structure solvers hold the links
+  of cable_chain and rod_truss to their length. Ground
+  contacts resolved after the solve may stretch a link
+  for a step on impact, under 1%; after that the error
+  stays under 0.1%
+ */
+inline std::string check_direct_links() {
+  for (auto name : {"cable_chain", "rod_truss"}) {
+    for (auto &entry : scene_catalog()) {
+      if (entry.name != name)
+        continue;
+      auto scene = entry.describe(entry.default_size);
+      ParticleWorld world(1, 0);
+      build_world(scene, world);
+      world.start();
+      double peak = 0, settled = 0;
+      for (unsigned int s = 0; s < 300; s++) {
+        world.run(1.0f / 60.0f);
+        double error = max_link_error(scene, world);
+        peak = std::max(peak, error);
+        if (s >= 100)
+          settled = std::max(settled, error);
+      }
+      if (!(peak < 1e-2) || !(settled < 1e-3))
+        return entry.name + ": link error " +
+               std::to_string(peak) + ", settled " +
+               std::to_string(settled);
+    }
+  }
+  return "";
+}
+
+/**
+  link batches write the same contacts, bit for bit, as
+  the per link generators, with the direct solvers off so
+  every link goes through the contacts
+ */
+inline std::string check_link_batch() {
+  for (auto name : {"cable_chain", "rod_truss"}) {
+    for (auto &entry : scene_catalog()) {
+      if (entry.name != name)
+        continue;
+      auto scene = entry.describe(entry.default_size);
+      ParticleWorld batched(1, 0), single(1, 0);
+      build_world(scene, batched);
+      build_world(scene, single);
+      single.batch_links = false;
+      for (auto *w : {&batched, &single}) {
+        w->solve_chains = false;
+        w->solve_structures = false;
+        w->start();
+      }
+      const real dt = 1.0f / 60.0f;
+      for (unsigned int s = 0; s < 200; s++) {
+        unsigned int nb[2];
+        ParticleWorld *ws[2] = {&batched, &single};
+        for (int k = 0; k < 2; k++) {
+          ws[k]->apply_commands();
+          ws[k]->emit(dt);
+          ws[k]->update_forces(dt);
+          ws[k]->integrate(dt);
+          nb[k] = ws[k]->generate_contacts();
+        }
+        if (nb[0] != nb[1])
+          return entry.name + ": contact counts differ";
+        for (unsigned int c = 0; c < nb[0]; c++) {
+          const auto &a = batched.contacts[c];
+          const auto &b = single.contacts[c];
+          if (std::memcmp(&a.contact_normal,
+                          &b.contact_normal,
+                          sizeof(v3)) != 0 ||
+              std::memcmp(&a.penetration, &b.penetration,
+                          sizeof(real)) != 0 ||
+              a.restitution != b.restitution ||
+              a.particles.is_double !=
+                  b.particles.is_double)
+            return entry.name + ": contact " +
+                   std::to_string(c) + " differs at step " +
+                   std::to_string(s);
+        }
+        for (int k = 0; k < 2; k++) {
+          ws[k]->resolve_contacts(nb[k], dt);
+          ws[k]->retire(dt);
+          ws[k]->end_step();
+        }
+      }
+    }
+  }
+  return "";
+}
+
+/**
+  a pipeline of gravity, drag and anchored springs pushes
+  as the same generators registered per particle, and the
+  fused form moves the particles the same way
+ */
+inline std::string check_pipeline_forces() {
+  const unsigned int n = 1000;
+  const v3 g(0, -9.81f, 0), anchor(0, 10, 0);
+  const ParticleGravity gravity(g);
+  const ParticleDrag drag(0.1f, 0.01f);
+  const ParticleAnchoredSpring spring(anchor, 5.0f, 2.0f);
+  ParticleWorld registry(1, 1), pipelined(1, 1),
+      fused(1, 1);
+  auto pipeline =
+      make_force_pipeline(gravity, drag, spring);
+  auto fused_pipeline =
+      make_force_pipeline(gravity, drag, spring);
+  SceneRandom rnd(17);
+  for (unsigned int i = 0; i < n; i++) {
+    Particle p;
+    p.set_position(rnd.uniform(v3(-10), v3(10)));
+    p.set_velocity(rnd.uniform(v3(-5), v3(5)));
+    p.set_mass(rnd.uniform(0.5f, 2.0f));
+    p.set_damping(0.99f);
+    p.clear_accumulator();
+    auto a = std::make_shared<Particle>(p);
+    registry.particles.push_back(a);
+    registry.registry.add(a, gravity);
+    registry.registry.add(a, drag);
+    registry.registry.add(a, spring);
+    auto b = std::make_shared<Particle>(p);
+    pipelined.particles.push_back(b);
+    pipeline->add(b);
+    auto c = std::make_shared<Particle>(p);
+    fused_pipeline->add(c);
+  }
+  pipelined.registry.add_pipeline(pipeline);
+  fused.fused_pipelines.push_back(fused_pipeline);
+  for (auto *w : {&registry, &pipelined, &fused})
+    w->start();
+
+  const real dt = 1.0f / 60.0f;
+  registry.update_forces(dt);
+  pipelined.update_forces(dt);
+  double worst = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    const auto &a = registry.particles[i];
+    worst = std::max(
+        worst, relative_error(
+                   pipelined.particles[i]
+                       ->get_accumulated_force(),
+                   a->get_accumulated_force(),
+                   9.81 * a->get_mass()));
+  }
+  if (!(worst < 1e-5))
+    return "pipeline force off by " + std::to_string(worst);
+
+  for (auto *w : {&registry, &pipelined})
+    w->start();
+  for (unsigned int s = 0; s < 100; s++)
+    for (auto *w : {&registry, &fused})
+      w->run(dt);
+  worst = 0;
+  for (unsigned int i = 0; i < n; i++)
+    worst = std::max(
+        worst,
+        relative_error(
+            fused_pipeline->particles[i]->get_position(),
+            registry.particles[i]->get_position(), 1.0));
+  if (!(worst < 1e-4))
+    return "fused positions off by " +
+           std::to_string(worst);
+  return "";
+}
+
+inline std::vector<CheckEntry> check_catalog() {
+  return {
+      {"scene_round_trip", check_scene_round_trip},
+      {"scenes_finite", check_scenes_finite},
+      {"thread_determinism", check_thread_determinism},
+      {"sph_forces", check_sph_forces},
+      {"implicit_springs", check_implicit_springs},
+      {"direct_links", check_direct_links},
+      {"link_batch", check_link_batch},
+      {"pipeline_forces", check_pipeline_forces},
+  };
+}
+
+/**run every check, returns how many failed*/
+inline unsigned int run_checks(std::ostream &out) {
+  unsigned int nb_failed = 0;
+  for (auto &entry : check_catalog()) {
+    auto failure = entry.run();
+    if (failure.empty()) {
+      out << "ok " << entry.name << std::endl;
+    } else {
+      out << "FAILED " << entry.name << ": " << failure
+          << std::endl;
+      nb_failed++;
+    }
+  }
+  return nb_failed;
+}
+};
@@ -0,0 +1,118 @@
+#pragma once
+// stiff cloth with implicit and explicit springs
+#include "harness.hpp"
+#include <vivaphysics/pimplicit.hpp>
+#include <vivaphysics/pworld.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**
+  \brief size x size cloth hanging from its first row,
+  structural and shear springs in a network registered
+  with the world. Returns the network
+ */
+inline std::shared_ptr<ImplicitSpringNetwork>
+build_cloth(ParticleWorld &world, unsigned int size,
+            bool implicit) {
+  const real spacing = 0.1f, stiffness = 2000.0f;
+  const real diagonal = spacing * std::sqrt(2.0f);
+  auto net = std::make_shared<ImplicitSpringNetwork>();
+  net->implicit = implicit;
+  for (unsigned int i = 0; i < size * size; i++) {
+    unsigned int x = i % size, z = i / size;
+    auto particle_ptr = std::make_shared<Particle>();
+    particle_ptr->set_position(x * spacing, 0, z * spacing);
+    particle_ptr->set_mass(0.01f);
+    if (z == 0)
+      particle_ptr->set_inverse_mass(0);
+    particle_ptr->set_acceleration(v3::GRAVITY);
+    particle_ptr->set_damping(1.0f);
+    world.particles.push_back(particle_ptr);
+    net->add_body(particle_ptr);
+  }
+  auto link = [&](unsigned int x0, unsigned int z0,
+                  unsigned int x1, unsigned int z1,
+                  real rest) {
+    net->add_spring(z0 * size + x0, z1 * size + x1,
+                    stiffness, rest, 0.05f);
+  };
+  for (unsigned int z = 0; z < size; z++) {
+    for (unsigned int x = 0; x < size; x++) {
+      if (x + 1 < size)
+        link(x, z, x + 1, z, spacing);
+      if (z + 1 < size)
+        link(x, z, x, z + 1, spacing);
+      if (x + 1 < size && z + 1 < size) {
+        link(x, z, x + 1, z + 1, diagonal);
+        link(x + 1, z, x, z + 1, diagonal);
+      }
+    }
+  }
+  world.registry.add_spring_network(net);
+  return net;
+}
+
+/**largest length over rest length of the springs*/
+inline double
+max_spring_stretch(const ImplicitSpringNetwork &net) {
+  double max_stretch = 0;
+  for (const auto &spring : net.springs) {
+    v3 d = net.bodies[spring.a]->get_position() -
+           net.bodies[spring.b]->get_position();
+    double stretch = d.magnitude() / spring.rest_length;
+    max_stretch = std::max(max_stretch, stretch);
+  }
+  return max_stretch;
+}
+
+/**
+  \brief the cloth of build_cloth stepped through a world
+  with an implicit spring network and again with the same
+  springs applied explicitly
+
+  Structural and shear springs are stiff enough that the
+  explicit run needs steps below a millisecond. Reports the
+  largest speed and spring stretch at the end of each run,
+  a cloth that blew up shows them huge or not finite.
+ */
+inline void run_cloth_bench(unsigned int size,
+                            const BenchConfig &config,
+                            std::ostream &out) {
+  for (bool implicit : {true, false}) {
+    ParticleWorld world(1, 1);
+    auto net = build_cloth(world, size, implicit);
+    world.set_threads(config.threads);
+    world.start();
+
+    PhaseTimes times;
+    double iterations = 0;
+    auto steps = config.warmup + config.steps;
+    for (unsigned int s = 0; s < steps; s++) {
+      timed_step(world, config.duration, times);
+      iterations += net->get_iterations();
+    }
+
+    double max_speed = 0;
+    bool finite = world_is_finite(world);
+    for (auto &p : world.particles) {
+      double speed = p->get_velocity().magnitude();
+      max_speed = std::max(max_speed, speed);
+    }
+    double max_stretch = max_spring_stretch(*net);
+    out << "{\"scene\":\"cloth\",\"size\":" << size
+        << ",\"implicit\":" << (implicit ? "true" : "false")
+        << ",\"threads\":" << world.get_threads()
+        << ",\"dt\":" << config.duration
+        << ",\"ms_per_step\":"
+        << times.total_ns / std::max(steps, 1u) / 1e6
+        << ",\"cg_iterations_per_step\":"
+        << iterations / std::max(steps, 1u)
+        << ",\"finite\":" << (finite ? "true" : "false")
+        << ",\"max_speed\":" << max_speed
+        << ",\"max_stretch\":" << max_stretch << "}"
+        << std::endl;
+  }
+}
+};
@@ -0,0 +1,120 @@
+#pragma once
+// parameter sweep of ballistic shots, ensemble vs worlds
+#include "harness.hpp"
+#include "scenes.hpp"
+#include <vivaphysics/pensemble.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**
+  \brief shot i of the sweep: the four BallisticMeshDemo
+  shot types with mass and damping varied around them
+ */
+inline Particle make_shot(unsigned int i,
+                          SceneRandom &rnd) {
+  Particle p;
+  p.set_position(v3(0, 1.5f, 0));
+  p.clear_accumulator();
+  real scale = rnd.uniform(0.5f, 2.0f);
+  real damping = rnd.uniform(-0.05f, 0.0f);
+  switch (i % 4) {
+  case 0: // pistol
+    p.set_mass(2.0f * scale);
+    p.set_velocity(0, 0, 35);
+    p.set_acceleration(0, -1.0f, 0);
+    p.set_damping(0.99f + damping / 5);
+    break;
+  case 1: // artillery
+    p.set_mass(200.0f * scale);
+    p.set_velocity(0, 30, 40);
+    p.set_acceleration(0, -20.0f, 0);
+    p.set_damping(0.99f + damping / 5);
+    break;
+  case 2: // fireball
+    p.set_mass(1.0f * scale);
+    p.set_velocity(0, 0, 10);
+    p.set_acceleration(0, 0.6f, 0);
+    p.set_damping(0.9f + damping);
+    break;
+  default: // laser
+    p.set_mass(0.1f * scale);
+    p.set_velocity(0, 0, 100.f);
+    p.set_acceleration(0, 0.0f, 0);
+    p.set_damping(0.99f + damping / 5);
+    break;
+  }
+  return p;
+}
+
+/**
+  \brief step size shots to retirement, once as an ensemble
+  and once as separate one particle worlds
+
+  Shots retire like in the demo: below the ground, beyond
+  the far plane or after five seconds.
+ */
+inline void run_ensemble_bench(unsigned int size,
+                               const BenchConfig &config,
+                               std::ostream &out) {
+  const v3 lo(-1000, 0, -1000), hi(1000, 1000, 200);
+  auto max_steps =
+      static_cast<std::uint64_t>(5.0f / config.duration);
+  SceneRandom rnd(3);
+  std::vector<Particle> shots;
+  for (unsigned int i = 0; i < size; i++)
+    shots.push_back(make_shot(i, rnd));
+
+  ParticleEnsemble ensemble(size, 1);
+  for (unsigned int i = 0; i < size; i++)
+    ensemble.set_particle(i, 0, shots[i]);
+  ensemble.set_bounds(lo, hi);
+  ensemble.set_max_steps(max_steps);
+  std::shared_ptr<ThreadPool> pool;
+  if (config.threads > 1)
+    pool = std::make_shared<ThreadPool>(config.threads);
+
+  auto t0 = BenchClock::now();
+  std::uint64_t ensemble_steps = 0;
+  while (ensemble.nb_active() > 0) {
+    ensemble_steps += ensemble.nb_active();
+    ensemble.run(config.duration, pool.get());
+  }
+  auto t1 = BenchClock::now();
+
+  // one world per shot, as the sweep used to be run
+  std::uint64_t world_steps = 0;
+  for (unsigned int i = 0; i < size; i++) {
+    ParticleWorld world(1, 1);
+    auto particle_ptr =
+        std::make_shared<Particle>(shots[i]);
+    world.particles.push_back(particle_ptr);
+    world.start();
+    for (std::uint64_t s = 0; s < max_steps; s++) {
+      world.run(config.duration);
+      world_steps++;
+      v3 pos = particle_ptr->get_position();
+      bool inside = true;
+      for (unsigned int c = 0; c < 3; c++)
+        inside = inside && pos[c] >= lo[c] &&
+                 pos[c] <= hi[c];
+      if (!inside)
+        break;
+    }
+  }
+  auto t2 = BenchClock::now();
+
+  auto ns_per = [](double ns, std::uint64_t n) {
+    return n == 0 ? 0.0 : ns / n;
+  };
+  out << "{\"scene\":\"shot_ensemble\",\"size\":" << size
+      << ",\"threads\":" << config.threads
+      << ",\"world_steps\":" << ensemble_steps
+      << ",\"ensemble_ns_per_world_step\":"
+      << ns_per(elapsed_ns(t0, t1), ensemble_steps)
+      << ",\"separate_ns_per_world_step\":"
+      << ns_per(elapsed_ns(t1, t2), world_steps) << "}"
+      << std::endl;
+}
+};
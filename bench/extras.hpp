@@ -0,0 +1,41 @@
+#pragma once
+// benchmarks that build their own systems
+#include "cloth.hpp"
+#include "ensemble.hpp"
+#include "field.hpp"
+#include "harness.hpp"
+#include "nbody.hpp"
+#include "rigid.hpp"
+#include "sph.hpp"
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**
+  \brief a benchmark outside the scene catalog, run with
+  bench.out --extra name [--size n]
+
+  run() builds its system at the given size, steps it as
+  config says and writes one json line per measurement.
+ */
+struct ExtraEntry {
+  std::string name;
+  /**size used when none is given*/
+  unsigned int default_size;
+  std::function<void(unsigned int, const BenchConfig &,
+                     std::ostream &)>
+      run;
+};
+
+inline std::vector<ExtraEntry> extra_catalog() {
+  return {
+      {"ensemble", 10000, run_ensemble_bench},
+      {"nbody", 200000, run_nbody_bench},
+      {"sph", 20000, run_sph_bench},
+      {"cloth", 64, run_cloth_bench},
+      {"rigid", 100000, run_rigid_bench},
+      {"field", 1000000, run_field_bench},
+  };
+}
+};
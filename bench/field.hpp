@@ -0,0 +1,101 @@
+#pragma once
+// particles blown by a sampled vortex field
+#include "harness.hpp"
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vivaphysics/pfield.hpp>
+#include <vivaphysics/pworld.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**swirl around the y axis of the grid center, turning by
+ * phase*/
+inline v3 vortex_flow(const v3 &p, real phase) {
+  real r2 = p.x * p.x + p.z * p.z + 1.0f;
+  real c = std::cos(phase), s = std::sin(phase);
+  return v3(-p.z * c - p.x * s, 0.5f * s,
+            p.x * c - p.z * s) *
+         (10.0f / r2);
+}
+
+/**
+  \brief n particles dragged by a 64^3 vortex field
+
+  A writer thread fills and publishes a new slice of the
+  field every 20 ms while the world steps. The first grid
+  goes through a save and a mapped load. Reports the time
+  to push and integrate each particle and the number of
+  slices published.
+ */
+inline void run_field_bench(unsigned int n,
+                            const BenchConfig &config,
+                            std::ostream &out) {
+  const unsigned int side = 64;
+  const real spacing = 0.5f;
+  const v3 origin(-16, -16, -16);
+  auto grid = std::make_shared<VectorGrid>(
+      side, side, side, origin, spacing);
+  grid->fill(
+      [](const v3 &p) { return vortex_flow(p, 0); });
+  const std::string path = "field_bench.grid";
+  grid->save(path);
+  auto mapped = VectorGrid::load(path);
+  std::remove(path.c_str());
+
+  auto field = std::make_shared<ParticleForceField>(
+      mapped, ForceFieldMode::VELOCITY, 0.5f);
+  std::mt19937 engine(7);
+  std::uniform_real_distribution<real> unit(-15, 15);
+  for (unsigned int i = 0; i < n; i++) {
+    auto particle_ptr = std::make_shared<Particle>();
+    particle_ptr->set_position(unit(engine), unit(engine),
+                               unit(engine));
+    particle_ptr->set_mass(1);
+    particle_ptr->set_damping(1);
+    field->add(particle_ptr);
+  }
+
+  ParticleWorld world(1, 1);
+  world.fused_pipelines.push_back(field);
+  world.set_threads(config.threads);
+  world.start();
+
+  std::atomic<bool> done(false);
+  std::atomic<unsigned int> slices(0);
+  std::thread writer([&]() {
+    real phase = 0;
+    while (!done) {
+      phase += 0.1f;
+      auto back = field->back();
+      back->fill([phase](const v3 &p) {
+        return vortex_flow(p, phase);
+      });
+      field->publish(back);
+      slices++;
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(20));
+    }
+  });
+
+  PhaseTimes times;
+  auto steps = config.warmup + config.steps;
+  for (unsigned int s = 0; s < steps; s++)
+    timed_step(world, config.duration, times);
+  done = true;
+  writer.join();
+
+  double per_particle = static_cast<double>(steps) * n;
+  out << "{\"scene\":\"field\",\"size\":" << n
+      << ",\"threads\":" << world.get_threads()
+      << ",\"grid\":" << side
+      << ",\"mapped\":"
+      << (mapped->is_mapped() ? "true" : "false")
+      << ",\"ns_per_particle\":"
+      << times.integrate_ns / per_particle
+      << ",\"slices\":" << slices.load() << "}"
+      << std::endl;
+}
+};
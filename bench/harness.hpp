@@ -0,0 +1,194 @@
+#pragma once
+// headless benchmark harness for the particle world
+#include <chrono>
+#include <external.hpp>
+#include <vivaphysics/pworld.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+typedef std::chrono::steady_clock BenchClock;
+
+inline double elapsed_ns(BenchClock::time_point start,
+                         BenchClock::time_point end) {
+  return static_cast<double>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          end - start)
+          .count());
+}
+
+/** time spent in each phase of ParticleWorld::run */
+struct PhaseTimes {
+  double forces_ns = 0;
+  double integrate_ns = 0;
+  double contacts_ns = 0;
+  double resolve_ns = 0;
+  double total_ns = 0;
+
+  /**contacts generated and resolver iterations, summed over
+   * the steps*/
+  unsigned long nb_contacts = 0;
+  unsigned long nb_iterations = 0;
+
+  /**largest errors the resolver left, and the steps it
+   * stopped before meeting its tolerances*/
+  double velocity_error = 0;
+  double penetration_error = 0;
+  unsigned long nb_unconverged = 0;
+};
+
+/**
+  \brief one step of the world with every phase timed
+
+  Calls the phases in the same order as ParticleWorld::run.
+ */
+inline void timed_step(ParticleWorld &world, real duration,
+                       PhaseTimes &times) {
+  world.apply_commands();
+  world.emit(duration);
+  auto t0 = BenchClock::now();
+  world.update_forces(duration);
+  auto t1 = BenchClock::now();
+  world.integrate(duration);
+  auto t2 = BenchClock::now();
+  auto used_nb_contacts = world.generate_contacts();
+  auto t3 = BenchClock::now();
+  world.resolve_contacts(used_nb_contacts, duration);
+  world.retire(duration);
+  world.end_step();
+  auto t4 = BenchClock::now();
+
+  times.forces_ns += elapsed_ns(t0, t1);
+  times.integrate_ns += elapsed_ns(t1, t2);
+  times.contacts_ns += elapsed_ns(t2, t3);
+  times.resolve_ns += elapsed_ns(t3, t4);
+  times.total_ns += elapsed_ns(t0, t4);
+  times.nb_contacts += used_nb_contacts;
+  if (used_nb_contacts == 0)
+    return;
+  const auto &resolver = world.resolver;
+  times.nb_iterations += resolver.iteration_used;
+  times.velocity_error = std::max<double>(
+      times.velocity_error, resolver.velocity_error);
+  times.penetration_error = std::max<double>(
+      times.penetration_error, resolver.penetration_error);
+  if (!resolver.converged)
+    times.nb_unconverged++;
+}
+
+struct BenchConfig {
+  std::string scene = "all";
+  /**scene size, meaning depends on the scene*/
+  unsigned int size = 0;
+  unsigned int steps = 200;
+  unsigned int warmup = 10;
+  unsigned int threads = 1;
+  /**resolver iterations, 0 uses 2 per contact*/
+  unsigned int iterations = 0;
+  /**closing velocity and penetration the resolver may
+   * leave*/
+  real tolerance = 0;
+  real duration = 1.0f / 60.0f;
+  /**Barnes-Hut opening angle of --nbody*/
+  real theta = 0.5f;
+};
+
+/**every particle position and velocity is finite*/
+inline bool world_is_finite(const ParticleWorld &world) {
+  for (const auto &particle_ptr : world.particles) {
+    v3 p = particle_ptr->get_position();
+    v3 v = particle_ptr->get_velocity();
+    if (!std::isfinite(p.x + p.y + p.z) ||
+        !std::isfinite(v.x + v.y + v.z))
+      return false;
+  }
+  return true;
+}
+
+struct BenchResult {
+  std::string scene;
+  unsigned int size = 0;
+  unsigned int nb_particles = 0;
+  unsigned int steps = 0;
+  unsigned int threads = 1;
+  PhaseTimes times;
+  /**the state stayed finite, a run that blew up measures
+   * nothing*/
+  bool finite = true;
+
+  double steps_per_sec() const {
+    if (times.total_ns <= 0)
+      return 0;
+    return steps * 1e9 / times.total_ns;
+  }
+  double ns_per_particle() const {
+    if (steps == 0 || nb_particles == 0)
+      return 0;
+    return times.total_ns / steps / nb_particles;
+  }
+  double per_step(double v) const {
+    return steps == 0 ? 0 : v / steps;
+  }
+
+  /**one json object per line*/
+  void write_json(std::ostream &out) const {
+    out << "{\"scene\":\"" << scene << "\""
+        << ",\"size\":" << size
+        << ",\"particles\":" << nb_particles
+        << ",\"steps\":" << steps
+        << ",\"threads\":" << threads
+        << ",\"steps_per_sec\":" << steps_per_sec()
+        << ",\"ns_per_particle\":" << ns_per_particle()
+        << ",\"phases_ns_per_step\":{"
+        << "\"forces\":" << per_step(times.forces_ns)
+        << ",\"integrate\":"
+        << per_step(times.integrate_ns)
+        << ",\"contacts\":"
+        << per_step(times.contacts_ns)
+        << ",\"resolve\":" << per_step(times.resolve_ns)
+        << "}"
+        << ",\"contacts_per_step\":"
+        << per_step(static_cast<double>(times.nb_contacts))
+        << ",\"iterations_per_step\":"
+        << per_step(
+               static_cast<double>(times.nb_iterations))
+        << ",\"velocity_error\":" << times.velocity_error
+        << ",\"penetration_error\":"
+        << times.penetration_error
+        << ",\"unconverged_steps\":" << times.nb_unconverged
+        << ",\"finite\":" << (finite ? "true" : "false")
+        << "}" << std::endl;
+  }
+};
+
+/**
+  \brief run the warmup and measured steps on a built world
+ */
+inline BenchResult run_bench(const std::string &scene,
+                             ParticleWorld &world,
+                             const BenchConfig &config) {
+  world.set_threads(config.threads);
+  world.resolver.velocity_tolerance = config.tolerance;
+  world.resolver.penetration_tolerance = config.tolerance;
+  world.start();
+  PhaseTimes warmup_times;
+  for (unsigned int i = 0; i < config.warmup; i++) {
+    timed_step(world, config.duration, warmup_times);
+  }
+  // counter rates only cover the measured steps
+  PerfRecorder::get().reset();
+  BenchResult result;
+  result.scene = scene;
+  result.size = config.size;
+  result.nb_particles =
+      static_cast<unsigned int>(world.particles.size());
+  result.steps = config.steps;
+  result.threads = world.get_threads();
+  for (unsigned int i = 0; i < config.steps; i++) {
+    timed_step(world, config.duration, result.times);
+  }
+  result.finite = world_is_finite(world);
+  return result;
+}
+};
@@ -0,0 +1,73 @@
+#pragma once
+// Barnes-Hut gravity against direct summation
+#include "harness.hpp"
+#include "scenes.hpp"
+#include <vivaphysics/pnbody.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**
+  \brief time the octree force on a random ball of size
+  bodies and measure its error on a sample of them
+
+  The error is the largest relative difference to direct
+  summation over 64 bodies spread through the set.
+ */
+inline void run_nbody_bench(unsigned int size,
+                            const BenchConfig &config,
+                            std::ostream &out) {
+  SceneRandom rnd(5);
+  auto gen = std::make_shared<ParticleNBodyGravity>(
+      1.0f, config.theta, 0.01f);
+  for (unsigned int i = 0; i < size; i++) {
+    v3 p;
+    do {
+      p = rnd.uniform(v3(-1, -1, -1), v3(1, 1, 1));
+    } while (p.dot(p) > 1);
+    auto particle_ptr = std::make_shared<Particle>();
+    particle_ptr->set_position(p * 100.0f);
+    particle_ptr->set_mass(rnd.uniform(0.5f, 2.0f));
+    particle_ptr->set_damping(1.0f);
+    particle_ptr->clear_accumulator();
+    gen->bodies.push_back(particle_ptr);
+  }
+  std::shared_ptr<ThreadPool> pool;
+  if (config.threads > 1)
+    pool = std::make_shared<ThreadPool>(config.threads);
+
+  auto steps = std::max(config.steps, 1u);
+  auto t0 = BenchClock::now();
+  for (unsigned int s = 0; s < steps; s++) {
+    for (auto &b : gen->bodies)
+      b->clear_accumulator();
+    gen->update_forces(config.duration, pool.get());
+  }
+  auto t1 = BenchClock::now();
+
+  double max_error = 0;
+  unsigned int nb_samples = std::min(size, 64u);
+  for (unsigned int k = 0; k < nb_samples; k++) {
+    auto i = static_cast<unsigned int>(
+        (static_cast<unsigned long>(size) * k) /
+        nb_samples);
+    v3 exact = gen->direct_acceleration(i);
+    v3 approx = gen->bodies[i]->get_accumulated_force() *
+                gen->bodies[i]->get_inverse_mass();
+    v3 diff = approx - exact;
+    real norm2 = std::max(exact.dot(exact), 1e-30f);
+    double err = std::sqrt(diff.dot(diff) / norm2);
+    max_error = std::max(max_error, err);
+  }
+
+  out << "{\"scene\":\"nbody\",\"size\":" << size
+      << ",\"threads\":" << config.threads
+      << ",\"theta\":" << config.theta
+      << ",\"nodes\":" << gen->get_nodes().size()
+      << ",\"ms_per_step\":"
+      << elapsed_ns(t0, t1) / steps / 1e6
+      << ",\"max_relative_error\":" << max_error << "}"
+      << std::endl;
+}
+};
@@ -0,0 +1,123 @@
+#pragma once
+// tumbling rigid bodies
+#include "harness.hpp"
+#include <random>
+#include <vivaphysics/pworld.hpp>
+#include <vivaphysics/rbody.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**
+  \brief the per object update RigidBodySet replaces: one
+  struct per body integrated with glm types, the even
+  bodies pushed by the thruster of run_rigid_bench
+ */
+inline void
+integrate_rigid_objects(std::vector<RigidBody> &bodies,
+                        real duration) {
+  const glm::vec3 point(0.1f, 0.2f, 0), thrust(0, 0, 1);
+  for (std::size_t i = 0; i < bodies.size(); i++) {
+    auto &b = bodies[i];
+    if (b.inverse_mass <= 0)
+      continue;
+    glm::mat3 r = glm::mat3_cast(b.orientation);
+    glm::mat3 inertia =
+        r * b.inverse_inertia * glm::transpose(r);
+    glm::vec3 force(0), torque(0);
+    if (i % 2 == 0) {
+      force = r * thrust;
+      torque = glm::cross(r * point, force);
+    }
+    b.position.add_scaled_vector(b.velocity, duration);
+    glm::quat spin(0, b.rotation.x, b.rotation.y,
+                   b.rotation.z);
+    b.orientation = glm::normalize(
+        b.orientation +
+        spin * b.orientation * (0.5f * duration));
+    b.velocity = v3(b.velocity.to_glm() +
+                    (b.acceleration.to_glm() +
+                     force * b.inverse_mass) *
+                        duration);
+    b.velocity *= static_cast<real>(
+        pow(b.linear_damping, duration));
+    b.rotation = v3(b.rotation.to_glm() +
+                    inertia * torque * duration);
+    b.rotation *= static_cast<real>(
+        pow(b.angular_damping, duration));
+  }
+}
+
+/**
+  \brief n boxes of random shapes tumbling in free space,
+  every other one pushed by an off center thruster
+
+  Times the rigid force and integrate phases of a world
+  through RigidBodySet, then the same bodies integrated one
+  struct at a time. drift is the largest departure of an
+  orientation from unit length.
+ */
+inline void run_rigid_bench(unsigned int n,
+                            const BenchConfig &config,
+                            std::ostream &out) {
+  std::mt19937 engine(42);
+  std::uniform_real_distribution<real> unit(-1, 1);
+  std::uniform_real_distribution<real> extent(0.1f, 1);
+  std::vector<RigidBody> start(n);
+  for (auto &body : start) {
+    body.position = v3(unit(engine), unit(engine),
+                       unit(engine)) *
+                    100.0f;
+    body.orientation = glm::normalize(
+        glm::quat(unit(engine), unit(engine),
+                  unit(engine), unit(engine)));
+    body.rotation = v3(unit(engine), unit(engine),
+                       unit(engine)) *
+                    5.0f;
+    body.set_box_inertia(1 + extent(engine),
+                         v3(extent(engine), extent(engine),
+                            extent(engine)));
+  }
+
+  ParticleWorld world(1, 1);
+  world.rigid_bodies.reserve(n);
+  for (unsigned int i = 0; i < n; i++) {
+    auto h = world.rigid_bodies.add(start[i]);
+    if (i % 2 == 0)
+      world.rigid_forces.add(
+          h, RigidThrust(v3(0.1f, 0.2f, 0),
+                         v3(0, 0, 1)));
+  }
+  world.set_threads(config.threads);
+  world.start();
+  PhaseTimes times;
+  auto steps = config.warmup + config.steps;
+  for (unsigned int s = 0; s < steps; s++)
+    timed_step(world, config.duration, times);
+
+  double drift = 0;
+  const auto &bodies = world.rigid_bodies;
+  for (unsigned int i = 0; i < n; i++) {
+    double norm = glm::length(bodies.get_orientation(i));
+    drift = std::max(drift, std::abs(norm - 1));
+  }
+
+  auto objects = start;
+  auto t0 = BenchClock::now();
+  for (unsigned int s = 0; s < steps; s++)
+    integrate_rigid_objects(objects, config.duration);
+  double objects_ns = elapsed_ns(t0, BenchClock::now());
+
+  double per_body = static_cast<double>(steps) * n;
+  out << "{\"scene\":\"rigid\",\"size\":" << n
+      << ",\"threads\":" << world.get_threads()
+      << ",\"forces_ns_per_body\":"
+      << times.forces_ns / per_body
+      << ",\"integrate_ns_per_body\":"
+      << times.integrate_ns / per_body
+      << ",\"objects_ns_per_body\":"
+      << objects_ns / per_body << ",\"drift\":" << drift
+      << "}" << std::endl;
+}
+};
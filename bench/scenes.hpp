@@ -0,0 +1,213 @@
+#pragma once
+// procedurally generated stress scenes
+#include <cstdint>
+#include <external.hpp>
+#include <random>
+#include <vivaphysics/pscene.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**seeded generator so every run builds the same scene*/
+struct SceneRandom {
+  std::mt19937 engine;
+  SceneRandom(std::uint32_t seed = 2020) : engine(seed) {}
+
+  /**uniform in [lo, hi), computed from the raw engine
+   * output so it does not depend on the standard library*/
+  real uniform(real lo, real hi) {
+    double u = engine() / 4294967296.0;
+    return static_cast<real>(lo + (hi - lo) * u);
+  }
+  v3 uniform(const v3 &lo, const v3 &hi) {
+    return v3(uniform(lo.x, hi.x), uniform(lo.y, hi.y),
+              uniform(lo.z, hi.z));
+  }
+};
+
+/**
+  \brief free flying shots like the ballistic demo
+
+  size: number of particles
+ */
+inline SceneDescription describe_ballistic_swarm(
+    unsigned int size) {
+  SceneDescription scene;
+  scene.max_contacts = 1;
+  SceneRandom rnd;
+  scene.particles.reserve(size);
+  for (unsigned int i = 0; i < size; i++) {
+    v3 position = rnd.uniform(v3(-5, 1, -5), v3(5, 3, 5));
+    real mass = rnd.uniform(0.1f, 200.0f);
+    v3 velocity =
+        rnd.uniform(v3(-10, 0, 10), v3(10, 30, 100));
+    v3 acceleration(0, rnd.uniform(-20, 1), 0);
+    scene.add_particle(position, mass, 0.99f, velocity,
+                       acceleration);
+  }
+  return scene;
+}
+
+/**
+  \brief a row of PlatformDemo style bays joined by rods
+
+  size: number of bays, two particles per bay
+ */
+inline SceneDescription
+describe_rod_truss(unsigned int size) {
+  SceneDescription scene;
+  scene.max_contacts = size * 8 + 8;
+  for (unsigned int i = 0; i < size; i++) {
+    real x = 3.0f * i;
+    real y = (i == 0 || i + 1 == size) ? 0.0f : 2.0f;
+    auto near = scene.add_particle(v3(x, y, 1), 1, 0.9f,
+                                   v3(0), v3::GRAVITY);
+    auto far = scene.add_particle(v3(x, y, -1), 1, 0.9f,
+                                  v3(0), v3::GRAVITY);
+    scene.add_rod(near, far);
+    if (i > 0) {
+      auto prev_near = near - 2, prev_far = far - 2;
+      scene.add_rod(prev_near, near);
+      scene.add_rod(prev_far, far);
+      scene.add_rod(prev_near, far);
+      scene.add_rod(prev_far, near);
+    }
+  }
+  scene.add_ground();
+  return scene;
+}
+
+/**
+  \brief a horizontal cable chain hanging from an anchor
+
+  size: number of links
+ */
+inline SceneDescription
+describe_cable_chain(unsigned int size) {
+  SceneDescription scene;
+  scene.max_contacts = size + 1;
+  const real spacing = 0.5f;
+  const v3 anchor(0, 10 + size * spacing, 0);
+  auto prev =
+      scene.add_particle(anchor + v3(spacing, 0, 0), 1,
+                         0.99f, v3(0), v3::GRAVITY);
+  scene.add_link(
+      ParticleContactGeneratorType::ROD_CONSTRAINT, prev,
+      prev, spacing, 0, anchor);
+  for (unsigned int i = 1; i < size; i++) {
+    auto p = scene.add_particle(
+        anchor + v3(spacing * (i + 1), 0, 0), 1, 0.99f,
+        v3(0), v3::GRAVITY);
+    scene.add_link(ParticleContactGeneratorType::CABLE,
+                   prev, p, spacing, 0.3f);
+    prev = p;
+  }
+  return scene;
+}
+
+/**
+  \brief square spring cloth pinned along its top edge
+
+  size: particles per side
+
+  Structural and shear springs between neighbours, stiff
+  enough that the cloth hangs within a few percent of its
+  rest size. Explicit springs that stiff need steps far
+  below the default 1/60 s, so the scene integrates them
+  with backward Euler.
+ */
+inline SceneDescription
+describe_spring_cloth(unsigned int size) {
+  SceneDescription scene;
+  scene.implicit_springs = true;
+  const real spacing = 0.25f, mass = 0.1f;
+  const real stiffness = 5000.0f;
+  const real diagonal = spacing * std::sqrt(2.0f);
+  const real pinned = std::numeric_limits<real>::infinity();
+  for (unsigned int r = 0; r < size; r++) {
+    for (unsigned int c = 0; c < size; c++)
+      scene.add_particle(v3(c * spacing, 10 - r * spacing,
+                            0),
+                         r == 0 ? pinned : mass, 0.9f);
+  }
+  for (unsigned int r = 0; r < size; r++) {
+    for (unsigned int c = 0; c < size; c++) {
+      auto p = r * size + c;
+      scene.add_gravity(p, v3::GRAVITY);
+      if (c + 1 < size)
+        scene.add_spring(p, p + 1, stiffness, spacing);
+      if (r + 1 < size)
+        scene.add_spring(p, p + size, stiffness, spacing);
+      if (c + 1 < size && r + 1 < size) {
+        scene.add_spring(p, p + size + 1, stiffness,
+                         diagonal);
+        scene.add_spring(p + 1, p + size, stiffness,
+                         diagonal);
+      }
+    }
+  }
+  return scene;
+}
+
+/**
+  \brief particles dropped onto the ground in a column
+
+  size: number of particles
+ */
+inline SceneDescription
+describe_ground_pile(unsigned int size) {
+  SceneDescription scene;
+  scene.max_contacts = size + 1;
+  SceneRandom rnd(7);
+  for (unsigned int i = 0; i < size; i++) {
+    v3 position =
+        rnd.uniform(v3(-1, 0.5f, -1), v3(1, 4, 1));
+    auto p = scene.add_particle(
+        position, rnd.uniform(0.5f, 2.0f), 0.95f);
+    scene.add_gravity(p, v3::GRAVITY);
+  }
+  scene.add_ground();
+  return scene;
+}
+
+/**
+  \brief floating crates in a pool with drag
+
+  size: number of particles
+ */
+inline SceneDescription
+describe_buoyancy_pool(unsigned int size) {
+  SceneDescription scene;
+  scene.max_contacts = 1;
+  SceneRandom rnd(11);
+  for (unsigned int i = 0; i < size; i++) {
+    v3 position =
+        rnd.uniform(v3(-20, 0, -20), v3(20, 4, 20));
+    auto p = scene.add_particle(
+        position, rnd.uniform(20.0f, 150.0f), 0.95f);
+    scene.add_gravity(p, v3::GRAVITY);
+    scene.add_drag(p, 0.1f, 0.01f);
+    scene.add_buoyancy(p, 0.5f, 1.0f, 2.0f);
+  }
+  return scene;
+}
+
+struct SceneEntry {
+  std::string name;
+  /**size used when none is given*/
+  unsigned int default_size;
+  std::function<SceneDescription(unsigned int)> describe;
+};
+
+inline std::vector<SceneEntry> scene_catalog() {
+  return {
+      {"ballistic_swarm", 100000, describe_ballistic_swarm},
+      {"rod_truss", 40, describe_rod_truss},
+      {"cable_chain", 100, describe_cable_chain},
+      {"spring_cloth", 32, describe_spring_cloth},
+      {"ground_pile", 200, describe_ground_pile},
+      {"buoyancy_pool", 20000, describe_buoyancy_pool},
+  };
+}
+};
@@ -0,0 +1,96 @@
+#pragma once
+// SPH dam break in a box
+#include "harness.hpp"
+#include <vivaphysics/psph.hpp>
+
+using namespace vivaphysics;
+
+namespace vivabench {
+
+/**
+  \brief column of size liquid particles collapsing in a
+  box, stepped with the fluid forces, gravity and the
+  integrator
+
+  The box walls are handled here by clamping positions and
+  reflecting velocities, the engine has no fluid boundary
+  yet. Steps are capped at 2 ms for stability.
+ */
+inline void run_sph_bench(unsigned int size,
+                          const BenchConfig &config,
+                          std::ostream &out) {
+  const real h = 0.1f, spacing = h / 2;
+  const real rest = 1000.0f;
+  auto fluid = std::make_shared<ParticleSPHFluid>(
+      h, rest, 50.0f, 0.5f);
+  // column twice as high as wide
+  auto side = static_cast<unsigned int>(
+      std::ceil(std::cbrt(size / 2.0)));
+  const v3 box_lo(0, 0, 0);
+  const v3 box_hi(4.0f * side * spacing, 10,
+                  side * spacing);
+  for (unsigned int i = 0; i < size; i++) {
+    unsigned int x = i % side, z = (i / side) % side,
+                 y = i / (side * side);
+    auto particle_ptr = std::make_shared<Particle>();
+    particle_ptr->set_position(v3(x + 0.5f, y + 0.5f,
+                                  z + 0.5f) *
+                               spacing);
+    particle_ptr->set_mass(rest * spacing * spacing *
+                           spacing);
+    particle_ptr->set_acceleration(0, -9.81f, 0);
+    particle_ptr->set_damping(1.0f);
+    particle_ptr->clear_accumulator();
+    fluid->bodies.push_back(particle_ptr);
+  }
+  std::shared_ptr<ThreadPool> pool;
+  if (config.threads > 1)
+    pool = std::make_shared<ThreadPool>(config.threads);
+
+  real dt = std::min(config.duration, 0.002f);
+  double forces_ns = 0, total_ns = 0;
+  for (unsigned int s = 0; s < config.warmup + config.steps;
+       s++) {
+    auto t0 = BenchClock::now();
+    fluid->update_forces(dt, pool.get());
+    auto t1 = BenchClock::now();
+    for (auto &p : fluid->bodies) {
+      p->integrate(dt);
+      v3 pos = p->get_position(), vel = p->get_velocity();
+      for (unsigned int c = 0; c < 3; c++) {
+        if (pos[c] < box_lo[c] || pos[c] > box_hi[c]) {
+          pos[c] = std::min(std::max(pos[c], box_lo[c]),
+                            box_hi[c]);
+          vel[c] *= -0.5f;
+        }
+      }
+      p->set_position(pos);
+      p->set_velocity(vel);
+    }
+    auto t2 = BenchClock::now();
+    if (s >= config.warmup) {
+      forces_ns += elapsed_ns(t0, t1);
+      total_ns += elapsed_ns(t0, t2);
+    }
+  }
+
+  double density = 0, max_speed = 0;
+  for (real d : fluid->get_densities())
+    density += d;
+  density /= std::max(size, 1u);
+  for (auto &p : fluid->bodies)
+    max_speed = std::max(
+        max_speed,
+        static_cast<double>(p->get_velocity().magnitude()));
+  auto steps = std::max(config.steps, 1u);
+  out << "{\"scene\":\"sph_dam\",\"size\":" << size
+      << ",\"threads\":" << config.threads
+      << ",\"dt\":" << dt
+      << ",\"ms_per_step\":" << total_ns / steps / 1e6
+      << ",\"sph_ms_per_step\":"
+      << forces_ns / steps / 1e6
+      << ",\"mean_density_ratio\":" << density / rest
+      << ",\"max_speed\":" << max_speed << "}"
+      << std::endl;
+}
+};
@@ -8,6 +8,7 @@
 #include <vivaphysics/pcontact.hpp>
 #include <vivaphysics/pfgen.hpp>
 #include <vivaphysics/plink.hpp>
+#include <vivaphysics/ppool.hpp>
 #include <vivaphysics/pworld.hpp>
 
 using namespace vivademos;
@@ -16,9 +17,14 @@ namespace vivademos {
 
 class BallisticMeshDemo : public MeshDemoApp {
 private:
-  // const unsigned int max_ammo = 16;
+  static constexpr unsigned int max_ammo = 16;
 
-  // AmmoRound ammo[16];
+  /**shots in flight, they live for five seconds*/
+  ParticlePool shots = ParticlePool(max_ammo);
+  /**below the ground or beyond the visible range*/
+  std::vector<KillRegion> kill_regions;
+
+  /**shape drawn at the position of each shot*/
   AmmoRound ammo;
   /** holds the current shot type*/
   ShotType current_stype;
@@ -27,54 +33,74 @@ private:
     if (current_stype == ShotType::UNUSED) {
       return;
     }
+    // no round left, wait for one to retire
+    if (shots.size() == max_ammo) {
+      return;
+    }
+    Particle p;
 
     // choose shot type
     switch (current_stype) {
     case ShotType::UNUSED:
-      ammo.stype = current_stype;
       return;
       break;
     case ShotType::PISTOL:
-      ammo.particle.set_mass(2.0f);
-      ammo.particle.set_velocity(0, 0, 35);
-      ammo.particle.set_acceleration(0, -1.0f, 0);
-      ammo.particle.set_damping(0.99f);
+      p.set_mass(2.0f);
+      p.set_velocity(0, 0, 35);
+      p.set_acceleration(0, -1.0f, 0);
+      p.set_damping(0.99f);
       break;
     case ShotType::ARTILLERY:
-      ammo.particle.set_mass(200.0f);
-      ammo.particle.set_velocity(0, 30, 40);
-      ammo.particle.set_acceleration(0, -20.0f, 0);
-      ammo.particle.set_damping(0.99f);
+      p.set_mass(200.0f);
+      p.set_velocity(0, 30, 40);
+      p.set_acceleration(0, -20.0f, 0);
+      p.set_damping(0.99f);
       break;
     case ShotType::FIREBALL:
-      ammo.particle.set_mass(1.0f);
-      ammo.particle.set_velocity(0, 0, 10);
-      ammo.particle.set_acceleration(0, 0.6f, 0);
-      ammo.particle.set_damping(0.9f);
+      p.set_mass(1.0f);
+      p.set_velocity(0, 0, 10);
+      p.set_acceleration(0, 0.6f, 0);
+      p.set_damping(0.9f);
       break;
     case ShotType::LASER:
-      ammo.particle.set_mass(0.1f);
-      ammo.particle.set_velocity(0, 0, 100.f);
-      ammo.particle.set_acceleration(0, 0.0f,
-                                     0); // no gravity
-      ammo.particle.set_damping(0.99f);
+      p.set_mass(0.1f);
+      p.set_velocity(0, 0, 100.f);
+      p.set_acceleration(0, 0.0f, 0); // no gravity
+      p.set_damping(0.99f);
       break;
     }
-    ammo.particle.set_position(1.0f, 1.0f, 1.0f);
-    ammo.stype = current_stype;
-    // set timing
-    ammo.start_time = last_time;
+    p.set_position(1.0f, 1.0f, 1.0f);
 
     // clear accumulated force
-    ammo.particle.clear_accumulator();
+    p.clear_accumulator();
+    shots.spawn(p, 5.0f);
+  }
+
+  void set_kill_regions() {
+    kill_regions.push_back(KillRegion::below(1, 0.0f));
+    kill_regions.push_back(
+        KillRegion::above(2, far_plane_dist));
+  }
+
+  void draw_shots(Shader &shader) {
+    for (const auto &p : shots) {
+      ammo.particle = p;
+      modelMat = ammo.get_model_mat();
+      shader.setMat4Uni("model", modelMat);
+      ammo.draw();
+    }
   }
 
 public:
   BallisticMeshDemo()
-      : MeshDemoApp(), current_stype(ShotType::LASER) {}
+      : MeshDemoApp(), current_stype(ShotType::LASER) {
+    set_kill_regions();
+  }
   BallisticMeshDemo(int w, int h, std::string title)
       : MeshDemoApp(w, h, title),
-        current_stype(ShotType::LASER) {}
+        current_stype(ShotType::LASER) {
+    set_kill_regions();
+  }
   std::string get_title() override {
     return "Ballistic Demo Application";
   }
@@ -84,24 +110,8 @@ public:
       return;
 
     // update physics tick for each particle
-    if (ammo.stype != ShotType::UNUSED) {
-      // run the physics
-      ammo.particle.integrate(duration);
-
-      // check if the shot is still visible
-      // not on screen
-      bool cond1 = ammo.particle.get_position().y < 0.0f;
-
-      // takes too long
-      bool cond2 = ammo.start_time + 5000 < last_time;
-
-      // beyond visible range
-      bool cond3 =
-          ammo.particle.get_position().z > far_plane_dist;
-      if (cond1 || cond2 || cond3) {
-        ammo.stype = ShotType::UNUSED;
-      }
-    }
+    shots.integrate(duration);
+    shots.retire(duration, kill_regions);
   }
 
   void set_scene_objects() override {
@@ -116,9 +126,7 @@ public:
     glm::mat4 identityModel = glm::mat4(1.0f);
 
     // draw scene from light's perspective
-    modelMat = ammo.get_model_mat();
-    depth_shader.setMat4Uni("model", modelMat);
-    ammo.draw();
+    draw_shots(depth_shader);
 
     depth_shader.setMat4Uni("model", identityModel);
     plane.draw();
@@ -131,9 +139,7 @@ public:
     obj_shader.setVec3Uni("diffColor",
                           glm::vec3(0.2, 0.7, 0.2));
 
-    modelMat = ammo.get_model_mat();
-    obj_shader.setMat4Uni("model", modelMat);
-    ammo.draw();
+    draw_shots(obj_shader);
   }
 
   void update() override {
@@ -18,10 +18,13 @@
 #include <memory>
 
 // thirdparty modules
+// headless targets only need the physics and glm
+#ifndef VIVAPHYSICS_HEADLESS
 // gl pointer
 #include <glad/glad.h>
 // window manager
 #include <GLFW/glfw3.h>
+#endif
 // glm
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -0,0 +1,192 @@
+#pragma once
+// worker threads for the simulation loop
+#include <condition_variable>
+#include <external.hpp>
+#include <mutex>
+#include <thread>
+
+namespace vivaphysics {
+
+/**
+  \brief fixed size pool of worker threads
+
+  Work is always split into contiguous chunks in index
+  order, so the chunk given to a worker depends only on the
+  item count and the thread count, never on scheduling.
+ */
+class ThreadPool {
+protected:
+  typedef std::function<void(unsigned int, unsigned int,
+                             unsigned int)>
+      ChunkFn;
+
+  std::vector<std::thread> workers;
+  std::mutex mtx;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+
+  ChunkFn job;
+  unsigned int job_count = 0;
+  unsigned int generation = 0;
+  unsigned int pending = 0;
+  bool stopping = false;
+
+  void chunk_bounds(unsigned int tid, unsigned int count,
+                    unsigned int &begin,
+                    unsigned int &end) const {
+    unsigned int nb = nb_threads();
+    begin = static_cast<unsigned int>(
+        (static_cast<unsigned long>(count) * tid) / nb);
+    end = static_cast<unsigned int>(
+        (static_cast<unsigned long>(count) * (tid + 1)) /
+        nb);
+  }
+
+  void worker_loop(unsigned int tid) {
+    unsigned int seen = 0;
+    while (true) {
+      ChunkFn fn;
+      unsigned int count;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        work_cv.wait(lock, [&] {
+          return stopping || generation != seen;
+        });
+        if (stopping)
+          return;
+        seen = generation;
+        fn = job;
+        count = job_count;
+      }
+      unsigned int begin, end;
+      chunk_bounds(tid, count, begin, end);
+      if (begin < end)
+        fn(begin, end, tid);
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        pending--;
+      }
+      done_cv.notify_one();
+    }
+  }
+
+public:
+  /**the calling thread always works as thread 0, so a
+   * pool of n threads spawns n - 1 workers*/
+  ThreadPool(unsigned int nb) {
+    if (nb == 0)
+      nb = 1;
+    for (unsigned int i = 1; i < nb; i++) {
+      workers.push_back(
+          std::thread([this, i] { worker_loop(i); }));
+    }
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopping = true;
+    }
+    work_cv.notify_all();
+    for (auto &w : workers)
+      w.join();
+  }
+
+  unsigned int nb_threads() const {
+    return static_cast<unsigned int>(workers.size()) + 1;
+  }
+
+  /**
+    \brief run fn(begin, end, thread_id) over [0, count)
+
+    Blocks until every chunk has been processed.
+   */
+  void parallel_for(unsigned int count, const ChunkFn &fn) {
+    if (count == 0)
+      return;
+    if (workers.empty() || count == 1) {
+      fn(0, count, 0);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      job = fn;
+      job_count = count;
+      pending = static_cast<unsigned int>(workers.size());
+      generation++;
+    }
+    work_cv.notify_all();
+
+    unsigned int begin, end;
+    chunk_bounds(0, count, begin, end);
+    if (begin < end)
+      fn(begin, end, 0);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    done_cv.wait(lock, [this] { return pending == 0; });
+  }
+};
+
+/**run fn over [0, count) on the pool if there is one,
+ * inline otherwise*/
+inline void
+parallel_for(ThreadPool *pool, unsigned int count,
+             const std::function<void(unsigned int,
+                                      unsigned int,
+                                      unsigned int)> &fn) {
+  if (pool == nullptr) {
+    if (count > 0)
+      fn(0, count, 0);
+    return;
+  }
+  pool->parallel_for(count, fn);
+}
+
+/**
+  \brief sort [first, last) on the pool threads
+
+  Each thread sorts one chunk, then the chunks are merged
+  pairwise. comp must be a strict total order, ties would
+  otherwise be broken differently for different thread
+  counts.
+ */
+template <class It, class Comp>
+void parallel_sort(ThreadPool *pool, It first, It last,
+                   Comp comp) {
+  auto n = static_cast<unsigned int>(last - first);
+  unsigned int nb = pool ? pool->nb_threads() : 1;
+  if (nb == 1 || n < 4096) {
+    std::sort(first, last, comp);
+    return;
+  }
+  auto bound = [n, nb](unsigned int c) {
+    return static_cast<unsigned int>(
+        (static_cast<unsigned long>(n) * c) / nb);
+  };
+  parallel_for(pool, nb,
+               [&](unsigned int begin, unsigned int end,
+                   unsigned int) {
+                 for (unsigned int c = begin; c < end; c++)
+                   std::sort(first + bound(c),
+                             first + bound(c + 1), comp);
+               });
+  for (unsigned int width = 1; width < nb; width *= 2) {
+    unsigned int nb_pairs =
+        (nb + 2 * width - 1) / (2 * width);
+    parallel_for(
+        pool, nb_pairs,
+        [&](unsigned int begin, unsigned int end,
+            unsigned int) {
+          for (unsigned int k = begin; k < end; k++) {
+            unsigned int lo = 2 * width * k;
+            unsigned int mid = std::min(lo + width, nb);
+            unsigned int hi = std::min(lo + 2 * width, nb);
+            std::inplace_merge(first + bound(lo),
+                               first + bound(mid),
+                               first + bound(hi), comp);
+          }
+        });
+  }
+}
+};
@@ -0,0 +1,140 @@
+#pragma once
+// contacts remembered from one step to the next
+#include <cstdint>
+#include <external.hpp>
+#include <unordered_map>
+#include <vivaphysics/pcontact.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief identity of a contact across steps: the generator
+  that made it and its particles
+ */
+struct ContactKey {
+  std::uint64_t generator = 0;
+  const Particle *a = nullptr;
+  const Particle *b = nullptr;
+
+  ContactKey() {}
+  ContactKey(std::uint64_t g, const ParticleContact &c)
+      : generator(g), a(c.particles.ps[0].get()),
+        b(c.particles.is_double ? c.particles.ps[1].get()
+                                : nullptr) {}
+
+  bool operator==(const ContactKey &k) const {
+    return generator == k.generator && a == k.a &&
+           b == k.b;
+  }
+};
+
+struct ContactKeyHash {
+  std::size_t operator()(const ContactKey &k) const {
+    std::uint64_t h = k.generator * 0x9e3779b97f4a7c15ULL;
+    h ^= reinterpret_cast<std::uintptr_t>(k.a) +
+         0x7f4a7c159e3779b9ULL + (h << 6) + (h >> 2);
+    h ^= reinterpret_cast<std::uintptr_t>(k.b) +
+         0x7f4a7c159e3779b9ULL + (h << 6) + (h >> 2);
+    return static_cast<std::size_t>(h);
+  }
+};
+
+/**
+  \brief impulses of the contacts of the previous steps,
+  to warm start the resolver with
+
+  Before resolving, warm() applies to every contact that
+  was seen recently the impulse it ended its last step
+  with. Resting contacts then start close to balance and
+  the resolver only corrects what changed, instead of
+  rebuilding the whole support from zero every step.
+  store() records the impulses the step ended with and
+  sweep() drops the contacts not seen for max_age steps.
+
+  Lookups go through a hash map but the impulses are
+  applied in contact order, so the result stays bit
+  reproducible.
+ */
+class ParticleContactCache {
+protected:
+  struct Entry {
+    real impulse;
+    v3 normal;
+    std::uint64_t step;
+  };
+  std::unordered_map<ContactKey, Entry, ContactKeyHash>
+      entries;
+  std::uint64_t step = 0;
+
+public:
+  /**fraction of the remembered impulse applied*/
+  real warm_start = 1;
+  /**smallest cosine between the old and the new normal
+   * for the impulse to carry over, rods flip theirs*/
+  real min_alignment = 0.9f;
+  /**steps a contact may be missing and still warm start,
+   * ground contacts come and go every other step*/
+  unsigned int max_age = 2;
+
+  /**last warm started count*/
+  unsigned int nb_warm = 0;
+
+  std::size_t size() const { return entries.size(); }
+  void clear() { entries.clear(); }
+
+  /**reset the impulses of the first n contacts and apply
+   * the remembered ones*/
+  void warm(std::vector<ParticleContact> &contacts,
+            const std::vector<ContactKey> &keys,
+            unsigned int n) {
+    step++;
+    nb_warm = 0;
+    for (unsigned int i = 0; i < n; i++) {
+      auto &contact = contacts[i];
+      contact.impulse = 0;
+      contact.warm_impulse = 0;
+      if (keys[i].a == nullptr)
+        continue;
+      auto it = entries.find(keys[i]);
+      if (it == entries.end())
+        continue;
+      const auto &entry = it->second;
+      if (entry.impulse <= 0 ||
+          entry.normal.dot(contact.contact_normal) <
+              min_alignment)
+        continue;
+      contact.apply_impulse(entry.impulse * warm_start);
+      contact.warm_impulse = contact.impulse;
+      nb_warm++;
+    }
+  }
+
+  /**remember the impulses of the first n contacts*/
+  void store(const std::vector<ParticleContact> &contacts,
+             const std::vector<ContactKey> &keys,
+             unsigned int n) {
+    for (unsigned int i = 0; i < n; i++)
+      if (keys[i].a != nullptr)
+        entries[keys[i]] =
+            Entry{contacts[i].impulse,
+                  contacts[i].contact_normal, step};
+  }
+
+  /**drop the contacts not seen for more than max_age
+   * steps, returns how many went*/
+  unsigned int sweep() {
+    unsigned int nb = 0;
+    for (auto it = entries.begin(); it != entries.end();) {
+      if (step - it->second.step > max_age) {
+        it = entries.erase(it);
+        nb++;
+      } else {
+        ++it;
+      }
+    }
+    return nb;
+  }
+};
+};
@@ -0,0 +1,390 @@
+#pragma once
+// direct solver for chains of links
+#include <cstdint>
+#include <external.hpp>
+#include <unordered_map>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/plink.hpp>
+#include <vivaphysics/profiler.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief rods and cables forming unbranched chains, solved
+  exactly in O(n) per chain
+
+  The links of a chain couple only their neighbours, so the
+  impulses making every link hit its target at once solve a
+  symmetric tridiagonal system
+
+    (w_k + w_k+1) l_k - w_k n_k-1.n_k l_k-1
+                      - w_k+1 n_k.n_k+1 l_k+1 = c_k
+
+  with w the inverse masses of the nodes and n the link
+  directions. It is solved by elimination for the lengths
+  until they are within tolerance, at most
+  position_iterations times, then once for the velocities
+  along the corrected links so that they do not stretch
+  the chain on the next step. The iterative resolver needs
+  a number of iterations proportional to the chain length
+  to carry a correction from one end to the other.
+
+  Rods, cables and their anchored versions form chains
+  when none of their particles has more than two links, an
+  anchor ends its chain. Links meeting at a branch and
+  closed loops are left to the general resolver. Cables
+  only pull: a taut cable is kept in the system while its
+  impulse pulls, which takes at most MAX_PASSES solves.
+  Chains share no particle and are solved on the pool
+  threads independently.
+ */
+class ParticleChainSolver {
+public:
+  /**solves per chain to settle which cables pull*/
+  static constexpr unsigned int MAX_PASSES = 4;
+  /**cables this close to their length count as taut*/
+  static constexpr real TAUT = 1e-3f;
+
+  /**most linearized length corrections per step*/
+  unsigned int position_iterations = 8;
+  /**length error left, relative to the link length*/
+  real tolerance = 1e-4f;
+
+protected:
+  /**a particle, or an anchor when p is null*/
+  struct Node {
+    std::shared_ptr<Particle> p;
+    v3 anchor;
+  };
+  struct Link {
+    real length;
+    real restitution;
+    bool cable;
+  };
+
+  /**nodes of chain c are [node_start[c],
+   * node_start[c + 1]), its links start at
+   * node_start[c] - c*/
+  std::vector<unsigned int> node_start;
+  std::vector<Node> nodes;
+  std::vector<Link> links;
+
+  // per node state, per link system
+  std::vector<v3> xs, vs, normals;
+  std::vector<real> ws, lengths;
+  std::vector<real> diag, off, rhs, lambda;
+  std::vector<real> pivot, reduced;
+  std::vector<std::uint8_t> active;
+  /**cables that may not enter the system*/
+  std::vector<std::uint8_t> slack;
+
+  static bool is_link(ParticleContactGeneratorType t) {
+    return t == ParticleContactGeneratorType::ROD ||
+           t == ParticleContactGeneratorType::CABLE;
+  }
+  static bool is_anchored(ParticleContactGeneratorType t) {
+    return t == ParticleContactGeneratorType::
+                    ROD_CONSTRAINT ||
+           t == ParticleContactGeneratorType::
+                    CABLE_CONSTRAINT;
+  }
+
+  /**
+    elimination on the active rows of links [first, last),
+    inactive rows get a zero impulse and no coupling
+   */
+  void eliminate(unsigned int first, unsigned int last) {
+    for (unsigned int k = first; k < last; k++) {
+      bool on = active[k] && diag[k] > 0;
+      real a = on ? diag[k] : 1;
+      real r = on ? rhs[k] : 0;
+      if (on && k > first && active[k - 1] &&
+          diag[k - 1] > 0) {
+        real b = off[k - 1];
+        real factor = b / pivot[k - 1];
+        a -= factor * b;
+        r -= factor * reduced[k - 1];
+      }
+      pivot[k] = a;
+      reduced[k] = r;
+    }
+    for (unsigned int k = last; k-- > first;) {
+      bool on = active[k] && diag[k] > 0;
+      real r = reduced[k];
+      if (on && k + 1 < last && active[k + 1] &&
+          diag[k + 1] > 0)
+        r -= off[k] * lambda[k + 1];
+      lambda[k] = on ? r / pivot[k] : 0;
+    }
+  }
+
+  /**
+    solve for the impulses, dropping cables that would
+    push and taking in cables left beyond their target
+   */
+  void solve_rows(unsigned int first, unsigned int last) {
+    for (unsigned int pass = 0; pass < MAX_PASSES;
+         pass++) {
+      eliminate(first, last);
+      bool changed = false;
+      for (unsigned int k = first; k < last; k++) {
+        if (!links[k].cable || slack[k])
+          continue;
+        // remaining error once the impulses apply
+        real left = rhs[k] - diag[k] * lambda[k];
+        if (k > first)
+          left -= off[k - 1] * lambda[k - 1];
+        if (k + 1 < last)
+          left -= off[k] * lambda[k + 1];
+        bool keep = active[k] ? lambda[k] >= 0 : left > 0;
+        if (keep != static_cast<bool>(active[k])) {
+          active[k] = keep;
+          changed = true;
+        }
+      }
+      if (!changed)
+        return;
+    }
+    eliminate(first, last);
+  }
+
+  /**directions, lengths and matrix of chain c*/
+  void setup(unsigned int c) {
+    unsigned int n0 = node_start[c], n1 = node_start[c + 1];
+    unsigned int l0 = n0 - c;
+    for (unsigned int j = n0; j + 1 < n1; j++) {
+      unsigned int k = l0 + j - n0;
+      v3 d = xs[j + 1] - xs[j];
+      lengths[k] = d.magnitude();
+      normals[k] = lengths[k] > 0 ? d * (1 / lengths[k])
+                                  : v3(0);
+      diag[k] = ws[j] + ws[j + 1];
+      if (j > n0)
+        off[k - 1] =
+            -ws[j] * normals[k - 1].dot(normals[k]);
+    }
+  }
+
+  /**apply impulses lambda along the links to out*/
+  void apply(unsigned int c, std::vector<v3> &out) {
+    unsigned int n0 = node_start[c], n1 = node_start[c + 1];
+    unsigned int l0 = n0 - c;
+    for (unsigned int j = n0; j + 1 < n1; j++) {
+      unsigned int k = l0 + j - n0;
+      v3 step = normals[k] * lambda[k];
+      out[j] += step * ws[j];
+      out[j + 1] -= step * ws[j + 1];
+    }
+  }
+
+  void solve_chain(unsigned int c) {
+    unsigned int n0 = node_start[c], n1 = node_start[c + 1];
+    unsigned int l0 = n0 - c, l1 = n1 - c - 1;
+    for (unsigned int j = n0; j < n1; j++) {
+      const auto &p = nodes[j].p;
+      ws[j] = p ? std::max(p->get_inverse_mass(), real(0))
+                : 0;
+      xs[j] = p ? p->get_position() : nodes[j].anchor;
+      vs[j] = p ? p->get_velocity() : v3(0);
+    }
+
+    // positions: rods back to length, cables within it
+    for (unsigned int it = 0; it < position_iterations;
+         it++) {
+      setup(c);
+      bool any = false;
+      for (unsigned int k = l0; k < l1; k++) {
+        rhs[k] = lengths[k] - links[k].length;
+        active[k] = !links[k].cable ||
+                    rhs[k] > -TAUT * links[k].length;
+        slack[k] = 0;
+        real error = std::abs(rhs[k]);
+        any = any || (active[k] &&
+                      error > tolerance * links[k].length);
+      }
+      if (!any)
+        break;
+      solve_rows(l0, l1);
+      apply(c, xs);
+    }
+
+    // velocities along the corrected links: rods stop
+    // stretching, taut cables bounce
+    setup(c);
+    for (unsigned int j = n0; j + 1 < n1; j++) {
+      unsigned int k = l0 + j - n0;
+      const auto &link = links[k];
+      real rate = normals[k].dot(vs[j + 1] - vs[j]);
+      bool taut = lengths[k] >= link.length * (1 - TAUT);
+      rhs[k] = rate * (1 + (link.cable
+                                ? link.restitution
+                                : 0));
+      active[k] = !link.cable || taut;
+      slack[k] = link.cable && !taut;
+    }
+    solve_rows(l0, l1);
+    apply(c, vs);
+
+    for (unsigned int j = n0; j < n1; j++) {
+      const auto &p = nodes[j].p;
+      if (!p || ws[j] == 0)
+        continue;
+      p->set_position(xs[j]);
+      p->set_velocity(vs[j]);
+    }
+  }
+
+public:
+  unsigned int nb_chains() const {
+    return node_start.empty()
+               ? 0
+               : static_cast<unsigned int>(
+                     node_start.size() - 1);
+  }
+  unsigned int nb_links() const {
+    return static_cast<unsigned int>(links.size());
+  }
+
+  /**
+    \brief find the chains among the links
+
+    Sets solved[i] for every link i that belongs to a
+    chain, the others are for the general resolver. Chains
+    are walked in link order, so the result only depends
+    on that order.
+   */
+  void
+  build(const std::vector<ParticleContactWrapper> &data,
+        std::vector<std::uint8_t> &solved) {
+    VP_PROFILE_ZONE("chains/build");
+    auto n = static_cast<unsigned int>(data.size());
+    solved.assign(n, 0);
+    node_start.clear();
+    nodes.clear();
+    links.clear();
+
+    // particles of each usable link, b null if anchored
+    std::vector<std::pair<Particle *, Particle *>> ends(n);
+    std::unordered_map<Particle *, unsigned int> degree;
+    for (unsigned int i = 0; i < n; i++) {
+      const auto &w = data[i];
+      const auto &ps = w.contact_ps.ps;
+      ends[i] = {nullptr, nullptr};
+      if (is_link(w.type) && ps.size() >= 2 && ps[0] &&
+          ps[1] && ps[0] != ps[1]) {
+        ends[i] = {ps[0].get(), ps[1].get()};
+        degree[ps[0].get()]++;
+        degree[ps[1].get()]++;
+      } else if (is_anchored(w.type) && !ps.empty() &&
+                 ps[0]) {
+        ends[i] = {ps[0].get(), nullptr};
+        degree[ps[0].get()]++;
+      }
+    }
+
+    // links of each particle with at most two of them
+    typedef std::pair<unsigned int, unsigned int> Pair;
+    std::unordered_map<Particle *, Pair> incident;
+    const unsigned int none = ~0u;
+    std::vector<std::uint8_t> usable(n, 0);
+    for (unsigned int i = 0; i < n; i++) {
+      auto [a, b] = ends[i];
+      if (a == nullptr || degree[a] > 2 ||
+          (b != nullptr && degree[b] > 2))
+        continue;
+      usable[i] = 1;
+      for (Particle *p : {a, b}) {
+        if (p == nullptr)
+          continue;
+        auto it = incident.find(p);
+        if (it == incident.end())
+          incident[p] = {i, none};
+        else
+          it->second.second = i;
+      }
+    }
+
+    std::vector<std::uint8_t> visited(n, 0);
+    auto push_node = [&](unsigned int i, Particle *p) {
+      Node node;
+      const auto &ps = data[i].contact_ps.ps;
+      if (p == nullptr)
+        node.anchor = data[i].anchor;
+      else
+        node.p = ps[0].get() == p ? ps[0] : ps[1];
+      nodes.push_back(node);
+    };
+    // walk from an end: from (link, node) to the next
+    auto walk = [&](unsigned int i, Particle *from) {
+      node_start.push_back(
+          static_cast<unsigned int>(nodes.size()));
+      push_node(i, from);
+      while (true) {
+        visited[i] = 1;
+        solved[i] = 1;
+        links.push_back(
+            {data[i].length_max_length,
+             data[i].restitution,
+             data[i].type ==
+                     ParticleContactGeneratorType::CABLE ||
+                 data[i].type ==
+                     ParticleContactGeneratorType::
+                         CABLE_CONSTRAINT});
+        auto [a, b] = ends[i];
+        Particle *to = from == a ? b : a;
+        push_node(i, to);
+        if (to == nullptr)
+          return;
+        auto inc = incident[to];
+        unsigned int next =
+            inc.first == i ? inc.second : inc.first;
+        if (next == none || visited[next])
+          return;
+        i = next;
+        from = to;
+      }
+    };
+    for (unsigned int i = 0; i < n; i++) {
+      if (!usable[i] || visited[i])
+        continue;
+      auto [a, b] = ends[i];
+      if (b == nullptr) {
+        walk(i, nullptr);
+      } else if (incident[a].second == none) {
+        walk(i, a);
+      } else if (incident[b].second == none) {
+        walk(i, b);
+      }
+    }
+    node_start.push_back(
+        static_cast<unsigned int>(nodes.size()));
+    if (node_start.size() == 1)
+      node_start.clear();
+
+    auto nb_nodes = nodes.size(), nb = links.size();
+    xs.resize(nb_nodes);
+    vs.resize(nb_nodes);
+    ws.resize(nb_nodes);
+    for (auto *v : {&lengths, &diag, &off, &rhs, &lambda,
+                    &pivot, &reduced})
+      v->resize(nb);
+    normals.resize(nb);
+    active.resize(nb);
+    slack.resize(nb);
+  }
+
+  /**velocities then positions of every chain*/
+  void solve(ThreadPool *pool = nullptr) {
+    VP_PROFILE_ZONE("chains/solve");
+    parallel_for(
+        pool, nb_chains(),
+        [this](unsigned int begin, unsigned int end,
+               unsigned int) {
+          for (unsigned int c = begin; c < end; c++)
+            solve_chain(c);
+        });
+  }
+};
+};
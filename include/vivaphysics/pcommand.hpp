@@ -0,0 +1,184 @@
+#pragma once
+// commands posted to a world from other threads
+#include <atomic>
+#include <external.hpp>
+#include <vivaphysics/pfgen.hpp>
+#include <vivaphysics/plink.hpp>
+
+namespace vivaphysics {
+
+/**
+  \brief multi producer, single consumer queue
+
+  Producers push with a single compare and swap on the head
+  and never wait for the consumer. The consumer takes the
+  whole list with one exchange and replays it oldest first,
+  so a drain is wait free and commands of one producer keep
+  their order. Nodes are only popped all at once, which
+  keeps the stack free of ABA.
+ */
+template <class T> class CommandQueue {
+protected:
+  struct Node {
+    T value;
+    Node *next;
+    Node(const T &v) : value(v), next(nullptr) {}
+  };
+  std::atomic<Node *> head;
+
+  static void destroy(Node *n) {
+    while (n != nullptr) {
+      Node *next = n->next;
+      delete n;
+      n = next;
+    }
+  }
+
+public:
+  CommandQueue() : head(nullptr) {}
+  /**a copy starts empty, pending commands belong to the
+   * queue they were posted to*/
+  CommandQueue(const CommandQueue &) : head(nullptr) {}
+  CommandQueue &operator=(const CommandQueue &) {
+    return *this;
+  }
+  ~CommandQueue() { destroy(head.load()); }
+
+  /**safe from any thread*/
+  void push(const T &value) {
+    Node *n = new Node(value);
+    n->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(
+        n->next, n, std::memory_order_release,
+        std::memory_order_relaxed)) {
+    }
+  }
+
+  bool empty() const {
+    return head.load(std::memory_order_relaxed) == nullptr;
+  }
+
+  /**
+    \brief apply fn to every pending value, oldest first
+
+    Only one thread may drain at a time. Values pushed while
+    draining wait for the next drain.
+   */
+  template <class F> unsigned int drain(F fn) {
+    Node *n =
+        head.exchange(nullptr, std::memory_order_acquire);
+    // the stack is newest first
+    Node *ordered = nullptr;
+    while (n != nullptr) {
+      Node *next = n->next;
+      n->next = ordered;
+      ordered = n;
+      n = next;
+    }
+    unsigned int count = 0;
+    for (Node *c = ordered; c != nullptr; c = c->next) {
+      fn(c->value);
+      count++;
+    }
+    destroy(ordered);
+    return count;
+  }
+};
+
+enum class WorldCommandType {
+  SPAWN = 0,
+  DESPAWN = 1,
+  ADD_FORCE = 2,
+  REMOVE_FORCE = 3,
+  ADD_CONTACT = 4,
+  SET_STATE = 5,
+  REMOVE_CONTACT = 6
+};
+
+/**one deferred change of a world, unused fields are left
+ * default*/
+struct WorldCommand {
+  WorldCommandType type;
+  std::shared_ptr<Particle> particle;
+  /**ADD_FORCE*/
+  ParticleForceGeneratorWrapper force;
+  /**ADD_CONTACT*/
+  ParticleContactWrapper contact;
+  /**REMOVE_FORCE, REMOVE_CONTACT*/
+  Handle handle;
+  /**SET_STATE*/
+  Particle state;
+};
+
+/**
+  \brief changes to a world posted while it may be stepping
+
+  Every function is safe to call from any thread while the
+  world runs. The commands are applied by the stepping
+  thread at the start of the next ParticleWorld::run, in
+  the order each producer posted them. Removals name what
+  they remove by handle; one that went stale before it is
+  applied, e.g. with a despawned particle, does nothing.
+ */
+class WorldCommandQueue
+    : public CommandQueue<WorldCommand> {
+protected:
+  void post(WorldCommandType type,
+            std::shared_ptr<Particle> p) {
+    WorldCommand c;
+    c.type = type;
+    c.particle = p;
+    push(c);
+  }
+
+public:
+  /**the particle can be referred to by later commands right
+   * away, it joins the world at the next step*/
+  std::shared_ptr<Particle> spawn(const Particle &p) {
+    auto particle_ptr = std::make_shared<Particle>(p);
+    post(WorldCommandType::SPAWN, particle_ptr);
+    return particle_ptr;
+  }
+  /**removes the particle with its forces and contacts*/
+  void despawn(std::shared_ptr<Particle> p) {
+    post(WorldCommandType::DESPAWN, p);
+  }
+  void add_force(std::shared_ptr<Particle> p,
+                 const ParticleForceGeneratorWrapper &gen) {
+    WorldCommand c;
+    c.type = WorldCommandType::ADD_FORCE;
+    c.particle = p;
+    c.force = gen;
+    push(c);
+  }
+  /**h is a registration of the world registry*/
+  void remove_force(ForceHandle h) {
+    WorldCommand c;
+    c.type = WorldCommandType::REMOVE_FORCE;
+    c.handle = h;
+    push(c);
+  }
+  void add_contact(const ParticleContactWrapper &pcw) {
+    WorldCommand c;
+    c.type = WorldCommandType::ADD_CONTACT;
+    c.contact = pcw;
+    push(c);
+  }
+  /**h is a contact generator of the world*/
+  void remove_contact(LinkHandle h) {
+    WorldCommand c;
+    c.type = WorldCommandType::REMOVE_CONTACT;
+    c.handle = h;
+    push(c);
+  }
+  /**overwrite the whole state of the particle*/
+  void set_state(std::shared_ptr<Particle> p,
+                 const Particle &state) {
+    WorldCommand c;
+    c.type = WorldCommandType::SET_STATE;
+    c.particle = p;
+    c.state = state;
+    push(c);
+  }
+};
+};
@@ -1,5 +1,6 @@
 #pragma once
 // particle contact
+#include <chrono>
 #include <external.hpp>
 #include <vivaphysics/particle.hpp>
 
@@ -41,13 +42,49 @@ public:
    * phase*/
   v3 particle_movement[3];
 
+  /**impulse applied along the normal this step, warm
+   * start included. Reset by ParticleContactCache::warm*/
+  real impulse = 0;
+  /**part of the warm start impulse not given back yet*/
+  real warm_impulse = 0;
+
   /** resolve the contact for both velocity and
    * interpenetration*/
-  void resolve(real duration) {
-    resolve_velocity(duration);
+  void resolve(real duration, bool accumulated = false) {
+    if (accumulated && warm_impulse > 0 &&
+        compute_separating_velocity() > 0)
+      give_back_impulse();
+    else
+      resolve_velocity(duration);
     resolve_interpenetration(duration);
   }
 
+  /**
+    \brief take back part of the warm start impulse from a
+    separating contact
+
+    Stops the separation but never pulls: at most the warm
+    start impulse is removed, the bounce the resolver gave
+    the contact this step stays. Lets the resolver undo a
+    warm start that pushed too hard.
+   */
+  void give_back_impulse() {
+    if (warm_impulse <= 0)
+      return;
+    real total_inverse_mass =
+        particles.ps[0]->get_inverse_mass();
+    if (particles.is_double)
+      total_inverse_mass +=
+          particles.ps[1]->get_inverse_mass();
+    if (total_inverse_mass <= 0)
+      return;
+    real j = -compute_separating_velocity() /
+             total_inverse_mass;
+    j = std::max(j, -warm_impulse);
+    apply_impulse(j);
+    warm_impulse += j;
+  }
+
   real compute_separating_velocity() const {
     std::shared_ptr<Particle> p1 = particles.ps[0];
     v3 relative_velocity = p1->get_velocity();
@@ -102,6 +139,7 @@ public:
 
     /***/
     real impulse = delta_velocity / total_inverse_mass;
+    this->impulse += impulse;
 
     // impulse per inverse mass
     v3 impulse_per_inverse_mass = contact_normal * impulse;
@@ -123,8 +161,30 @@ public:
     }
   }
 
+  /**
+    push the particles apart by an impulse j along the
+    normal, the first one along it and the second one
+    against it. Used to warm start from a previous step
+   */
+  void apply_impulse(real j) {
+    auto &p1 = particles.ps[0];
+    p1->set_velocity(p1->get_velocity() +
+                     contact_normal *
+                         (j * p1->get_inverse_mass()));
+    if (particles.is_double) {
+      auto &p2 = particles.ps[1];
+      p2->set_velocity(p2->get_velocity() -
+                       contact_normal *
+                           (j * p2->get_inverse_mass()));
+    }
+    impulse += j;
+  }
+
   /**resolve interpenetration for the contact*/
   void resolve_interpenetration(real duration) {
+    // nothing moves unless we get to the end
+    particle_movement[0].clear();
+    particle_movement[1].clear();
     if (penetration <= 0)
       return;
 
@@ -166,60 +226,156 @@ public:
   }
 };
 
+/**
+  \brief iterative contact resolver
+
+  Each iteration resolves the worst contact. The resolver
+  stops once every separating velocity is above
+  -velocity_tolerance and every penetration below
+  penetration_tolerance, or when it runs out of iterations
+  or of time. Both tolerances default to 0, which resolves
+  until nothing is left to resolve.
+
+  After each call, velocity_error and penetration_error
+  hold the largest closing velocity and penetration left,
+  and converged tells whether the tolerances were met.
+ */
 class ParticleContactResolver {
 public:
+  typedef std::chrono::steady_clock Clock;
+
   /** number of iterations allowed*/
   unsigned int nb_iterations;
 
   /**number of used iterations*/
   unsigned int iteration_used;
+
+  /**closing velocity left alone*/
+  real velocity_tolerance = 0;
+  /**penetration left alone*/
+  real penetration_tolerance = 0;
+  /**seconds a call may take, 0 for no limit. The clock
+   * is read once per iteration, the call stops when the
+   * average iteration would not fit*/
+  double time_limit = 0;
+
+  /**largest closing velocity left by the last call*/
+  real velocity_error = 0;
+  /**largest penetration left by the last call*/
+  real penetration_error = 0;
+  /**the last call met both tolerances*/
+  bool converged = true;
+  /**the last call ran out of time*/
+  bool timed_out = false;
+
+  /**
+    contacts may give back their warm start impulse when
+    they separate faster than velocity_tolerance, which
+    then counts as an error. Needed to warm start, see
+    ParticleContactCache
+   */
+  bool accumulated = false;
+  /**separating velocity a give back ignores*/
+  static constexpr real GIVE_BACK_SLOP = real(1e-5);
+
   ParticleContactResolver(unsigned int iter)
-      : nb_iterations(iter) {}
+      : nb_iterations(iter), iteration_used(0) {}
   void set_iterations(unsigned int iter) {
     nb_iterations = iter;
   }
 
+  /**report a step without contacts*/
+  void clear_report() {
+    iteration_used = 0;
+    velocity_error = 0;
+    penetration_error = 0;
+    converged = true;
+    timed_out = false;
+  }
+
+  /**
+    resolves the contact with the most negative separating
+    velocity first; ties go to the lowest index, so a given
+    contact order always produces the same resolution order
+   */
   void
   resolve_contacts(std::vector<ParticleContact> &contacts,
                    unsigned int nb_contacts,
                    real duration) {
     unsigned int i;
     iteration_used = 0;
-    while (iteration_used < nb_iterations) {
+    timed_out = false;
+    auto start = Clock::now();
+    while (true) {
       real rmax = REAL_MAX;
       unsigned int max_index = nb_contacts;
+      real worst_velocity = 0, worst_penetration = 0;
       for (i = 0; i < nb_contacts; i++) {
-        auto contact = contacts[i];
+        const auto &contact = contacts[i];
         real sep_vel =
             contact.compute_separating_velocity();
+        // separation a warm start still pushes, rounding
+        // noise left by a give back excluded
+        real over = accumulated &&
+                            contact.warm_impulse > 0 &&
+                            sep_vel > GIVE_BACK_SLOP
+                        ? sep_vel
+                        : real(0);
+        worst_velocity = std::max(
+            worst_velocity, std::max(-sep_vel, over));
+        worst_penetration = std::max(worst_penetration,
+                                     contact.penetration);
         auto cond1 = sep_vel < rmax;
-        auto cond2 = sep_vel < 0;
-        auto cond3 = contact.penetration > 0;
-        if (cond1 && (cond2 || cond3)) {
+        auto cond2 = sep_vel < -velocity_tolerance;
+        auto cond3 =
+            contact.penetration > penetration_tolerance;
+        auto cond4 = over > velocity_tolerance;
+        if (cond1 && (cond2 || cond3 || cond4)) {
           rmax = sep_vel;
           max_index = i;
         }
       }
+      velocity_error = worst_velocity;
+      penetration_error = worst_penetration;
+      converged =
+          velocity_error <= velocity_tolerance &&
+          penetration_error <= penetration_tolerance;
       //
       // there's nothing worth solving
       if (max_index == nb_contacts)
         break;
+      if (iteration_used >= nb_iterations)
+        break;
+      if (time_limit > 0 && iteration_used != 0) {
+        double elapsed = std::chrono::duration<double>(
+                             Clock::now() - start)
+                             .count();
+        // stop before an iteration that would end late
+        if (elapsed + elapsed / iteration_used >
+            time_limit) {
+          timed_out = true;
+          break;
+        }
+      }
 
       //
-      auto max_contact = contacts[max_index];
-      max_contact.resolve(duration);
+      auto &max_contact = contacts[max_index];
+      max_contact.resolve(duration, accumulated);
       auto max_contact_p1 = max_contact.particles.ps[0];
-      auto max_contact_p2 = max_contact.particles.ps[1];
+      std::shared_ptr<Particle> max_contact_p2;
+      if (max_contact.particles.is_double)
+        max_contact_p2 = max_contact.particles.ps[1];
 
       // update particles
       v3 *move = max_contact.particle_movement;
-      for (auto &contact : contacts) {
+      for (i = 0; i < nb_contacts; i++) {
+        auto &contact = contacts[i];
         auto p1 = contact.particles.ps[0];
         auto is_double = contact.particles.is_double;
         if (p1 == max_contact_p1) {
           contact.penetration -=
               move[0].dot(contact.contact_normal);
-        } else if (p1 == max_contact_p2) {
+        } else if (max_contact_p2 && p1 == max_contact_p2) {
           contact.penetration -=
               move[1].dot(contact.contact_normal);
         }
@@ -228,7 +384,8 @@ public:
           if (p2 == max_contact_p1) {
             contact.penetration +=
                 move[0].dot(contact.contact_normal);
-          } else if (p2 == max_contact_p2) {
+          } else if (max_contact_p2 &&
+                     p2 == max_contact_p2) {
             contact.penetration +=
                 move[1].dot(contact.contact_normal);
           }
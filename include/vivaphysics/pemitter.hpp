@@ -0,0 +1,80 @@
+#pragma once
+// particle emitters feeding a ParticlePool
+#include <external.hpp>
+#include <random>
+#include <vivaphysics/ppool.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief spawns particles at a steady rate
+
+  Every value is drawn uniformly in value +- spread, from
+  the raw output of a seeded engine so a run is repeatable
+  on any standard library. Fractions of a particle carry
+  over to the next step, so the rate holds for any step
+  size.
+ */
+struct ParticleEmitter {
+  /**particles per second*/
+  real rate = 0;
+  v3 position;
+  v3 position_spread;
+  v3 velocity;
+  v3 velocity_spread;
+  v3 acceleration;
+  real mass = 1;
+  real mass_spread = 0;
+  real damping = 0.99f;
+  /**seconds, infinite lifetimes rely on kill regions*/
+  real lifetime = ParticlePool::FOREVER;
+  real lifetime_spread = 0;
+  bool enabled = true;
+
+  std::mt19937 engine;
+  /**particles owed from previous steps*/
+  real carry = 0;
+
+  ParticleEmitter() {}
+  ParticleEmitter(real r, std::uint32_t seed = 2020)
+      : rate(r), engine(seed) {}
+
+  /**uniform in [-1, 1)*/
+  real symmetric() {
+    double u = engine() / 2147483648.0 - 1.0;
+    return static_cast<real>(u);
+  }
+  real draw(real value, real spread) {
+    return value + spread * symmetric();
+  }
+  v3 draw(const v3 &value, const v3 &spread) {
+    return v3(draw(value.x, spread.x),
+              draw(value.y, spread.y),
+              draw(value.z, spread.z));
+  }
+
+  /**spawn the particles due over duration, returns how
+   * many*/
+  unsigned int emit(real duration, ParticlePool &pool) {
+    if (!enabled || rate <= 0)
+      return 0;
+    carry += rate * duration;
+    auto nb = static_cast<unsigned int>(carry);
+    carry -= static_cast<real>(nb);
+    for (unsigned int i = 0; i < nb; i++) {
+      Particle p;
+      p.set_position(draw(position, position_spread));
+      p.set_velocity(draw(velocity, velocity_spread));
+      p.set_acceleration(acceleration);
+      p.set_mass(std::max(draw(mass, mass_spread),
+                          static_cast<real>(1e-6)));
+      p.set_damping(damping);
+      p.clear_accumulator();
+      pool.spawn(p, draw(lifetime, lifetime_spread));
+    }
+    return nb;
+  }
+};
+};
@@ -0,0 +1,360 @@
+#pragma once
+// many same topology worlds stepped in lockstep
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/particle.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief N copies of a small particle system, one per lane
+
+  Every field is stored world minor: the value of particle
+  p for world w sits at p * stride + w, vectors use one such
+  row per component. The inner loop of every kernel runs
+  over contiguous worlds with no branches on the topology,
+  so the compiler vectorizes across worlds and a step of
+  thousands of tiny worlds is one streaming pass.
+
+  Each world has its own gravity and drag, plus the mass,
+  damping and state of each of its particles. Worlds retire
+  when their particles leave the bounds or after max_steps:
+  a retired world is swapped behind the active lanes so the
+  live ones stay packed, and it keeps its final state.
+ */
+class ParticleEnsemble {
+public:
+  /**lanes are padded to a multiple of this*/
+  static constexpr unsigned int LANE_WIDTH = 8;
+
+protected:
+  unsigned int nb_worlds;
+  unsigned int nb_particles;
+  unsigned int stride;
+  unsigned int active;
+
+  /**\name per particle, per lane*/
+  /**@{*/
+  std::vector<real> position;
+  std::vector<real> velocity;
+  std::vector<real> acceleration;
+  std::vector<real> force;
+  std::vector<real> inverse_mass;
+  std::vector<real> mass;
+  std::vector<real> damping;
+  /**pow(damping, duration) of the last duration*/
+  std::vector<real> damping_factor;
+  real factor_duration = 0;
+  /**@}*/
+
+  /**\name per lane*/
+  /**@{*/
+  std::vector<real> gravity;
+  std::vector<real> drag_k1;
+  std::vector<real> drag_k2;
+  std::vector<std::uint64_t> steps;
+  std::vector<unsigned int> world_of;
+  /**drag terms of the particle being stepped, threads
+   * write disjoint lanes*/
+  std::vector<real> scratch;
+  /**@}*/
+  std::vector<unsigned int> lane_of;
+
+  v3 bounds_min = v3(-std::numeric_limits<real>::max());
+  v3 bounds_max = v3(std::numeric_limits<real>::max());
+  std::uint64_t max_steps = 0;
+
+  std::size_t at(unsigned int p, unsigned int lane) const {
+    return static_cast<std::size_t>(p) * stride + lane;
+  }
+  std::size_t at(unsigned int p, unsigned int c,
+                 unsigned int lane) const {
+    return (static_cast<std::size_t>(p) * 3 + c) * stride +
+           lane;
+  }
+  v3 load(const std::vector<real> &field, unsigned int p,
+          unsigned int lane) const {
+    return v3(field[at(p, 0, lane)], field[at(p, 1, lane)],
+              field[at(p, 2, lane)]);
+  }
+  void store(std::vector<real> &field, unsigned int p,
+             unsigned int lane, const v3 &v) {
+    field[at(p, 0, lane)] = v.x;
+    field[at(p, 1, lane)] = v.y;
+    field[at(p, 2, lane)] = v.z;
+  }
+
+  void update_damping_factor(real duration) {
+    if (duration == factor_duration)
+      return;
+    for (std::size_t i = 0; i < damping.size(); i++)
+      damping_factor[i] =
+          static_cast<real>(pow(damping[i], duration));
+    factor_duration = duration;
+  }
+
+  /**
+    \brief drag terms of one particle over lanes
+    [begin, end)
+
+    The kernels take restrict rows so that the compiler
+    vectorizes them without alias checks.
+   */
+  static void drag_rows(std::size_t begin, std::size_t end,
+                        const real *__restrict vx,
+                        const real *__restrict vy,
+                        const real *__restrict vz,
+                        const real *__restrict k1,
+                        const real *__restrict k2,
+                        real *__restrict norm,
+                        real *__restrict neg_dcoeff) {
+    for (std::size_t w = begin; w < end; w++) {
+      real speed = std::sqrt(vx[w] * vx[w] + vy[w] * vy[w] +
+                             vz[w] * vz[w]);
+      neg_dcoeff[w] =
+          -(k1[w] * speed + k2[w] * speed * speed);
+      norm[w] = speed > 0 ? speed : 1;
+    }
+  }
+
+  /**
+    \brief one component of gravity, drag and
+    Particle::integrate over lanes [begin, end)
+
+    Immovable lanes keep their state, as in
+    Particle::integrate.
+   */
+  static void integrate_rows(
+      std::size_t begin, std::size_t end, real duration,
+      real *__restrict pos, real *__restrict vel,
+      real *__restrict force, const real *__restrict acc,
+      const real *__restrict im, const real *__restrict m,
+      const real *__restrict df, const real *__restrict g,
+      const real *__restrict norm,
+      const real *__restrict neg_dcoeff) {
+    for (std::size_t w = begin; w < end; w++) {
+      real f = force[w] + g[w] * m[w];
+      f += vel[w] / norm[w] * neg_dcoeff[w];
+      real live = im[w] > 0 ? real(1) : real(0);
+      real dt = duration * live;
+      pos[w] += vel[w] * dt;
+      real a = acc[w] + f * im[w];
+      real damp = live * df[w] + (1 - live);
+      vel[w] = (vel[w] + a * dt) * damp;
+      force[w] = f * (1 - live);
+    }
+  }
+
+  /**forces and integration of lanes [begin, end)*/
+  void step_lanes(unsigned int begin, unsigned int end,
+                  real duration) {
+    real *norm = &scratch[0];
+    real *neg_dcoeff = &scratch[stride];
+    for (unsigned int p = 0; p < nb_particles; p++) {
+      drag_rows(begin, end, &velocity[at(p, 0, 0)],
+                &velocity[at(p, 1, 0)],
+                &velocity[at(p, 2, 0)], drag_k1.data(),
+                drag_k2.data(), norm, neg_dcoeff);
+      for (unsigned int c = 0; c < 3; c++) {
+        integrate_rows(
+            begin, end, duration, &position[at(p, c, 0)],
+            &velocity[at(p, c, 0)], &force[at(p, c, 0)],
+            &acceleration[at(p, c, 0)],
+            &inverse_mass[at(p, 0)], &mass[at(p, 0)],
+            &damping_factor[at(p, 0)], &gravity[c * stride],
+            norm, neg_dcoeff);
+      }
+    }
+  }
+
+  bool in_bounds(unsigned int p, unsigned int lane) const {
+    for (unsigned int c = 0; c < 3; c++) {
+      real v = position[at(p, c, lane)];
+      if (v < bounds_min[c] || v > bounds_max[c])
+        return false;
+    }
+    return true;
+  }
+  bool should_retire(unsigned int lane) const {
+    if (max_steps != 0 && steps[lane] >= max_steps)
+      return true;
+    for (unsigned int p = 0; p < nb_particles; p++) {
+      if (in_bounds(p, lane))
+        return false;
+    }
+    return true;
+  }
+
+  void swap_lanes(unsigned int a, unsigned int b) {
+    auto swap_field = [this, a, b](std::vector<real> &f,
+                                   unsigned int rows) {
+      for (unsigned int r = 0; r < rows; r++)
+        std::swap(f[r * stride + a], f[r * stride + b]);
+    };
+    swap_field(position, nb_particles * 3);
+    swap_field(velocity, nb_particles * 3);
+    swap_field(acceleration, nb_particles * 3);
+    swap_field(force, nb_particles * 3);
+    swap_field(inverse_mass, nb_particles);
+    swap_field(mass, nb_particles);
+    swap_field(damping, nb_particles);
+    swap_field(damping_factor, nb_particles);
+    swap_field(gravity, 3);
+    std::swap(drag_k1[a], drag_k1[b]);
+    std::swap(drag_k2[a], drag_k2[b]);
+    std::swap(steps[a], steps[b]);
+    std::swap(world_of[a], world_of[b]);
+    lane_of[world_of[a]] = a;
+    lane_of[world_of[b]] = b;
+  }
+
+public:
+  ParticleEnsemble(unsigned int worlds,
+                   unsigned int particles_per_world)
+      : nb_worlds(worlds),
+        nb_particles(particles_per_world),
+        stride((worlds + LANE_WIDTH - 1) / LANE_WIDTH *
+               LANE_WIDTH),
+        active(worlds) {
+    std::size_t scalars =
+        static_cast<std::size_t>(nb_particles) * stride;
+    position.assign(scalars * 3, 0);
+    velocity.assign(scalars * 3, 0);
+    acceleration.assign(scalars * 3, 0);
+    force.assign(scalars * 3, 0);
+    inverse_mass.assign(scalars, 0);
+    mass.assign(scalars, 0);
+    damping.assign(scalars, 1);
+    damping_factor.assign(scalars, 1);
+    gravity.assign(stride * 3, 0);
+    drag_k1.assign(stride, 0);
+    drag_k2.assign(stride, 0);
+    steps.assign(stride, 0);
+    scratch.assign(stride * 2, 0);
+    world_of.resize(stride);
+    lane_of.resize(nb_worlds);
+    for (unsigned int w = 0; w < stride; w++)
+      world_of[w] = w;
+    for (unsigned int w = 0; w < nb_worlds; w++)
+      lane_of[w] = w;
+  }
+
+  unsigned int size() const { return nb_worlds; }
+  unsigned int particles_per_world() const {
+    return nb_particles;
+  }
+  /**worlds that are still stepped*/
+  unsigned int nb_active() const { return active; }
+  bool is_retired(unsigned int world) const {
+    return lane_of[world] >= active;
+  }
+  std::uint64_t steps_of(unsigned int world) const {
+    return steps[lane_of[world]];
+  }
+
+  /**\name per world parameters*/
+  /**@{*/
+  void set_particle(unsigned int world, unsigned int p,
+                    const Particle &particle) {
+    auto lane = lane_of[world];
+    store(position, p, lane, particle.get_position());
+    store(velocity, p, lane, particle.get_velocity());
+    store(acceleration, p, lane,
+          particle.get_acceleration());
+    store(force, p, lane, particle.get_accumulated_force());
+    real im = particle.get_inverse_mass();
+    inverse_mass[at(p, lane)] = im;
+    mass[at(p, lane)] = im > 0 ? particle.get_mass() : 0;
+    damping[at(p, lane)] = particle.get_damping();
+    damping_factor[at(p, lane)] = static_cast<real>(
+        pow(particle.get_damping(), factor_duration));
+  }
+  void get_particle(unsigned int world, unsigned int p,
+                    Particle &particle) const {
+    auto lane = lane_of[world];
+    particle.set_position(load(position, p, lane));
+    particle.set_velocity(load(velocity, p, lane));
+    particle.set_acceleration(load(acceleration, p, lane));
+    particle.set_accumulated_force(load(force, p, lane));
+    particle.set_inverse_mass(inverse_mass[at(p, lane)]);
+    particle.set_damping(damping[at(p, lane)]);
+  }
+  v3 get_position(unsigned int world,
+                 unsigned int p) const {
+    return load(position, p, lane_of[world]);
+  }
+  void set_gravity(unsigned int world, const v3 &g) {
+    auto lane = lane_of[world];
+    gravity[lane] = g.x;
+    gravity[stride + lane] = g.y;
+    gravity[2 * stride + lane] = g.z;
+  }
+  void set_drag(unsigned int world, real k1, real k2) {
+    drag_k1[lane_of[world]] = k1;
+    drag_k2[lane_of[world]] = k2;
+  }
+  /**@}*/
+
+  /**\name retirement, shared by every world*/
+  /**@{*/
+  /**a world retires once none of its particles is inside
+   * the box*/
+  void set_bounds(const v3 &lo, const v3 &hi) {
+    bounds_min = lo;
+    bounds_max = hi;
+  }
+  /**0 never retires on step count*/
+  void set_max_steps(std::uint64_t n) { max_steps = n; }
+  /**@}*/
+
+  /**
+    \brief step every active world once and retire the
+    finished ones
+
+    Lanes are split between the threads of the pool in
+    blocks of LANE_WIDTH. Returns the number of worlds still
+    active.
+   */
+  unsigned int run(real duration,
+                   ThreadPool *pool = nullptr) {
+    D_CHECK_MSG(duration > 0.0,
+                "duration should be bigger than 0");
+    update_damping_factor(duration);
+    unsigned int blocks =
+        (active + LANE_WIDTH - 1) / LANE_WIDTH;
+    parallel_for(
+        pool, blocks,
+        [this, duration](unsigned int begin,
+                         unsigned int end, unsigned int) {
+          step_lanes(begin * LANE_WIDTH,
+                     std::min(end * LANE_WIDTH, active),
+                     duration);
+        });
+    for (unsigned int lane = 0; lane < active; lane++)
+      steps[lane]++;
+    // from the back so a swapped in lane is already checked
+    for (unsigned int lane = active; lane-- > 0;) {
+      if (should_retire(lane)) {
+        swap_lanes(lane, active - 1);
+        active--;
+      }
+    }
+    return active;
+  }
+
+  /**step until every world retired or max_total steps*/
+  std::uint64_t
+  run_until_retired(real duration, std::uint64_t max_total,
+                    ThreadPool *pool = nullptr) {
+    std::uint64_t n = 0;
+    while (active > 0 && n < max_total) {
+      run(duration, pool);
+      n++;
+    }
+    return n;
+  }
+};
+};
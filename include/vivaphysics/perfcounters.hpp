@@ -0,0 +1,315 @@
+#pragma once
+// hardware performance counters per simulation phase
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/profiler.hpp>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace vivaphysics {
+
+/**phases of ParticleWorld::run that are sampled*/
+enum class StepPhase {
+  FORCES = 0,
+  INTEGRATE = 1,
+  CONTACTS = 2,
+  RESOLVE = 3
+};
+const unsigned int NB_STEP_PHASES = 4;
+
+enum class PerfEvent {
+  CYCLES = 0,
+  INSTRUCTIONS = 1,
+  L1D_MISSES = 2,
+  LLC_MISSES = 3,
+  BRANCH_MISSES = 4
+};
+const unsigned int NB_PERF_EVENTS = 5;
+
+inline const char *step_phase_name(unsigned int phase) {
+  static const char *const names[NB_STEP_PHASES] = {
+      "forces", "integrate", "contacts", "resolve"};
+  return names[phase];
+}
+inline const char *perf_event_name(unsigned int event) {
+  static const char *const names[NB_PERF_EVENTS] = {
+      "cycles", "instructions", "l1d_misses", "llc_misses",
+      "branch_misses"};
+  return names[event];
+}
+
+/**
+  \brief counters of the calling thread
+
+  Every event is opened on its own, so a machine or a
+  container that lacks some of them still reports the
+  others. Unavailable events read as zero.
+ */
+class PerfCounterSet {
+protected:
+  int fds[NB_PERF_EVENTS];
+
+#if defined(__linux__)
+  static int open_event(std::uint32_t type,
+                        std::uint64_t config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // this thread, any cpu
+    long fd = syscall(__NR_perf_event_open, &attr, 0, -1,
+                      -1, 0);
+    return static_cast<int>(fd);
+  }
+#endif
+
+public:
+  /**errno of the first event that failed to open*/
+  int error = 0;
+
+  PerfCounterSet() {
+    for (unsigned int i = 0; i < NB_PERF_EVENTS; i++)
+      fds[i] = -1;
+#if defined(__linux__)
+    const std::uint64_t cache_read_miss =
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    std::uint32_t types[NB_PERF_EVENTS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+        PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE};
+    std::uint64_t configs[NB_PERF_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | cache_read_miss,
+        PERF_COUNT_HW_CACHE_LL | cache_read_miss,
+        PERF_COUNT_HW_BRANCH_MISSES};
+    for (unsigned int i = 0; i < NB_PERF_EVENTS; i++) {
+      fds[i] = open_event(types[i], configs[i]);
+      if (fds[i] < 0 && error == 0)
+        error = errno;
+    }
+#else
+    error = ENOSYS;
+#endif
+  }
+  PerfCounterSet(const PerfCounterSet &) = delete;
+  PerfCounterSet &
+  operator=(const PerfCounterSet &) = delete;
+  ~PerfCounterSet() {
+#if defined(__linux__)
+    for (unsigned int i = 0; i < NB_PERF_EVENTS; i++) {
+      if (fds[i] >= 0)
+        close(fds[i]);
+    }
+#endif
+  }
+
+  bool has(unsigned int event) const {
+    return fds[event] >= 0;
+  }
+  bool any() const {
+    for (unsigned int i = 0; i < NB_PERF_EVENTS; i++) {
+      if (has(i))
+        return true;
+    }
+    return false;
+  }
+
+  /**current raw counts, free running since open*/
+  void read_values(std::uint64_t values[NB_PERF_EVENTS]) {
+    for (unsigned int i = 0; i < NB_PERF_EVENTS; i++) {
+      values[i] = 0;
+#if defined(__linux__)
+      if (fds[i] >= 0) {
+        std::uint64_t v = 0;
+        if (::read(fds[i], &v, sizeof(v)) ==
+            static_cast<ssize_t>(sizeof(v)))
+          values[i] = v;
+      }
+#endif
+    }
+  }
+};
+
+/**
+  \brief per phase totals gathered from every thread
+
+  Threads add their deltas with relaxed atomic adds, so
+  worker chunks never wait on each other.
+ */
+class PerfRecorder {
+protected:
+  std::atomic<std::uint64_t> totals[NB_STEP_PHASES]
+                                   [NB_PERF_EVENTS];
+  std::atomic<std::uint64_t> items[NB_STEP_PHASES];
+  std::atomic<std::uint64_t> calls[NB_STEP_PHASES];
+  std::atomic<bool> event_seen[NB_PERF_EVENTS];
+
+  PerfRecorder() { reset(); }
+
+public:
+  static PerfRecorder &get() {
+    static PerfRecorder recorder;
+    return recorder;
+  }
+
+  /**counters of the calling thread, opened on first use*/
+  PerfCounterSet &thread_counters() {
+    thread_local PerfCounterSet counters;
+    return counters;
+  }
+
+  void reset() {
+    for (unsigned int p = 0; p < NB_STEP_PHASES; p++) {
+      for (unsigned int e = 0; e < NB_PERF_EVENTS; e++)
+        totals[p][e].store(0);
+      items[p].store(0);
+      calls[p].store(0);
+    }
+    for (unsigned int e = 0; e < NB_PERF_EVENTS; e++)
+      event_seen[e].store(false);
+  }
+
+  void add(unsigned int phase,
+           const std::uint64_t start[NB_PERF_EVENTS],
+           const std::uint64_t end[NB_PERF_EVENTS],
+           const PerfCounterSet &counters) {
+    for (unsigned int e = 0; e < NB_PERF_EVENTS; e++) {
+      if (!counters.has(e))
+        continue;
+      event_seen[e].store(true, std::memory_order_relaxed);
+      totals[phase][e].fetch_add(end[e] - start[e],
+                                 std::memory_order_relaxed);
+    }
+  }
+  void add_call(unsigned int phase) {
+    calls[phase].fetch_add(1, std::memory_order_relaxed);
+  }
+  /**particles or contacts processed by a phase, the rates
+   * of the report are per item*/
+  void add_items(unsigned int phase, std::uint64_t n) {
+    items[phase].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  std::uint64_t total(StepPhase phase,
+                      PerfEvent event) const {
+    return totals[static_cast<unsigned int>(phase)]
+                 [static_cast<unsigned int>(event)]
+                     .load();
+  }
+
+  /**
+    \brief json object with totals and per item rates
+
+    Events that could not be opened on any thread are
+    reported as null together with the reason.
+   */
+  void write_json(std::ostream &out) {
+    auto &counters = thread_counters();
+    out << "{\"available\":"
+        << (counters.any() ? "true" : "false");
+    if (counters.error != 0) {
+      out << ",\"error\":\"" << strerror(counters.error)
+          << "\"";
+    }
+    out << ",\"phases\":{";
+    for (unsigned int p = 0; p < NB_STEP_PHASES; p++) {
+      auto n = items[p].load();
+      out << (p == 0 ? "" : ",") << "\""
+          << step_phase_name(p) << "\":{\"calls\":"
+          << calls[p].load() << ",\"items\":" << n;
+      for (unsigned int e = 0; e < NB_PERF_EVENTS; e++) {
+        out << ",\"" << perf_event_name(e) << "\":";
+        if (!event_seen[e].load()) {
+          out << "null";
+          continue;
+        }
+        auto v = totals[p][e].load();
+        out << v << ",\"" << perf_event_name(e)
+            << "_per_item\":"
+            << (n == 0 ? 0.0
+                       : static_cast<double>(v) / n);
+      }
+      out << "}";
+    }
+    out << "}}";
+  }
+};
+
+/** counts the calling thread between construction and
+ * destruction */
+struct PerfPhaseScope {
+  unsigned int phase;
+  bool active;
+  std::uint64_t start[NB_PERF_EVENTS];
+
+  PerfPhaseScope(StepPhase p)
+      : phase(static_cast<unsigned int>(p)), active(true) {
+    auto &recorder = PerfRecorder::get();
+    recorder.add_call(phase);
+    recorder.thread_counters().read_values(start);
+  }
+  /**worker chunk: thread 0 is the caller, already counted
+   * by the enclosing phase scope*/
+  PerfPhaseScope(StepPhase p, unsigned int thread_id)
+      : phase(static_cast<unsigned int>(p)),
+        active(thread_id != 0) {
+    if (active)
+      PerfRecorder::get().thread_counters().read_values(
+          start);
+  }
+  ~PerfPhaseScope() {
+    if (!active)
+      return;
+    auto &recorder = PerfRecorder::get();
+    auto &counters = recorder.thread_counters();
+    std::uint64_t end[NB_PERF_EVENTS];
+    counters.read_values(end);
+    recorder.add(phase, start, end, counters);
+  }
+};
+
+/**
+  Counter sampling only exists in builds defining
+  VIVAPHYSICS_PERF_COUNTERS, otherwise the macros expand to
+  nothing.
+ */
+#ifdef VIVAPHYSICS_PERF_COUNTERS
+#define VP_PERF_PHASE(phase)                               \
+  vivaphysics::PerfPhaseScope VP_CONCAT(vp_perf_,          \
+                                        __LINE__)(phase)
+#define VP_PERF_CHUNK(phase, thread_id)                    \
+  vivaphysics::PerfPhaseScope VP_CONCAT(                   \
+      vp_perf_, __LINE__)(phase, thread_id)
+#define VP_PERF_ITEMS(phase, n)                            \
+  vivaphysics::PerfRecorder::get().add_items(              \
+      static_cast<unsigned int>(phase),                    \
+      static_cast<std::uint64_t>(n))
+#define VP_PERF_ENABLED 1
+#else
+#define VP_PERF_PHASE(phase)                               \
+  do {                                                     \
+  } while (0)
+// the thread id is often a lambda parameter used nowhere
+// else
+#define VP_PERF_CHUNK(phase, thread_id)                    \
+  do {                                                     \
+    (void)(thread_id);                                     \
+  } while (0)
+#define VP_PERF_ITEMS(phase, n)                            \
+  do {                                                     \
+  } while (0)
+#define VP_PERF_ENABLED 0
+#endif
+};
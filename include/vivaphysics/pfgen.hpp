@@ -3,12 +3,24 @@
 #include <external.hpp>
 #include <memory>
 #include <vivaphysics/core.h>
+#include <vivaphysics/parallel.hpp>
 #include <vivaphysics/particle.hpp>
+#include <vivaphysics/phandle.hpp>
 #include <vivaphysics/pfgenenum.hpp>
 
 using namespace vivaphysics;
 
 namespace vivaphysics {
+
+// generators over sets of particles, the registry only
+// holds them by pointer. The members that run them are
+// defined in pworld.hpp
+class ParticleForcePipeline;
+class ParticleNBodyGravity;
+class ParticleSPHFluid;
+class ImplicitSpringNetwork;
+template <class T> struct PipelineForce;
+
 template <class T> struct ParticleForceGenerator {
   /**Compute the force that is going to be applied to given
    * particle*/
@@ -429,6 +441,80 @@ struct ParticleForceGenerator<ParticleBuoyancy> {
     p->add_force(force);
   }
 };
+// scalar forms for ForcePipeline, see PipelineForce
+
+template <> struct PipelineForce<ParticleGravity> {
+  static void add(const ParticleGravity &g, real, real,
+                  real, real, real, real, real im,
+                  real &f0, real &f1, real &f2) {
+    real mass = im > 0 ? 1.0f / im : 0.0f;
+    f0 += g.gravity.x * mass;
+    f1 += g.gravity.y * mass;
+    f2 += g.gravity.z * mass;
+  }
+};
+
+template <> struct PipelineForce<ParticleDrag> {
+  static void add(const ParticleDrag &g, real, real, real,
+                  real u, real v, real w, real, real &f0,
+                  real &f1, real &f2) {
+    real speed = std::sqrt(u * u + v * v + w * w);
+    real c = g.k1 * speed + g.k2 * speed * speed;
+    real scale = speed > 0 ? -c / speed : 0.0f;
+    f0 += u * scale;
+    f1 += v * scale;
+    f2 += w * scale;
+  }
+};
+
+template <> struct PipelineForce<ParticleAnchoredSpring> {
+  static void add(const ParticleAnchoredSpring &g, real x,
+                  real y, real z, real, real, real, real,
+                  real &f0, real &f1, real &f2) {
+    real dx = x - g.anchor.x, dy = y - g.anchor.y,
+         dz = z - g.anchor.z;
+    real length = std::sqrt(dx * dx + dy * dy + dz * dz);
+    real mag = (g.rest_length - length) * g.spring_constant;
+    real scale = length > 0 ? mag / length : 0.0f;
+    f0 += dx * scale;
+    f1 += dy * scale;
+    f2 += dz * scale;
+  }
+};
+
+template <> struct PipelineForce<ParticleAnchoredBungee> {
+  static void add(const ParticleAnchoredBungee &g, real x,
+                  real y, real z, real, real, real, real,
+                  real &f0, real &f1, real &f2) {
+    real dx = x - g.anchor.x, dy = y - g.anchor.y,
+         dz = z - g.anchor.z;
+    real length = std::sqrt(dx * dx + dy * dy + dz * dz);
+    real stretch = std::max(length - g.rest_length, 0.0f);
+    real scale = length > 0
+                     ? -stretch * g.spring_constant / length
+                     : 0.0f;
+    f0 += dx * scale;
+    f1 += dy * scale;
+    f2 += dz * scale;
+  }
+};
+
+template <> struct PipelineForce<ParticleBuoyancy> {
+  static void add(const ParticleBuoyancy &g, real,
+                  real depth, real, real, real, real, real,
+                  real &, real &f1, real &) {
+    real full = g.liquid_density * g.volume;
+    real partial = full *
+                   (depth - g.max_depth - g.liquid_height) /
+                   (2 * g.max_depth);
+    real force =
+        depth <= g.liquid_height - g.max_depth ? full
+                                               : partial;
+    f1 += depth >= g.liquid_height + g.max_depth ? 0.0f
+                                                 : force;
+  }
+};
+
 template <>
 struct ParticleForceGenerator<
     ParticleForceGeneratorWrapper> {
@@ -476,6 +562,39 @@ struct ParticleForceGenerator<
   }
 };
 
+/**handle to a registration of ParticleForceRegistry*/
+typedef Handle ForceHandle;
+
+/**
+  \brief shared generators of one type that each act on a
+  whole set of particles
+
+  T provides update_forces(real, ThreadPool *).
+ */
+template <class T> struct SetForceGenerators {
+  std::vector<std::shared_ptr<T>> generators;
+  HandleTable handles;
+
+  ForceHandle add(std::shared_ptr<T> gen) {
+    generators.push_back(gen);
+    return handles.push_back();
+  }
+  bool contains(ForceHandle h) const {
+    return handles.contains(h);
+  }
+  void remove(ForceHandle h) {
+    swap_and_pop(generators, handles.erase(h));
+  }
+  void clear() {
+    generators.clear();
+    handles.clear();
+  }
+  void update_forces(real duration, ThreadPool *pool) {
+    for (auto &gen : generators)
+      gen->update_forces(duration, pool);
+  }
+};
+
 class ParticleForceRegistry {
 protected:
   typedef std::vector<
@@ -483,39 +602,257 @@ protected:
                 ParticleForceGeneratorWrapper>>
       Registry;
   Registry force_register;
+  HandleTable handles;
+
+  /**
+    force of each gravity registration for the inverse
+    mass it was computed with. The force only changes with
+    the mass, so it is reused while the mass stays the
+    same. Kept aligned with force_register
+   */
+  struct ConstantForce {
+    real inverse_mass;
+    v3 force;
+  };
+  std::vector<ConstantForce> constant_forces;
+
+  /**a cache entry that is never reused*/
+  static ConstantForce stale_force() {
+    return ConstantForce{
+        std::numeric_limits<real>::quiet_NaN(), v3(0)};
+  }
+
+  /**the gravity of registration i, from the cache when
+   * the mass did not change*/
+  void add_gravity(unsigned int i) {
+    auto &[p, wrapper] = force_register[i];
+    if (!p->has_finite_mass())
+      return;
+    auto &cached = constant_forces[i];
+    real inverse_mass = p->get_inverse_mass();
+    if (cached.inverse_mass != inverse_mass) {
+      cached.inverse_mass = inverse_mass;
+      cached.force = wrapper.gravity_anchor * p->get_mass();
+    }
+    p->add_force(cached.force);
+  }
+
+  /**apply registration i*/
+  void update_entry(unsigned int i, real duration) {
+    auto &entry = force_register[i];
+    if (entry.second.gtype ==
+        ParticleForceGeneratorType::GRAVITY) {
+      add_gravity(i);
+      return;
+    }
+    ParticleForceGenerator<ParticleForceGeneratorWrapper>()
+        .update_force(entry.second, entry.first, duration);
+  }
+
+  /**generators acting on sets of particles, applied
+   * before the others*/
+  SetForceGenerators<ParticleForcePipeline> pipelines;
+  SetForceGenerators<ParticleNBodyGravity> nbody;
+  SetForceGenerators<ParticleSPHFluid> fluids;
+  SetForceGenerators<ImplicitSpringNetwork> spring_networks;
+
+  void update_sets(real duration, ThreadPool *pool);
+
+public:
+  /**
+    finish the step of the implicit spring networks, once
+    the world integrated the particles. Forces alone do
+    not change the state
+   */
+  void integrate(real duration, ThreadPool *pool);
+
+protected:
+
+  /**
+    registry indices grouped by particle: the entries of
+    group g are group_entries[group_start[g] ..
+    group_start[g + 1]), kept in storage order
+   */
+  std::vector<unsigned int> group_start;
+  std::vector<unsigned int> group_entries;
+  bool schedule_dirty = true;
+
+  void build_schedule() {
+    std::map<Particle *, unsigned int> slots;
+    std::vector<std::vector<unsigned int>> groups;
+    for (unsigned int i = 0; i < force_register.size();
+         i++) {
+      Particle *p = force_register[i].first.get();
+      auto it = slots.find(p);
+      if (it == slots.end()) {
+        auto slot =
+            static_cast<unsigned int>(groups.size());
+        slots[p] = slot;
+        groups.push_back(std::vector<unsigned int>());
+        groups[slot].push_back(i);
+      } else {
+        groups[it->second].push_back(i);
+      }
+    }
+    group_start.clear();
+    group_entries.clear();
+    for (auto &group : groups) {
+      group_start.push_back(
+          static_cast<unsigned int>(group_entries.size()));
+      group_entries.insert(group_entries.end(),
+                           group.begin(), group.end());
+    }
+    group_start.push_back(
+        static_cast<unsigned int>(group_entries.size()));
+    schedule_dirty = false;
+  }
 
 public:
   /** registers the given particle with given generator */
-  void add(std::shared_ptr<Particle> p,
-           ParticleForceGeneratorWrapper gwrapper) {
+  ForceHandle add(std::shared_ptr<Particle> p,
+                  ParticleForceGeneratorWrapper gwrapper) {
     auto particle_gen_pair = std::make_pair(p, gwrapper);
     force_register.push_back(particle_gen_pair);
+    constant_forces.push_back(stale_force());
+    schedule_dirty = true;
+    return handles.push_back();
+  }
+
+  /**
+    \brief registers a generator acting on all pairs of its
+    bodies
+
+    Set generators run before the per particle generators,
+    pipelines first then n-body ones, so the force on each
+    particle is still summed in a fixed order.
+   */
+  ForceHandle
+  add_nbody(std::shared_ptr<ParticleNBodyGravity> gen) {
+    return nbody.add(gen);
+  }
+  bool contains_nbody(ForceHandle h) const {
+    return nbody.contains(h);
+  }
+  void remove_nbody(ForceHandle h) { nbody.remove(h); }
+
+  /**registers a fused group of generators, see add_nbody
+   * for the order*/
+  ForceHandle
+  add_pipeline(std::shared_ptr<ParticleForcePipeline> gen) {
+    return pipelines.add(gen);
+  }
+  bool contains_pipeline(ForceHandle h) const {
+    return pipelines.contains(h);
+  }
+  void remove_pipeline(ForceHandle h) {
+    pipelines.remove(h);
+  }
+
+  /**registers a fluid, see add_nbody for the order*/
+  ForceHandle
+  add_fluid(std::shared_ptr<ParticleSPHFluid> gen) {
+    return fluids.add(gen);
+  }
+  bool contains_fluid(ForceHandle h) const {
+    return fluids.contains(h);
+  }
+  void remove_fluid(ForceHandle h) { fluids.remove(h); }
+
+  /**registers implicit springs, after the fluids*/
+  ForceHandle add_spring_network(
+      std::shared_ptr<ImplicitSpringNetwork> gen) {
+    return spring_networks.add(gen);
+  }
+  bool contains_spring_network(ForceHandle h) const {
+    return spring_networks.contains(h);
+  }
+  void remove_spring_network(ForceHandle h) {
+    spring_networks.remove(h);
+  }
+
+  /**preallocate room for n registrations*/
+  void reserve(unsigned int n) {
+    force_register.reserve(n);
+    constant_forces.reserve(n);
+  }
+
+  bool contains(ForceHandle h) const {
+    return handles.contains(h);
+  }
+
+  /**
+    \brief removes a registration in O(1)
+
+    The last registration takes the place of the removed
+    one, see update_forces for what that means for the
+    order of the forces.
+   */
+  void remove(ForceHandle h) {
+    auto i = handles.erase(h);
+    swap_and_pop(force_register, i);
+    swap_and_pop(constant_forces, i);
+    schedule_dirty = true;
   }
 
   /** removes the given particle with given generator */
   void remove(std::shared_ptr<Particle> p,
               ParticleForceGeneratorWrapper gen) {
-    for (unsigned int i = 0; i < force_register.size();
-         i++) {
-      auto vpair = force_register[i];
-      if (vpair.first == p && vpair.second == gen) {
-        force_register.erase(force_register.begin() + i);
+    remove_if([&](const Registry::value_type &vpair) {
+      return vpair.first == p && vpair.second == gen;
+    });
+  }
+
+  /**removes every generator registered with the particle*/
+  void remove_particle(std::shared_ptr<Particle> p) {
+    remove_if([&p](const Registry::value_type &vpair) {
+      return vpair.first == p;
+    });
+  }
+
+  /**swap and pop every registration matching pred*/
+  template <class Pred> void remove_if(Pred pred) {
+    unsigned int i = 0;
+    while (i < force_register.size()) {
+      if (pred(force_register[i])) {
+        handles.erase_index(i);
+        swap_and_pop(force_register, i);
+        swap_and_pop(constant_forces, i);
+        schedule_dirty = true;
+      } else {
+        i++;
       }
     }
   }
 
-  /**clears out the registry*/
-  void clear() { force_register.clear(); }
+  /**clears out the registry, every handle goes stale*/
+  void clear() {
+    force_register.clear();
+    constant_forces.clear();
+    handles.clear();
+    pipelines.clear();
+    nbody.clear();
+    fluids.clear();
+    spring_networks.clear();
+    schedule_dirty = true;
+  }
 
-  /**update forces of the registry*/
-  void update_forces(real duration) {
-    for (auto & [ part_ptr, generator_wrapper ] :
-         force_register) {
-      auto generator = ParticleForceGenerator<
-          ParticleForceGeneratorWrapper>();
-      generator.update_force(generator_wrapper, part_ptr,
-                             duration);
-    }
+  unsigned int size() const {
+    return static_cast<unsigned int>(force_register.size());
   }
+
+  /**update forces of the registry*/
+  void update_forces(real duration);
+
+  /**
+    \brief update forces in parallel, one particle per task
+
+    Every particle is owned by a single task which applies
+    its generators in storage order, so each accumulated
+    force is summed in exactly the order of the serial
+    update_forces() whatever the thread count. Storage order
+    is registration order until a removal moves the last
+    registration into the hole.
+   */
+  void update_forces(real duration, ThreadPool *pool);
 };
 };
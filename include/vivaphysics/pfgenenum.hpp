@@ -16,4 +16,15 @@ enum class ParticleForceGeneratorType {
   BUNGEE = 6,
   BUOYANCY = 7
 };
+const unsigned int NB_FORCE_GENERATOR_TYPES = 8;
+
+/**profiler counter names, indexed by generator type*/
+inline const char *const *force_generator_profile_names() {
+  static const char *const names[NB_FORCE_GENERATOR_TYPES] =
+      {"force/gravity",         "force/drag",
+       "force/anchored_spring", "force/anchored_bungee",
+       "force/fake_spring",     "force/spring",
+       "force/bungee",          "force/buoyancy"};
+  return names;
+}
 };
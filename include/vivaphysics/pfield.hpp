@@ -0,0 +1,519 @@
+#pragma once
+// force fields sampled from a regular 3d grid
+#include <atomic>
+#include <cstdint>
+#include <external.hpp>
+#include <fstream>
+#include <vivaphysics/debug.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/particle.hpp>
+#include <vivaphysics/ppipeline.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define VIVAPHYSICS_MMAP
+#endif
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**header of a grid file, the nodes follow it*/
+struct VectorGridHeader {
+  static constexpr std::uint32_t MAGIC = 0x444c4656; // VFLD
+  static constexpr std::uint32_t VERSION = 1;
+
+  std::uint32_t magic = MAGIC;
+  std::uint32_t version = VERSION;
+  std::uint32_t real_size = sizeof(real);
+  std::uint32_t nx = 0, ny = 0, nz = 0;
+  real origin[3] = {0, 0, 0};
+  real spacing = 1;
+};
+
+/**
+  \brief vectors at the nodes of a regular 3d grid
+
+  Node (i, j, k) sits at origin + spacing * (i, j, k) and
+  its three components are stored together at index
+  i + nx * (j + ny * k), so the corners of a cell are four
+  runs of two nodes. The file form is the header followed
+  by the nodes as they are in memory: load() maps it
+  read-only where the platform allows, such a grid shares
+  the page cache and can not be written.
+
+  Sampling interpolates trilinearly and clamps to the grid,
+  points outside take the value of the nearest face. Cells
+  are located with 32 bit node indices, so a grid holds at
+  most 2^32 - 1 nodes.
+ */
+class VectorGrid {
+protected:
+  VectorGridHeader header;
+  std::vector<real> storage;
+  const real *nodes = nullptr;
+  /**keeps the mapping alive, unmaps on release*/
+  std::shared_ptr<void> mapping;
+
+  void check_shape() const {
+    D_CHECK_MSG(header.nx >= 2 && header.ny >= 2 &&
+                    header.nz >= 2,
+                "a grid needs two nodes per axis");
+    D_CHECK_MSG(header.spacing > 0,
+                "grid spacing should be positive");
+    D_CHECK_MSG(nb_nodes() <= UINT32_MAX,
+                "a grid holds at most 2^32 - 1 nodes, not "
+                    << nb_nodes());
+  }
+
+public:
+  VectorGrid(unsigned int nx, unsigned int ny,
+             unsigned int nz, const v3 &origin,
+             real spacing) {
+    header.nx = nx;
+    header.ny = ny;
+    header.nz = nz;
+    header.origin[0] = origin.x;
+    header.origin[1] = origin.y;
+    header.origin[2] = origin.z;
+    header.spacing = spacing;
+    check_shape();
+    storage.assign(3 * nb_nodes(), 0);
+    nodes = storage.data();
+  }
+
+  /**an owned, zeroed grid of the same shape*/
+  static std::shared_ptr<VectorGrid>
+  like(const VectorGrid &g) {
+    return std::make_shared<VectorGrid>(
+        g.nx(), g.ny(), g.nz(), g.get_origin(),
+        g.get_spacing());
+  }
+
+  /**
+    \brief open a grid file, mapped when possible
+
+    Throws if the file is missing, truncated or was
+    written with a different real.
+   */
+  static std::shared_ptr<VectorGrid>
+  load(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    D_CHECK_MSG(in.is_open(),
+                "can not open grid " << path);
+    VectorGridHeader h;
+    in.read(reinterpret_cast<char *>(&h), sizeof(h));
+    D_CHECK_MSG(in.good(), "truncated grid header");
+    D_CHECK_MSG(h.magic == VectorGridHeader::MAGIC,
+                "not a grid file");
+    D_CHECK_MSG(h.version == VectorGridHeader::VERSION,
+                "unsupported grid version " << h.version);
+    D_CHECK_MSG(h.real_size == sizeof(real),
+                "grid was written with a different real");
+    auto g = std::make_shared<VectorGrid>(
+        2, 2, 2, v3(h.origin[0], h.origin[1], h.origin[2]),
+        h.spacing);
+    g->header = h;
+    g->check_shape();
+    std::size_t bytes = 3 * g->nb_nodes() * sizeof(real);
+    std::size_t length = sizeof(h) + bytes;
+    in.seekg(0, std::ios::end);
+    auto size = in.tellg();
+    D_CHECK_MSG(size != std::streampos(-1) &&
+                    static_cast<std::uint64_t>(size) >=
+                        length,
+                "truncated grid, " << g->nb_nodes()
+                                   << " nodes need "
+                                   << length << " bytes");
+    in.seekg(sizeof(h));
+#ifdef VIVAPHYSICS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      void *base = ::mmap(nullptr, length, PROT_READ,
+                          MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (base != MAP_FAILED) {
+        g->storage.clear();
+        g->storage.shrink_to_fit();
+        g->mapping.reset(base, [length](void *p) {
+          ::munmap(p, length);
+        });
+        g->nodes = reinterpret_cast<const real *>(
+            static_cast<const char *>(base) + sizeof(h));
+        return g;
+      }
+    }
+#endif
+    g->storage.resize(3 * g->nb_nodes());
+    in.read(reinterpret_cast<char *>(g->storage.data()),
+            bytes);
+    D_CHECK_MSG(!in.fail(), "truncated grid");
+    g->nodes = g->storage.data();
+    return g;
+  }
+
+  void save(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary);
+    D_CHECK_MSG(out.is_open(),
+                "can not open grid " << path);
+    out.write(reinterpret_cast<const char *>(&header),
+              sizeof(header));
+    out.write(reinterpret_cast<const char *>(nodes),
+              3 * nb_nodes() * sizeof(real));
+    D_CHECK_MSG(out.good(), "failed to write grid");
+  }
+
+  unsigned int nx() const { return header.nx; }
+  unsigned int ny() const { return header.ny; }
+  unsigned int nz() const { return header.nz; }
+  std::size_t nb_nodes() const {
+    return std::size_t(header.nx) * header.ny * header.nz;
+  }
+  v3 get_origin() const {
+    return v3(header.origin[0], header.origin[1],
+              header.origin[2]);
+  }
+  real get_spacing() const { return header.spacing; }
+  bool is_mapped() const { return mapping != nullptr; }
+
+  const real *data() const { return nodes; }
+  /**the nodes, throws on a mapped grid*/
+  real *data() {
+    D_CHECK_MSG(!is_mapped(), "a mapped grid is read-only");
+    return storage.data();
+  }
+
+  std::size_t index(unsigned int i, unsigned int j,
+                    unsigned int k) const {
+    return i + header.nx * (j + std::size_t(header.ny) * k);
+  }
+  v3 node_position(unsigned int i, unsigned int j,
+                   unsigned int k) const {
+    return get_origin() + v3(real(i), real(j), real(k)) *
+                              header.spacing;
+  }
+  v3 get(unsigned int i, unsigned int j,
+         unsigned int k) const {
+    auto n = nodes + 3 * index(i, j, k);
+    return v3(n[0], n[1], n[2]);
+  }
+  void set(unsigned int i, unsigned int j, unsigned int k,
+           const v3 &value) {
+    auto n = data() + 3 * index(i, j, k);
+    n[0] = value.x;
+    n[1] = value.y;
+    n[2] = value.z;
+  }
+
+  /**set every node to f(node position), f is called from
+   * the pool threads when given*/
+  template <class F>
+  void fill(F f, ThreadPool *pool = nullptr) {
+    auto rows = [this, &f](unsigned int begin,
+                           unsigned int end, unsigned int) {
+      for (unsigned int jk = begin; jk < end; jk++) {
+        unsigned int j = jk % header.ny,
+                     k = jk / header.ny;
+        for (unsigned int i = 0; i < header.nx; i++)
+          set(i, j, k, f(node_position(i, j, k)));
+      }
+    };
+    auto nb_rows = header.ny * header.nz;
+    if (pool == nullptr)
+      rows(0, nb_rows, 0);
+    else
+      parallel_for(pool, nb_rows, rows);
+  }
+
+  /**
+    \brief cells and weights of a batch of points
+
+    base is the index of the lowest corner of the cell, t
+    the position inside it in [0, 1]. Branch free, the loop
+    vectorizes.
+   */
+  void locate_rows(std::size_t begin, std::size_t end,
+                   const real *__restrict x,
+                   const real *__restrict y,
+                   const real *__restrict z,
+                   std::uint32_t *__restrict base,
+                   real *__restrict t0,
+                   real *__restrict t1,
+                   real *__restrict t2) const {
+    const real inv = 1.0f / header.spacing;
+    const real ox = header.origin[0],
+               oy = header.origin[1],
+               oz = header.origin[2];
+    const real hx = real(header.nx - 1),
+               hy = real(header.ny - 1),
+               hz = real(header.nz - 1);
+    const int mx = int(header.nx) - 2,
+              my = int(header.ny) - 2,
+              mz = int(header.nz) - 2;
+    const std::uint32_t sy = header.nx,
+                        sz = header.nx * header.ny;
+    for (std::size_t n = begin; n < end; n++) {
+      real gx = std::min(std::max((x[n] - ox) * inv, 0.0f),
+                         hx);
+      real gy = std::min(std::max((y[n] - oy) * inv, 0.0f),
+                         hy);
+      real gz = std::min(std::max((z[n] - oz) * inv, 0.0f),
+                         hz);
+      int i = std::min(static_cast<int>(gx), mx);
+      int j = std::min(static_cast<int>(gy), my);
+      int k = std::min(static_cast<int>(gz), mz);
+      t0[n] = gx - real(i);
+      t1[n] = gy - real(j);
+      t2[n] = gz - real(k);
+      base[n] = std::uint32_t(i) + std::uint32_t(j) * sy +
+                std::uint32_t(k) * sz;
+    }
+  }
+
+  /**blend the eight corners of each located point*/
+  void blend_rows(std::size_t begin, std::size_t end,
+                  const std::uint32_t *__restrict base,
+                  const real *__restrict t0,
+                  const real *__restrict t1,
+                  const real *__restrict t2,
+                  real *__restrict v0, real *__restrict v1,
+                  real *__restrict v2) const {
+    const std::size_t dy = 3 * std::size_t(header.nx),
+                      dz = dy * header.ny;
+    for (std::size_t n = begin; n < end; n++) {
+      const real *c = nodes + 3 * std::size_t(base[n]);
+      real u = t0[n], v = t1[n], w = t2[n];
+      real out[3];
+      for (int d = 0; d < 3; d++) {
+        // along x in the four runs, then y, then z
+        real a = c[d] + (c[d + 3] - c[d]) * u;
+        const real *cy = c + dy, *cz = c + dz,
+                   *cyz = c + dy + dz;
+        real b = cy[d] + (cy[d + 3] - cy[d]) * u;
+        real e = cz[d] + (cz[d + 3] - cz[d]) * u;
+        real f = cyz[d] + (cyz[d + 3] - cyz[d]) * u;
+        real lo = a + (b - a) * v, hi = e + (f - e) * v;
+        out[d] = lo + (hi - lo) * w;
+      }
+      v0[n] = out[0];
+      v1[n] = out[1];
+      v2[n] = out[2];
+    }
+  }
+
+  v3 sample(const v3 &p) const {
+    std::uint32_t base;
+    real t[3], v[3];
+    locate_rows(0, 1, &p.x, &p.y, &p.z, &base, &t[0],
+                &t[1], &t[2]);
+    blend_rows(0, 1, &base, &t[0], &t[1], &t[2], &v[0],
+               &v[1], &v[2]);
+    return v3(v[0], v[1], v[2]);
+  }
+};
+
+/**how the sampled vector pushes a particle*/
+enum class ForceFieldMode {
+  /**force = strength * value*/
+  FORCE = 0,
+  /**force = strength * value * mass, gravity like*/
+  ACCELERATION = 1,
+  /**force = strength * (value - velocity), a wind or
+     flow the particle is dragged along*/
+  VELOCITY = 2
+};
+
+/**
+  \brief a grid force field applied to a group of particles
+
+  A pipeline, register it with
+  ParticleForceRegistry::add_pipeline or put it in
+  ParticleWorld::fused_pipelines. The group is processed in
+  blocks: positions are gathered, located in the grid and
+  blended by vectorized loops, so each particle costs one
+  gather of its cell corners whatever the group size.
+
+  The grid is double buffered. One writer, on any thread,
+  fills back() and publish()es it while the world steps;
+  each update samples the grid that was published when it
+  started, and back() never returns a grid a running update
+  still reads: updates count themselves in nb_readers, and
+  the retired grid is only handed out again when none runs.
+ */
+class ParticleForceField : public ParticleForcePipeline {
+protected:
+  static constexpr std::size_t BLOCK = 256;
+
+  std::shared_ptr<VectorGrid> current;
+  std::shared_ptr<VectorGrid> spare;
+  /**updates running. Incremented before the grid is
+   * loaded and decremented once it is no longer read,
+   * both sequentially consistent, so a writer reading 0
+   * after publish() knows no update still holds the old
+   * grid*/
+  std::atomic<unsigned int> nb_readers{0};
+
+  struct ReadScope {
+    std::atomic<unsigned int> &readers;
+    ReadScope(std::atomic<unsigned int> &r) : readers(r) {
+      readers++;
+    }
+    ~ReadScope() { readers--; }
+  };
+
+  /**columns of one block, on the stack of the thread
+   * updating it so they stay in the first level cache*/
+  struct Block {
+    real xs[BLOCK], ys[BLOCK], zs[BLOCK];
+    real us[BLOCK], vs[BLOCK], ws[BLOCK], ims[BLOCK];
+    real t0s[BLOCK], t1s[BLOCK], t2s[BLOCK];
+    real v0s[BLOCK], v1s[BLOCK], v2s[BLOCK];
+    std::uint32_t bases[BLOCK];
+  };
+
+  /**value to force, in place. u v w is the velocity and
+   * im the inverse mass, read by the modes needing them*/
+  static void force_rows(std::size_t begin, std::size_t end,
+                         ForceFieldMode mode, real strength,
+                         const real *__restrict u,
+                         const real *__restrict v,
+                         const real *__restrict w,
+                         const real *__restrict im,
+                         real *__restrict v0,
+                         real *__restrict v1,
+                         real *__restrict v2) {
+    switch (mode) {
+    case ForceFieldMode::FORCE:
+      for (auto n = begin; n < end; n++) {
+        v0[n] *= strength;
+        v1[n] *= strength;
+        v2[n] *= strength;
+      }
+      break;
+    case ForceFieldMode::ACCELERATION:
+      for (auto n = begin; n < end; n++) {
+        real s = im[n] > 0 ? strength / im[n] : 0.0f;
+        v0[n] *= s;
+        v1[n] *= s;
+        v2[n] *= s;
+      }
+      break;
+    case ForceFieldMode::VELOCITY:
+      for (auto n = begin; n < end; n++) {
+        v0[n] = (v0[n] - u[n]) * strength;
+        v1[n] = (v1[n] - v[n]) * strength;
+        v2[n] = (v2[n] - w[n]) * strength;
+      }
+      break;
+    }
+  }
+
+  void update_block(const VectorGrid &g, std::size_t begin,
+                    std::size_t end) {
+    Block c;
+    std::size_t count = end - begin;
+    // every lane is set, the ones past count repeat the
+    // last particle: no lane of a partial block is read
+    // uninitialized
+    for (std::size_t n = 0; n < BLOCK; n++) {
+      const Particle &p =
+          *particles[begin + std::min(n, count - 1)];
+      v3 pos = p.get_position(), vel = p.get_velocity();
+      c.xs[n] = pos.x;
+      c.ys[n] = pos.y;
+      c.zs[n] = pos.z;
+      c.us[n] = vel.x;
+      c.vs[n] = vel.y;
+      c.ws[n] = vel.z;
+      c.ims[n] = p.get_inverse_mass();
+    }
+    g.locate_rows(0, count, c.xs, c.ys, c.zs, c.bases,
+                  c.t0s, c.t1s, c.t2s);
+    g.blend_rows(0, count, c.bases, c.t0s, c.t1s, c.t2s,
+                 c.v0s, c.v1s, c.v2s);
+    force_rows(0, count, mode, strength, c.us, c.vs, c.ws,
+               c.ims, c.v0s, c.v1s, c.v2s);
+    for (std::size_t n = 0; n < count; n++)
+      particles[begin + n]->add_force(
+          v3(c.v0s[n], c.v1s[n], c.v2s[n]));
+  }
+
+public:
+  ForceFieldMode mode = ForceFieldMode::FORCE;
+  real strength = 1;
+
+  ParticleForceField() {}
+  ParticleForceField(
+      std::shared_ptr<VectorGrid> grid,
+      ForceFieldMode m = ForceFieldMode::FORCE, real s = 1)
+      : current(grid), mode(m), strength(s) {}
+
+  /**the grid updates sample from now on*/
+  std::shared_ptr<const VectorGrid> front() const {
+    return std::atomic_load(&current);
+  }
+
+  /**
+    \brief an owned grid shaped like front() to write the
+    next slice into
+
+    The grid retired by the last publish() when no update
+    is running, nothing else holds it and it is writable,
+    a new one otherwise. Writer side only.
+   */
+  std::shared_ptr<VectorGrid> back() {
+    if (spare && nb_readers.load() == 0 &&
+        spare.use_count() == 1 && !spare->is_mapped())
+      return spare;
+    auto f = front();
+    D_CHECK_MSG(f != nullptr, "the field has no grid");
+    spare = VectorGrid::like(*f);
+    return spare;
+  }
+
+  /**make g the grid of the next updates, writer side
+   * only*/
+  void publish(std::shared_ptr<VectorGrid> g) {
+    spare = std::atomic_exchange(&current, g);
+  }
+
+  /**add the field force to the group*/
+  void update_forces(real,
+                     ThreadPool *pool = nullptr) override {
+    ReadScope scope(nb_readers);
+    auto grid = front();
+    if (!grid || particles.empty())
+      return;
+    const VectorGrid &g = *grid;
+    auto rows = [this, &g](unsigned int begin,
+                           unsigned int end, unsigned int) {
+      for (std::size_t b = begin; b < end; b += BLOCK)
+        update_block(g, b,
+                     std::min<std::size_t>(end, b + BLOCK));
+    };
+    if (pool == nullptr)
+      rows(0, size(), 0);
+    else
+      parallel_for(pool, size(), rows);
+  }
+
+  /**push then integrate the group, its particles must not
+   * be integrated elsewhere*/
+  void integrate(real duration,
+                 ThreadPool *pool = nullptr) override {
+    update_forces(duration, pool);
+    auto rows = [this, duration](unsigned int begin,
+                                 unsigned int end,
+                                 unsigned int) {
+      for (unsigned int n = begin; n < end; n++)
+        particles[n]->integrate(duration);
+    };
+    if (pool == nullptr)
+      rows(0, size(), 0);
+    else
+      parallel_for(pool, size(), rows);
+  }
+};
+};
@@ -0,0 +1,191 @@
+#pragma once
+// generational handles over densely packed storage
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/debug.hpp>
+
+namespace vivaphysics {
+
+/**
+  \brief stable reference to an element of packed storage
+
+  The slot stays valid while the element lives, the
+  generation changes every time the slot is freed so a
+  handle to a removed element is detected instead of
+  silently naming whatever reused the slot.
+ */
+struct Handle {
+  static constexpr std::uint32_t INVALID = 0xffffffff;
+  std::uint32_t slot = INVALID;
+  std::uint32_t generation = 0;
+
+  bool is_null() const { return slot == INVALID; }
+  bool operator==(const Handle &h) const {
+    return slot == h.slot && generation == h.generation;
+  }
+  bool operator!=(const Handle &h) const {
+    return !(*this == h);
+  }
+};
+
+/**
+  \brief maps handles to indices of dense arrays
+
+  The owner keeps its elements packed and removes them by
+  moving the last element into the hole, the table follows
+  that move. Every operation is O(1).
+ */
+class HandleTable {
+protected:
+  /**slot to dense index, INVALID when the slot is free*/
+  std::vector<std::uint32_t> slot_dense;
+  std::vector<std::uint32_t> slot_generation;
+  /**dense index to slot*/
+  std::vector<std::uint32_t> dense_slot;
+  std::vector<std::uint32_t> free_slots;
+
+public:
+  /**number of live elements*/
+  std::uint32_t size() const {
+    return static_cast<std::uint32_t>(dense_slot.size());
+  }
+
+  bool contains(Handle h) const {
+    return h.slot < slot_dense.size() &&
+           slot_generation[h.slot] == h.generation &&
+           slot_dense[h.slot] != Handle::INVALID;
+  }
+
+  /**dense index of a live handle, throws on a stale one*/
+  std::uint32_t index(Handle h) const {
+    D_CHECK_MSG(contains(h), "stale or null handle");
+    return slot_dense[h.slot];
+  }
+
+  Handle handle(std::uint32_t dense_index) const {
+    Handle h;
+    h.slot = dense_slot[dense_index];
+    h.generation = slot_generation[h.slot];
+    return h;
+  }
+
+  /**handle of an element appended at the end of the dense
+   * arrays*/
+  Handle push_back() {
+    Handle h;
+    if (free_slots.empty()) {
+      h.slot =
+          static_cast<std::uint32_t>(slot_dense.size());
+      slot_dense.push_back(0);
+      slot_generation.push_back(0);
+    } else {
+      h.slot = free_slots.back();
+      free_slots.pop_back();
+    }
+    h.generation = slot_generation[h.slot];
+    slot_dense[h.slot] = size();
+    dense_slot.push_back(h.slot);
+    return h;
+  }
+
+  /**
+    \brief free the element at dense index i
+
+    The caller then moves its last element to i and pops
+    the back, see swap_and_pop.
+   */
+  void erase_index(std::uint32_t i) {
+    auto slot = dense_slot[i];
+    auto last = size() - 1;
+    dense_slot[i] = dense_slot[last];
+    slot_dense[dense_slot[i]] = i;
+    dense_slot.pop_back();
+    slot_dense[slot] = Handle::INVALID;
+    slot_generation[slot]++;
+    free_slots.push_back(slot);
+  }
+
+  /**same as erase_index, returns the freed dense index*/
+  std::uint32_t erase(Handle h) {
+    auto i = index(h);
+    erase_index(i);
+    return i;
+  }
+
+  /**room for n elements without allocating*/
+  void reserve(std::uint32_t n) {
+    slot_dense.reserve(n);
+    slot_generation.reserve(n);
+    dense_slot.reserve(n);
+    free_slots.reserve(n);
+  }
+
+  /**
+    \brief give handles to elements appended to the dense
+    arrays without going through push_back
+
+    The owners expose their arrays, code filling them
+    directly is picked up lazily this way.
+   */
+  void grow(std::uint32_t n) {
+    D_CHECK_MSG(n >= size(),
+                "dense array shrank behind its handles");
+    while (size() < n)
+      push_back();
+  }
+
+  /**
+    \brief drop every element whose kill flag is set,
+    keeping the others in order
+
+    The caller compacts its arrays the same way, see
+    compact_array. Returns the new size.
+   */
+  std::uint32_t compact(const std::uint8_t *kill) {
+    std::uint32_t kept = 0;
+    for (std::uint32_t i = 0; i < size(); i++) {
+      auto slot = dense_slot[i];
+      if (kill[i]) {
+        slot_dense[slot] = Handle::INVALID;
+        slot_generation[slot]++;
+        free_slots.push_back(slot);
+        continue;
+      }
+      dense_slot[kept] = slot;
+      slot_dense[slot] = kept;
+      kept++;
+    }
+    dense_slot.resize(kept);
+    return kept;
+  }
+
+  /**invalidates every handle given so far*/
+  void clear() {
+    while (size() > 0)
+      erase_index(size() - 1);
+  }
+};
+
+/**keep the elements whose kill flag is clear, in order*/
+template <class T>
+void compact_array(std::vector<T> &v,
+                   const std::uint8_t *kill) {
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < v.size(); i++) {
+    if (kill[i])
+      continue;
+    if (kept != i)
+      v[kept] = std::move(v[i]);
+    kept++;
+  }
+  v.erase(v.begin() + kept, v.end());
+}
+
+/**move the last element into i and drop the back*/
+template <class T>
+void swap_and_pop(std::vector<T> &v, std::size_t i) {
+  if (i + 1 != v.size())
+    v[i] = std::move(v.back());
+  v.pop_back();
+}
+};
@@ -0,0 +1,461 @@
+#pragma once
+// implicit integration of stiff spring networks
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/particle.hpp>
+#include <vivaphysics/profiler.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief springs between the given particles, integrated
+  with backward Euler
+
+  Each update linearizes the spring forces around the
+  current state and solves the velocity change of the step
+  (Baraff and Witkin 1998)
+
+    (M - h D - h^2 K) dv = h (f + h K v)
+
+  where K and D are the derivatives of the forces with
+  respect to the positions and velocities. The matrix is
+  stored as 3x3 blocks in a sparse row layout built from
+  the spring topology, and solved with a conjugate gradient
+  preconditioned by the inverse diagonal blocks, starting
+  from the solution of the previous step.
+
+  The velocity change goes to the particle accumulators as
+  the force m dv / h, so the world integrates it along with
+  every other force, which stay explicit. The integrator
+  moves positions with the velocity from the start of the
+  step, so integrate() moves them by h dv afterwards; the
+  world calls it once its particles are integrated.
+  Stiffness that needs steps below a millisecond with
+  explicit springs is then stable at 60 Hz, the error shows
+  as extra damping.
+
+  Compressed springs only keep the stiffness along their
+  axis so that the matrix stays positive definite. Bodies of
+  infinite mass do not move, springs to them act as
+  anchored ones. Rows and sums are split over the pool
+  threads on fixed boundaries, so the result does not
+  depend on the thread count.
+ */
+class ImplicitSpringNetwork {
+public:
+  /**rows of one partial sum of the dot products*/
+  static constexpr unsigned int DOT_BLOCK = 1024;
+  /**b of an anchored spring*/
+  static constexpr unsigned int ANCHOR = ~0u;
+
+  struct Spring {
+    unsigned int a, b;
+    real stiffness;
+    real rest_length;
+    /**force per unit of stretching speed*/
+    real damping;
+    /**other end of an anchored spring*/
+    v3 anchor;
+    /**a bungee, no force while shorter than its rest
+     * length*/
+    bool slack = false;
+  };
+
+  Particles bodies;
+  std::vector<Spring> springs;
+  /**false applies the same forces explicitly*/
+  bool implicit = true;
+  /**stop once the residual is this fraction of the rhs*/
+  real tolerance = 1e-4f;
+  unsigned int max_iterations = 200;
+
+protected:
+  /**
+    off diagonal blocks of row i are
+    [row_start[i], row_start[i + 1]), columns sorted
+   */
+  std::vector<unsigned int> row_start;
+  std::vector<unsigned int> columns;
+  /**block of each spring in row a and in row b*/
+  std::vector<unsigned int> block_ab, block_ba;
+  std::size_t topology_springs = 0;
+  std::size_t topology_bodies = 0;
+
+  std::vector<glm::mat3> diagonal, blocks, inv_diagonal;
+  std::vector<glm::vec3> xs, vs, forces, rhs;
+  std::vector<real> masses;
+  /**solution, kept as the guess of the next step*/
+  std::vector<glm::vec3> dv;
+  std::vector<glm::vec3> r, z, p, q;
+  std::vector<real> partial;
+
+  unsigned int last_iterations = 0;
+  real last_residual = 0;
+  /**dv of the last update still has to move the bodies*/
+  bool pending = false;
+
+  static glm::mat3 outer(const glm::vec3 &u) {
+    return glm::outerProduct(u, u);
+  }
+
+  bool has_b(const Spring &s) const {
+    return s.b != ANCHOR;
+  }
+
+  /**sparse layout of the off diagonal blocks*/
+  void build_topology() {
+    auto n = static_cast<unsigned int>(bodies.size());
+    std::vector<std::vector<unsigned int>> rows(n);
+    for (const auto &s : springs) {
+      D_CHECK_MSG(s.a < n && (s.b < n || s.b == ANCHOR),
+                  "spring end out of range");
+      if (!has_b(s) || s.a == s.b)
+        continue;
+      rows[s.a].push_back(s.b);
+      rows[s.b].push_back(s.a);
+    }
+    row_start.assign(n + 1, 0);
+    columns.clear();
+    for (unsigned int i = 0; i < n; i++) {
+      auto &row = rows[i];
+      std::sort(row.begin(), row.end());
+      row.erase(std::unique(row.begin(), row.end()),
+                row.end());
+      columns.insert(columns.end(), row.begin(), row.end());
+      row_start[i + 1] =
+          static_cast<unsigned int>(columns.size());
+    }
+    auto find = [this](unsigned int i, unsigned int j) {
+      auto first = columns.begin() + row_start[i];
+      auto last = columns.begin() + row_start[i + 1];
+      return static_cast<unsigned int>(
+          std::lower_bound(first, last, j) -
+          columns.begin());
+    };
+    block_ab.assign(springs.size(), 0);
+    block_ba.assign(springs.size(), 0);
+    for (std::size_t k = 0; k < springs.size(); k++) {
+      const auto &s = springs[k];
+      if (!has_b(s) || s.a == s.b)
+        continue;
+      block_ab[k] = find(s.a, s.b);
+      block_ba[k] = find(s.b, s.a);
+    }
+    blocks.resize(columns.size());
+    dv.assign(n, glm::vec3(0));
+    topology_springs = springs.size();
+    topology_bodies = bodies.size();
+  }
+
+  void gather(ThreadPool *pool) {
+    auto n = static_cast<unsigned int>(bodies.size());
+    xs.resize(n);
+    vs.resize(n);
+    masses.resize(n);
+    parallel_for(
+        pool, n,
+        [this](unsigned int begin, unsigned int end,
+               unsigned int) {
+          for (unsigned int i = begin; i < end; i++) {
+            const auto &b = *bodies[i];
+            xs[i] = b.get_position().to_glm();
+            vs[i] = b.get_velocity().to_glm();
+            real w = b.get_inverse_mass();
+            masses[i] = w > 0 ? 1 / w : 0;
+          }
+        });
+  }
+
+  /**forces, matrix and right hand side at the current
+   * state, in spring order*/
+  void assemble(real h) {
+    auto n = static_cast<unsigned int>(bodies.size());
+    diagonal.resize(n);
+    forces.assign(n, glm::vec3(0));
+    rhs.assign(n, glm::vec3(0));
+    for (unsigned int i = 0; i < n; i++)
+      diagonal[i] = glm::mat3(masses[i]);
+    std::fill(blocks.begin(), blocks.end(), glm::mat3(0));
+    const glm::mat3 identity(1);
+    for (std::size_t k = 0; k < springs.size(); k++) {
+      const auto &s = springs[k];
+      if (s.a == s.b)
+        continue;
+      bool two_ended = has_b(s);
+      glm::vec3 xb =
+          two_ended ? xs[s.b] : s.anchor.to_glm();
+      glm::vec3 vb = two_ended ? vs[s.b] : glm::vec3(0);
+      glm::vec3 d = xs[s.a] - xb;
+      real length = glm::length(d);
+      if (length <= std::numeric_limits<real>::epsilon())
+        continue;
+      if (s.slack && length <= s.rest_length)
+        continue;
+      glm::vec3 u = d / length;
+      glm::vec3 dvel = vs[s.a] - vb;
+      glm::vec3 f =
+          u * (-s.stiffness * (length - s.rest_length) -
+               s.damping * glm::dot(dvel, u));
+      // minus the derivatives of f on a, kept positive
+      glm::mat3 uu = outer(u);
+      real lateral =
+          std::max(real(0), 1 - s.rest_length / length);
+      glm::mat3 stiff =
+          s.stiffness * (lateral * (identity - uu) + uu);
+      glm::mat3 jacobian =
+          h * h * stiff + h * s.damping * uu;
+      glm::vec3 kv = h * h * (stiff * dvel);
+      forces[s.a] += f;
+      rhs[s.a] += h * f - kv;
+      diagonal[s.a] += jacobian;
+      if (two_ended) {
+        forces[s.b] -= f;
+        rhs[s.b] -= h * f - kv;
+        diagonal[s.b] += jacobian;
+        blocks[block_ab[k]] -= jacobian;
+        blocks[block_ba[k]] -= jacobian;
+      }
+    }
+  }
+
+  /**out = A in, rows of fixed bodies cleared*/
+  void multiply(ThreadPool *pool,
+                const std::vector<glm::vec3> &in,
+                std::vector<glm::vec3> &out) const {
+    auto n = static_cast<unsigned int>(in.size());
+    parallel_for(
+        pool, n,
+        [&](unsigned int begin, unsigned int end,
+            unsigned int) {
+          for (unsigned int i = begin; i < end; i++) {
+            if (masses[i] == 0) {
+              out[i] = glm::vec3(0);
+              continue;
+            }
+            glm::vec3 sum = diagonal[i] * in[i];
+            for (unsigned int k = row_start[i];
+                 k < row_start[i + 1]; k++)
+              sum += blocks[k] * in[columns[k]];
+            out[i] = sum;
+          }
+        });
+  }
+
+  /**sum of a[i].b[i] over fixed blocks, added in order*/
+  real dot(ThreadPool *pool,
+           const std::vector<glm::vec3> &a,
+           const std::vector<glm::vec3> &b) {
+    auto n = static_cast<unsigned int>(a.size());
+    unsigned int nb = (n + DOT_BLOCK - 1) / DOT_BLOCK;
+    partial.resize(nb);
+    parallel_for(
+        pool, nb,
+        [&](unsigned int begin, unsigned int end,
+            unsigned int) {
+          for (unsigned int c = begin; c < end; c++) {
+            unsigned int last =
+                std::min(n, (c + 1) * DOT_BLOCK);
+            real sum = 0;
+            for (unsigned int i = c * DOT_BLOCK; i < last;
+                 i++)
+              sum += glm::dot(a[i], b[i]);
+            partial[c] = sum;
+          }
+        });
+    real sum = 0;
+    for (real s : partial)
+      sum += s;
+    return sum;
+  }
+
+  /**z = P r with P the inverse diagonal blocks*/
+  void precondition(ThreadPool *pool) {
+    auto n = static_cast<unsigned int>(r.size());
+    parallel_for(
+        pool, n,
+        [this](unsigned int begin, unsigned int end,
+               unsigned int) {
+          for (unsigned int i = begin; i < end; i++)
+            z[i] = inv_diagonal[i] * r[i];
+        });
+  }
+
+  /**preconditioned conjugate gradient on A dv = rhs*/
+  void solve(ThreadPool *pool) {
+    auto n = static_cast<unsigned int>(bodies.size());
+    inv_diagonal.resize(n);
+    r.resize(n);
+    z.resize(n);
+    p.resize(n);
+    q.resize(n);
+    parallel_for(
+        pool, n,
+        [this](unsigned int begin, unsigned int end,
+               unsigned int) {
+          for (unsigned int i = begin; i < end; i++) {
+            bool fixed = masses[i] == 0;
+            inv_diagonal[i] =
+                fixed ? glm::mat3(0)
+                      : glm::inverse(diagonal[i]);
+            if (fixed) {
+              rhs[i] = glm::vec3(0);
+              dv[i] = glm::vec3(0);
+            }
+          }
+        });
+    last_iterations = 0;
+    real rhs_norm = std::sqrt(dot(pool, rhs, rhs));
+    if (rhs_norm == 0) {
+      std::fill(dv.begin(), dv.end(), glm::vec3(0));
+      last_residual = 0;
+      return;
+    }
+    multiply(pool, dv, q);
+    for (unsigned int i = 0; i < n; i++)
+      r[i] = rhs[i] - q[i];
+    precondition(pool);
+    p = z;
+    real rz = dot(pool, r, z);
+    real goal = tolerance * rhs_norm;
+    last_residual = std::sqrt(dot(pool, r, r));
+    while (last_residual > goal &&
+           last_iterations < max_iterations) {
+      multiply(pool, p, q);
+      real pq = dot(pool, p, q);
+      if (pq <= 0)
+        break;
+      real alpha = rz / pq;
+      parallel_for(
+          pool, n,
+          [&](unsigned int begin, unsigned int end,
+              unsigned int) {
+            for (unsigned int i = begin; i < end; i++) {
+              dv[i] += alpha * p[i];
+              r[i] -= alpha * q[i];
+            }
+          });
+      last_iterations++;
+      last_residual = std::sqrt(dot(pool, r, r));
+      precondition(pool);
+      real rz_next = dot(pool, r, z);
+      real beta = rz_next / rz;
+      rz = rz_next;
+      parallel_for(pool, n,
+                   [&](unsigned int begin, unsigned int end,
+                       unsigned int) {
+                     for (unsigned int i = begin; i < end;
+                          i++)
+                       p[i] = z[i] + beta * p[i];
+                   });
+    }
+  }
+
+public:
+  ImplicitSpringNetwork() {}
+  ImplicitSpringNetwork(const Particles &ps) : bodies(ps) {}
+
+  /**index of the particle, to pass to add_spring*/
+  unsigned int add_body(std::shared_ptr<Particle> p) {
+    bodies.push_back(p);
+    return static_cast<unsigned int>(bodies.size() - 1);
+  }
+  void add_spring(unsigned int a, unsigned int b,
+                  real stiffness, real rest_length,
+                  real damping = 0) {
+    springs.push_back(
+        {a, b, stiffness, rest_length, damping, v3(0)});
+  }
+  /**spring that only pulls, from rest_length on*/
+  void add_bungee(unsigned int a, unsigned int b,
+                  real stiffness, real rest_length,
+                  real damping = 0) {
+    add_spring(a, b, stiffness, rest_length, damping);
+    springs.back().slack = true;
+  }
+  void add_anchored_spring(unsigned int a, const v3 &anchor,
+                           real stiffness, real rest_length,
+                           real damping = 0) {
+    springs.push_back({a, ANCHOR, stiffness, rest_length,
+                       damping, anchor});
+  }
+  /**rebuild the sparse layout on the next update, needed
+   * after springs are modified in place*/
+  void topology_changed() { topology_springs = ~0ul; }
+
+  /**conjugate gradient iterations of the last update*/
+  unsigned int get_iterations() const {
+    return last_iterations;
+  }
+  /**residual norm at the end of the last update*/
+  real get_residual() const { return last_residual; }
+
+  /**solve the step and add the equivalent forces*/
+  void update_forces(real duration,
+                     ThreadPool *pool = nullptr) {
+    VP_PROFILE_ZONE("force/implicit_springs");
+    pending = false;
+    if (duration <= 0)
+      return;
+    if (topology_springs != springs.size() ||
+        topology_bodies != bodies.size())
+      build_topology();
+    gather(pool);
+    {
+      VP_PROFILE_ZONE("implicit/assemble");
+      assemble(duration);
+    }
+    if (implicit) {
+      VP_PROFILE_ZONE("implicit/solve");
+      solve(pool);
+      VP_PROFILE_COUNTER("implicit/iterations",
+                         last_iterations);
+    }
+    real per_step = 1 / duration;
+    auto n = static_cast<unsigned int>(bodies.size());
+    parallel_for(
+        pool, n,
+        [&](unsigned int begin, unsigned int end,
+            unsigned int) {
+          for (unsigned int i = begin; i < end; i++) {
+            if (masses[i] == 0)
+              continue;
+            auto &b = *bodies[i];
+            if (!implicit) {
+              b.add_force(v3(forces[i]));
+              continue;
+            }
+            b.add_force(v3(masses[i] * dv[i] * per_step));
+          }
+        });
+    pending = implicit;
+  }
+
+  /**
+    move the bodies by h dv once they are integrated, which
+    completes the backward Euler position. Does nothing
+    unless update_forces solved a step since the last call
+   */
+  void integrate(real duration,
+                 ThreadPool *pool = nullptr) {
+    if (!pending)
+      return;
+    pending = false;
+    auto n = static_cast<unsigned int>(bodies.size());
+    parallel_for(
+        pool, n,
+        [&](unsigned int begin, unsigned int end,
+            unsigned int) {
+          for (unsigned int i = begin; i < end; i++) {
+            if (masses[i] == 0)
+              continue;
+            auto &b = *bodies[i];
+            b.set_position(b.get_position() +
+                           v3(duration * dv[i]));
+          }
+        });
+  }
+};
+};
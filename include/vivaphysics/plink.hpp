@@ -3,12 +3,17 @@
 // particle links
 #include <external.hpp>
 #include <vivaphysics/pcontact.hpp>
+#include <vivaphysics/phandle.hpp>
 #include <vivaphysics/plinkenum.hpp>
 
 using namespace vivaphysics;
 
 namespace vivaphysics {
 
+/**handle to a contact generator of a world, see
+ * ContactGenerators*/
+typedef Handle LinkHandle;
+
 struct ParticleLink {
   ContactParticles contact_ps;
 
@@ -206,8 +211,7 @@ struct ParticleContactGenerator<ParticleCableConstraint> {
     if (cur_length < cable.max_length) {
       return 0;
     }
-    contact[contact_start].particles.ps[0] =
-        cable.contact_ps.ps[0];
+    contact[contact_start].particles = cable.contact_ps;
     contact[contact_start].particles.is_double = false;
 
     // calculate the normal
@@ -269,15 +273,28 @@ struct ParticleContactGenerator<GroundContacts> {
               std::vector<ParticleContact> &contacts,
               unsigned int contact_start,
               unsigned int contact_end) {
+    return add_contact(gs.particles, contacts,
+                       contact_start, contact_end);
+  }
+
+  /**the contacts of the given particles with the ground,
+   * without copying them into a GroundContacts*/
+  unsigned int
+  add_contact(const Particles &particles,
+              std::vector<ParticleContact> &contacts,
+              unsigned int contact_start,
+              unsigned int contact_end) {
     unsigned int count = 0;
-    for (auto &particle_ptr : gs.particles) {
+    for (auto &particle_ptr : particles) {
       real y = particle_ptr->get_position().y;
       if (y < 0.0) {
-        contacts[contact_start].contact_normal = v3::UP;
-        contacts[contact_start].particles = *particle_ptr;
-        contacts[contact_start].particles.is_double = false;
-        contacts[contact_start].penetration = -y;
-        contacts[contact_start].restitution = 0.2f;
+        auto &contact = contacts[contact_start];
+        contact.contact_normal = v3::UP;
+        // reuses the storage of the slot
+        contact.particles.ps.assign(1, particle_ptr);
+        contact.particles.is_double = false;
+        contact.penetration = -y;
+        contact.restitution = 0.2f;
         contact_start++;
         count++;
       }
@@ -330,10 +347,10 @@ struct ParticleContactGenerator<ParticleContactWrapper> {
       break;
     }
     case ParticleContactGeneratorType::GROUND: {
-      auto c5 = w.to_ground();
       ParticleContactGenerator<GroundContacts> pcg_gc;
       retval = pcg_gc.add_contact(
-          c5, contact, contact_start, contact_end);
+          w.contact_ps.ps, contact, contact_start,
+          contact_end);
     }
     }
     return retval;
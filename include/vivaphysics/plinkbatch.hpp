@@ -0,0 +1,245 @@
+#pragma once
+// rods, cables and anchored links evaluated in batches
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/plink.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief the link generators of a world, stored as columns
+
+  ParticleContactGenerator<ParticleContactWrapper> switches
+  on the type of each link, copies its particles into a
+  typed link and reads positions through shared pointers.
+  The batch does that work once, when the generators
+  change: every rod, cable, anchored rod and anchored cable
+  becomes a row of raw particle pointers, rest length,
+  restitution and anchor.
+
+  evaluate() gathers the end positions of all rows, then
+  computes lengths, normals, penetrations and which links
+  are violated in one branch free loop that the compiler
+  vectorizes. write() then copies a violated row into a
+  contact, so only violated links reach the contact buffer.
+  Contacts, normals and penetrations are bit identical to
+  the per link generators.
+
+  Ground contacts, and links skipped by the direct solvers,
+  are not rows: entries() keeps the generator order and
+  marks the generators the world still runs one by one.
+ */
+class ParticleLinkBatch {
+public:
+  /**no row, run the generator*/
+  static constexpr std::uint32_t NONE = ~std::uint32_t(0);
+
+  struct Entry {
+    /**index in the contact generators*/
+    std::uint32_t generator;
+    /**row, or NONE*/
+    std::uint32_t row;
+  };
+
+protected:
+  typedef std::vector<real> Column;
+
+  std::vector<Entry> order;
+
+  // one per row
+  std::vector<const Particle *> firsts, seconds;
+  std::vector<std::uint8_t> anchored;
+  Column lengths, restitutions, rods;
+  // anchor of anchored rows, second end for the others
+  Column bxs, bys, bzs;
+  Column axs, ays, azs;
+  // results
+  Column nxs, nys, nzs, penetrations, violated;
+
+  /**row whose particles each contact slot holds, NONE
+   * when the slot was written by something else*/
+  std::vector<std::uint32_t> slot_rows;
+
+  /**
+    rods push both ways and are violated at any other
+    length; cables only pull, from their full length on
+   */
+  static void
+  link_rows(std::size_t begin, std::size_t end,
+            const real *__restrict ax,
+            const real *__restrict ay,
+            const real *__restrict az,
+            const real *__restrict bx,
+            const real *__restrict by,
+            const real *__restrict bz,
+            const real *__restrict length,
+            const real *__restrict rod,
+            real *__restrict nx, real *__restrict ny,
+            real *__restrict nz, real *__restrict pen,
+            real *__restrict bad) {
+    for (std::size_t i = begin; i < end; i++) {
+      real dx = bx[i] - ax[i];
+      real dy = by[i] - ay[i];
+      real dz = bz[i] - az[i];
+      // summed as glm::length does
+      real len = std::sqrt((dx * dx + dy * dy) + dz * dz);
+      // selects between reals only, so the loop vectorizes
+      real pushed = len > length[i] ? real(0) : rod[i];
+      real sign = pushed != 0 ? real(-1) : real(1);
+      nx[i] = (len > 0 ? dx / len : real(0)) * sign;
+      ny[i] = (len > 0 ? dy / len : real(0)) * sign;
+      nz[i] = (len > 0 ? dz / len : real(0)) * sign;
+      pen[i] = pushed != 0 ? length[i] - len
+                           : len - length[i];
+      real rod_bad = len != length[i] ? real(1) : real(0);
+      real cable_bad = len >= length[i] ? real(1) : real(0);
+      bad[i] = rod[i] != 0 ? rod_bad : cable_bad;
+    }
+  }
+
+  void gather(std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i++) {
+      v3 a = firsts[i]->get_position();
+      axs[i] = a.x;
+      ays[i] = a.y;
+      azs[i] = a.z;
+      if (anchored[i])
+        continue;
+      v3 b = seconds[i]->get_position();
+      bxs[i] = b.x;
+      bys[i] = b.y;
+      bzs[i] = b.z;
+    }
+  }
+
+  void evaluate_rows(std::size_t begin, std::size_t end) {
+    gather(begin, end);
+    link_rows(begin, end, axs.data(), ays.data(),
+              azs.data(), bxs.data(), bys.data(),
+              bzs.data(), lengths.data(), rods.data(),
+              nxs.data(), nys.data(), nzs.data(),
+              penetrations.data(), violated.data());
+  }
+
+  void push_row(const ParticleContactWrapper &w,
+                bool is_rod, bool is_anchored) {
+    const auto &ps = w.contact_ps.ps;
+    firsts.push_back(ps[0].get());
+    seconds.push_back(is_anchored ? nullptr
+                                  : ps[1].get());
+    anchored.push_back(is_anchored);
+    lengths.push_back(w.length_max_length);
+    restitutions.push_back(is_rod ? 0 : w.restitution);
+    rods.push_back(is_rod ? 1 : 0);
+    bxs.push_back(is_anchored ? w.anchor.x : 0);
+    bys.push_back(is_anchored ? w.anchor.y : 0);
+    bzs.push_back(is_anchored ? w.anchor.z : 0);
+  }
+
+public:
+  /**
+    rebuild from the contact data, leaving out the
+    generators flagged in skip when it is not empty
+   */
+  void
+  build(const std::vector<ParticleContactWrapper> &data,
+        const std::vector<std::uint8_t> &skip) {
+    *this = ParticleLinkBatch();
+    for (std::size_t i = 0; i < data.size(); i++) {
+      if (!skip.empty() && skip[i])
+        continue;
+      const auto &w = data[i];
+      auto g = static_cast<std::uint32_t>(i);
+      auto row = static_cast<std::uint32_t>(firsts.size());
+      switch (w.type) {
+      case ParticleContactGeneratorType::CABLE:
+        push_row(w, false, false);
+        break;
+      case ParticleContactGeneratorType::ROD:
+        push_row(w, true, false);
+        break;
+      case ParticleContactGeneratorType::CABLE_CONSTRAINT:
+        push_row(w, false, true);
+        break;
+      case ParticleContactGeneratorType::ROD_CONSTRAINT:
+        push_row(w, true, true);
+        break;
+      default:
+        row = NONE;
+      }
+      order.push_back(Entry{g, row});
+    }
+    auto n = firsts.size();
+    for (auto column : {&axs, &ays, &azs, &nxs, &nys, &nzs,
+                        &penetrations, &violated})
+      column->resize(n);
+  }
+
+  /**contact slots [begin, end) were written by another
+   * generator*/
+  void forget(unsigned int begin, unsigned int end) {
+    end = std::min<unsigned int>(
+        end, static_cast<unsigned int>(slot_rows.size()));
+    for (unsigned int k = begin; k < end; k++)
+      slot_rows[k] = NONE;
+  }
+  /**the contact buffer was replaced*/
+  void forget() { slot_rows.clear(); }
+
+  /**generators in the order their contacts are written*/
+  const std::vector<Entry> &entries() const {
+    return order;
+  }
+  unsigned int nb_rows() const {
+    return static_cast<unsigned int>(firsts.size());
+  }
+
+  /**evaluate every row, split over the pool threads when
+   * given. Rows are independent*/
+  void evaluate(ThreadPool *pool = nullptr) {
+    if (pool == nullptr) {
+      evaluate_rows(0, firsts.size());
+      return;
+    }
+    parallel_for(pool, nb_rows(),
+                 [this](unsigned int begin,
+                        unsigned int end, unsigned int) {
+                   evaluate_rows(begin, end);
+                 });
+  }
+
+  /**
+    write the contact of an evaluated row into contacts[k],
+    w is the contact data the row was built from. Returns
+    the number of contacts written, 0 when the link holds.
+
+    A link that stays violated usually lands in the same
+    slot step after step, the particles are then left in
+    place instead of copied again
+   */
+  unsigned int write(std::uint32_t row,
+                     const ParticleContactWrapper &w,
+                     std::vector<ParticleContact> &contacts,
+                     unsigned int k) {
+    if (violated[row] == 0)
+      return 0;
+    if (slot_rows.size() < contacts.size())
+      slot_rows.resize(contacts.size(), NONE);
+    auto &contact = contacts[k];
+    if (slot_rows[k] != row) {
+      contact.particles = w.contact_ps;
+      if (anchored[row])
+        contact.particles.is_double = false;
+      slot_rows[k] = row;
+    }
+    contact.contact_normal =
+        v3(nxs[row], nys[row], nzs[row]);
+    contact.penetration = penetrations[row];
+    contact.restitution = restitutions[row];
+    return 1;
+  }
+};
+};
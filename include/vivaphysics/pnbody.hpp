@@ -0,0 +1,414 @@
+#pragma once
+// Barnes-Hut gravity between many particles
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/particle.hpp>
+#include <vivaphysics/profiler.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**cell of the octree, children are stored contiguously*/
+struct OctreeNode {
+  v3 center_of_mass;
+  real mass = 0;
+  /**geometric center and half width of the cell*/
+  v3 center;
+  real half = 0;
+  unsigned int first_child = 0;
+  /**0 for a leaf*/
+  unsigned int nb_children = 0;
+  /**bodies of the cell, in Morton order*/
+  unsigned int begin = 0;
+  unsigned int end = 0;
+};
+
+/**
+  \brief inverse square attraction between every pair of
+  bodies, approximated with a Barnes-Hut octree
+
+  A cell seen under an angle smaller than theta acts as a
+  point mass at its center of mass, so a step costs
+  O(n log n) instead of the n^2 of direct summation. theta
+  of 0 gives back direct summation, 0.5 is the usual
+  trade off. A negative constant makes the bodies repel,
+  which covers other inverse square laws with the mass as
+  the charge. Softening keeps close encounters finite.
+
+  Bodies of infinite mass neither attract nor move. The
+  tree is built from sorted Morton codes: the top levels
+  serially, the subtrees below them in parallel, and the
+  force on each body is traversed independently, so the
+  result does not depend on the thread count.
+ */
+class ParticleNBodyGravity {
+public:
+  /**bits per axis of the Morton codes*/
+  static constexpr unsigned int MAX_DEPTH = 21;
+  /**cells with fewer bodies are summed directly*/
+  static constexpr unsigned int LEAF_SIZE = 8;
+  /**subtrees below this depth are built in parallel*/
+  static constexpr unsigned int SPLIT_DEPTH = 2;
+
+  Particles bodies;
+  real constant;
+  real theta;
+  real softening;
+
+protected:
+  struct Subtree {
+    unsigned int slot, begin, end, depth;
+    v3 center;
+    real half;
+  };
+
+  /**body index of each active body, in Morton order*/
+  std::vector<unsigned int> order;
+  std::vector<std::pair<std::uint64_t, unsigned int>> keys;
+  /**active bodies in Morton order*/
+  std::vector<real> xs, ys, zs, ms;
+  std::vector<OctreeNode> nodes;
+  std::vector<Subtree> subtrees;
+  std::vector<std::vector<OctreeNode>> subtree_nodes;
+  std::vector<v3> lows, highs;
+  v3 root_center;
+  real root_half = 0;
+
+  /**spread the 21 low bits of v three bits apart*/
+  static std::uint64_t spread_bits(std::uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+  }
+
+  /**octant of the code at depth: x, y, z high to low*/
+  static unsigned int octant(std::uint64_t code,
+                             unsigned int depth) {
+    return static_cast<unsigned int>(
+        (code >> (3 * (MAX_DEPTH - 1 - depth))) & 7);
+  }
+
+  void leaf_moments(OctreeNode &n) const {
+    real m = 0, x = 0, y = 0, z = 0;
+    for (unsigned int j = n.begin; j < n.end; j++) {
+      m += ms[j];
+      x += ms[j] * xs[j];
+      y += ms[j] * ys[j];
+      z += ms[j] * zs[j];
+    }
+    n.mass = m;
+    n.center_of_mass = v3(x / m, y / m, z / m);
+  }
+
+  static void inner_moments(std::vector<OctreeNode> &out,
+                            unsigned int at) {
+    real m = 0;
+    v3 weighted(0);
+    auto &n = out[at];
+    for (unsigned int c = 0; c < n.nb_children; c++) {
+      const auto &child = out[n.first_child + c];
+      m += child.mass;
+      weighted += child.center_of_mass * child.mass;
+    }
+    n.mass = m;
+    n.center_of_mass = weighted * (1 / m);
+  }
+
+  /**
+    \brief fill out[at] with the cell of bodies
+    [begin, end), recursing into its children
+
+    With defer set, cells reaching SPLIT_DEPTH are left
+    as placeholders to be built as separate subtrees.
+   */
+  void build_node(std::vector<OctreeNode> &out,
+                  unsigned int at, unsigned int begin,
+                  unsigned int end, unsigned int depth,
+                  const v3 &center, real half,
+                  std::vector<Subtree> *defer) const {
+    OctreeNode n;
+    n.center = center;
+    n.half = half;
+    n.begin = begin;
+    n.end = end;
+    if (end - begin <= LEAF_SIZE || depth == MAX_DEPTH) {
+      leaf_moments(n);
+      out[at] = n;
+      return;
+    }
+    if (defer != nullptr && depth == SPLIT_DEPTH) {
+      out[at] = n;
+      defer->push_back(
+          Subtree{at, begin, end, depth, center, half});
+      return;
+    }
+    // children ranges, codes are sorted
+    unsigned int bounds[9];
+    bounds[0] = begin;
+    for (unsigned int d = 0; d < 8; d++) {
+      auto first = keys.begin() + bounds[d];
+      auto last = keys.begin() + end;
+      auto it = std::partition_point(
+          first, last, [depth, d](const auto &k) {
+            return octant(k.first, depth) <= d;
+          });
+      bounds[d + 1] = static_cast<unsigned int>(
+          std::distance(keys.begin(), it));
+    }
+    n.first_child = static_cast<unsigned int>(out.size());
+    for (unsigned int d = 0; d < 8; d++)
+      if (bounds[d + 1] > bounds[d])
+        n.nb_children++;
+    out[at] = n;
+    out.resize(out.size() + n.nb_children);
+    unsigned int c = n.first_child;
+    real q = half / 2;
+    for (unsigned int d = 0; d < 8; d++) {
+      if (bounds[d + 1] == bounds[d])
+        continue;
+      v3 child_center(center.x + (d & 4 ? q : -q),
+                      center.y + (d & 2 ? q : -q),
+                      center.z + (d & 1 ? q : -q));
+      build_node(out, c, bounds[d], bounds[d + 1],
+                 depth + 1, child_center, q, defer);
+      c++;
+    }
+    inner_moments(out, at);
+  }
+
+  void sort_bodies(ThreadPool *pool) {
+    order.clear();
+    for (unsigned int i = 0; i < bodies.size(); i++)
+      if (bodies[i]->get_inverse_mass() > 0)
+        order.push_back(i);
+    auto n = static_cast<unsigned int>(order.size());
+
+    // bounding cube
+    unsigned int nb = pool ? pool->nb_threads() : 1;
+    const real inf = std::numeric_limits<real>::infinity();
+    lows.assign(nb, v3(inf, inf, inf));
+    highs.assign(nb, v3(-inf, -inf, -inf));
+    parallel_for(
+        pool, n,
+        [this](unsigned int begin, unsigned int end,
+               unsigned int tid) {
+          v3 lo = lows[tid], hi = highs[tid];
+          for (unsigned int k = begin; k < end; k++) {
+            v3 p = bodies[order[k]]->get_position();
+            lo = glm::min(lo.to_glm(), p.to_glm());
+            hi = glm::max(hi.to_glm(), p.to_glm());
+          }
+          lows[tid] = lo;
+          highs[tid] = hi;
+        });
+    v3 lo = lows[0], hi = highs[0];
+    for (unsigned int t = 1; t < nb; t++) {
+      lo = glm::min(lo.to_glm(), lows[t].to_glm());
+      hi = glm::max(hi.to_glm(), highs[t].to_glm());
+    }
+    real size = std::max(
+        hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+    size = size > 0 ? size * (1 + 1e-4f) : 1;
+    root_center = lo + v3(size / 2, size / 2, size / 2);
+    root_half = size / 2;
+
+    // Morton order, ties broken by body index
+    keys.resize(n);
+    const real scale =
+        static_cast<real>(1 << MAX_DEPTH) / size;
+    parallel_for(
+        pool, n,
+        [this, lo, scale](unsigned int begin,
+                          unsigned int end, unsigned int) {
+          const real top = (1 << MAX_DEPTH) - 1;
+          for (unsigned int k = begin; k < end; k++) {
+            v3 p = bodies[order[k]]->get_position();
+            v3 cell = (p - lo) * scale;
+            auto q = [top](real v) {
+              return static_cast<std::uint64_t>(
+                  std::min(std::max(v, real(0)), top));
+            };
+            keys[k].first = spread_bits(q(cell.x)) << 2 |
+                            spread_bits(q(cell.y)) << 1 |
+                            spread_bits(q(cell.z));
+            keys[k].second = order[k];
+          }
+        });
+    parallel_sort(pool, keys.begin(), keys.end(),
+                  [](const auto &a, const auto &b) {
+                    return a < b;
+                  });
+
+    xs.resize(n);
+    ys.resize(n);
+    zs.resize(n);
+    ms.resize(n);
+    parallel_for(pool, n,
+                 [this](unsigned int begin,
+                        unsigned int end, unsigned int) {
+                   for (unsigned int k = begin; k < end;
+                        k++) {
+                     order[k] = keys[k].second;
+                     const auto &p = bodies[order[k]];
+                     v3 pos = p->get_position();
+                     xs[k] = pos.x;
+                     ys[k] = pos.y;
+                     zs[k] = pos.z;
+                     ms[k] = p->get_mass();
+                   }
+                 });
+  }
+
+  void build_tree(ThreadPool *pool) {
+    auto n = static_cast<unsigned int>(order.size());
+    nodes.assign(1, OctreeNode());
+    subtrees.clear();
+    build_node(nodes, 0, 0, n, 0, root_center, root_half,
+               &subtrees);
+    auto nb_top = static_cast<unsigned int>(nodes.size());
+    auto nb_sub =
+        static_cast<unsigned int>(subtrees.size());
+    if (subtree_nodes.size() < nb_sub)
+      subtree_nodes.resize(nb_sub);
+    parallel_for(pool, nb_sub,
+                 [this](unsigned int begin,
+                        unsigned int end, unsigned int) {
+                   for (unsigned int s = begin; s < end;
+                        s++) {
+                     const auto &t = subtrees[s];
+                     auto &out = subtree_nodes[s];
+                     out.assign(1, OctreeNode());
+                     build_node(out, 0, t.begin, t.end,
+                                t.depth, t.center, t.half,
+                                nullptr);
+                   }
+                 });
+    // splice: local node j > 0 lands at offset + j - 1
+    for (unsigned int s = 0; s < nb_sub; s++) {
+      const auto &sub = subtree_nodes[s];
+      auto offset = static_cast<unsigned int>(nodes.size());
+      auto remap = [offset](OctreeNode c) {
+        if (c.nb_children > 0)
+          c.first_child += offset - 1;
+        return c;
+      };
+      nodes[subtrees[s].slot] = remap(sub[0]);
+      for (unsigned int j = 1; j < sub.size(); j++)
+        nodes.push_back(remap(sub[j]));
+    }
+    // top cells above the subtrees, children first
+    for (unsigned int i = nb_top; i-- > 0;)
+      if (nodes[i].nb_children > 0)
+        inner_moments(nodes, i);
+  }
+
+  /**acceleration of the k th body in Morton order*/
+  v3 traverse(unsigned int k) const {
+    const real px = xs[k], py = ys[k], pz = zs[k];
+    const real eps2 = softening * softening;
+    const real theta2 = theta * theta;
+    real ax = 0, ay = 0, az = 0;
+    unsigned int stack[8 * MAX_DEPTH + 8];
+    unsigned int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const auto &n = nodes[stack[--top]];
+      if (n.nb_children == 0) {
+        for (unsigned int j = n.begin; j < n.end; j++) {
+          real dx = xs[j] - px, dy = ys[j] - py,
+               dz = zs[j] - pz;
+          real d2 = dx * dx + dy * dy + dz * dz + eps2;
+          real inv = j == k ? 0 : 1 / std::sqrt(d2);
+          real s = ms[j] * inv * inv * inv;
+          ax += s * dx;
+          ay += s * dy;
+          az += s * dz;
+        }
+        continue;
+      }
+      real dx = n.center_of_mass.x - px,
+           dy = n.center_of_mass.y - py,
+           dz = n.center_of_mass.z - pz;
+      real d2 = dx * dx + dy * dy + dz * dz;
+      real width = 2 * n.half;
+      if (width * width < theta2 * d2) {
+        d2 += eps2;
+        real inv = 1 / std::sqrt(d2);
+        real s = n.mass * inv * inv * inv;
+        ax += s * dx;
+        ay += s * dy;
+        az += s * dz;
+        continue;
+      }
+      // children are visited in order
+      for (unsigned int c = n.nb_children; c-- > 0;)
+        stack[top++] = n.first_child + c;
+    }
+    return v3(ax, ay, az) * constant;
+  }
+
+public:
+  ParticleNBodyGravity(real g = 1, real opening = 0.5f,
+                       real eps = 0.01f)
+      : constant(g), theta(opening), softening(eps) {}
+  ParticleNBodyGravity(const Particles &ps, real g = 1,
+                       real opening = 0.5f,
+                       real eps = 0.01f)
+      : bodies(ps), constant(g), theta(opening),
+        softening(eps) {}
+
+  /**octree of the last update_forces*/
+  const std::vector<OctreeNode> &get_nodes() const {
+    return nodes;
+  }
+
+  /**acceleration on body i from direct summation, for
+   * checking the approximation*/
+  v3 direct_acceleration(unsigned int i) const {
+    v3 p = bodies[i]->get_position();
+    v3 acc(0);
+    const real eps2 = softening * softening;
+    for (unsigned int j = 0; j < bodies.size(); j++) {
+      if (j == i || bodies[j]->get_inverse_mass() <= 0)
+        continue;
+      v3 d = bodies[j]->get_position() - p;
+      real inv = 1 / std::sqrt(d.dot(d) + eps2);
+      acc += d * (bodies[j]->get_mass() * inv * inv * inv);
+    }
+    return acc * constant;
+  }
+
+  /**build the tree and add the force of every body on
+   * every other one, the duration is not used*/
+  void update_forces(real, ThreadPool *pool = nullptr) {
+    VP_PROFILE_ZONE("force/nbody");
+    {
+      VP_PROFILE_ZONE("nbody/sort");
+      sort_bodies(pool);
+    }
+    if (order.empty())
+      return;
+    {
+      VP_PROFILE_ZONE("nbody/build");
+      build_tree(pool);
+    }
+    VP_PROFILE_ZONE("nbody/traverse");
+    auto n = static_cast<unsigned int>(order.size());
+    parallel_for(pool, n,
+                 [this](unsigned int begin,
+                        unsigned int end, unsigned int) {
+                   for (unsigned int k = begin; k < end;
+                        k++) {
+                     v3 acc = traverse(k) * ms[k];
+                     bodies[order[k]]->add_force(acc);
+                   }
+                 });
+  }
+};
+};
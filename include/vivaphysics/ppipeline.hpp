@@ -0,0 +1,314 @@
+#pragma once
+// force generators fused at compile time
+#include <external.hpp>
+#include <tuple>
+#include <utility>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/particle.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief force of a generator on one particle, in scalars
+
+  Specialized for the generators that only read the state
+  of the particle they push. add() accumulates into f the
+  same force as ParticleForceGenerator<T>::update_force,
+  without branches so that a loop over it vectorizes. im
+  is the inverse mass. The specializations sit next to the
+  generators in pfgen.hpp.
+ */
+template <class T> struct PipelineForce {
+  static void add(const T &generator, real x, real y,
+                  real z, real u, real v, real w, real im,
+                  real &f0, real &f1, real &f2);
+};
+
+/**pipelines of any generator types, as the registry
+ * and the world hold them*/
+class ParticleForcePipeline {
+public:
+  /**the group, appending directly is fine*/
+  Particles particles;
+
+  virtual ~ParticleForcePipeline() {}
+  /**add the forces of the generators to the group*/
+  virtual void update_forces(real duration,
+                             ThreadPool *pool) = 0;
+  /**push and integrate the group in one pass*/
+  virtual void integrate(real duration,
+                         ThreadPool *pool) = 0;
+
+  void add(std::shared_ptr<Particle> p) {
+    particles.push_back(p);
+  }
+  unsigned int size() const {
+    return static_cast<unsigned int>(particles.size());
+  }
+};
+
+/**
+  \brief a group of particles pushed by the same
+  generators, known at compile time
+
+  ForcePipeline<ParticleGravity, ParticleDrag> holds one
+  instance of each generator and applies all of them to
+  every particle in a single loop: the generator bodies are
+  inlined one after the other, there is no wrapper, no
+  switch and no registration per particle. The loop gathers
+  positions, velocities and inverse masses into arrays,
+  sums the forces of the generators in the order of the
+  template arguments, then adds the sum to each particle.
+
+  Only generators with a PipelineForce specialization fit,
+  springs between two particles stay in the registry.
+
+  integrate() fuses the generators with the integration of
+  the group: each block of particles is read once, pushed,
+  moved and written back while it is still in cache, and
+  the pipeline force is never stored in the particles.
+  Forces other generators accumulated in them are added on
+  the way.
+ */
+template <class... Gens>
+class ForcePipeline : public ParticleForcePipeline {
+public:
+  std::tuple<Gens...> generators;
+
+protected:
+  /**particles gathered at once, small enough for the
+   * columns of a block to stay in the first level cache*/
+  static constexpr std::size_t BLOCK = 256;
+
+  typedef std::vector<real> Column;
+  Column xs, ys, zs, us, vs, ws, ims, f0s, f1s, f2s;
+  // integrate() only: acceleration and damping factor
+  Column gxs, gys, gzs, dfs;
+
+  template <std::size_t... I>
+  static void add_all(const std::tuple<Gens...> &gens,
+                      std::index_sequence<I...>, real x,
+                      real y, real z, real u, real v,
+                      real w, real im, real &f0, real &f1,
+                      real &f2) {
+    (PipelineForce<Gens>::add(std::get<I>(gens), x, y, z,
+                              u, v, w, im, f0, f1, f2),
+     ...);
+  }
+
+  /**the fused loop*/
+  static void
+  force_rows(std::size_t begin, std::size_t end,
+             const std::tuple<Gens...> &gens,
+             const real *__restrict x,
+             const real *__restrict y,
+             const real *__restrict z,
+             const real *__restrict u,
+             const real *__restrict v,
+             const real *__restrict w,
+             const real *__restrict im, real *__restrict f0,
+             real *__restrict f1, real *__restrict f2) {
+    for (std::size_t i = begin; i < end; i++) {
+      real a = 0, b = 0, c = 0;
+      add_all(gens, std::index_sequence_for<Gens...>(),
+              x[i], y[i], z[i], u[i], v[i], w[i], im[i], a,
+              b, c);
+      f0[i] = a;
+      f1[i] = b;
+      f2[i] = c;
+    }
+  }
+
+  /**
+    integrate as Particle::integrate does, the position
+    moves with the velocity of the start of the step. f
+    holds the other forces on input
+   */
+  static void
+  fused_rows(std::size_t begin, std::size_t end,
+             real duration, const std::tuple<Gens...> &gens,
+             real *__restrict x, real *__restrict y,
+             real *__restrict z, real *__restrict u,
+             real *__restrict v, real *__restrict w,
+             const real *__restrict im,
+             const real *__restrict g0,
+             const real *__restrict g1,
+             const real *__restrict g2,
+             const real *__restrict damp,
+             const real *__restrict f0,
+             const real *__restrict f1,
+             const real *__restrict f2) {
+    for (std::size_t i = begin; i < end; i++) {
+      real a = f0[i], b = f1[i], c = f2[i];
+      add_all(gens, std::index_sequence_for<Gens...>(),
+              x[i], y[i], z[i], u[i], v[i], w[i], im[i], a,
+              b, c);
+      x[i] += u[i] * duration;
+      y[i] += v[i] * duration;
+      z[i] += w[i] * duration;
+      u[i] = (u[i] + (g0[i] + a * im[i]) * duration) *
+             damp[i];
+      v[i] = (v[i] + (g1[i] + b * im[i]) * duration) *
+             damp[i];
+      w[i] = (w[i] + (g2[i] + c * im[i]) * duration) *
+             damp[i];
+    }
+  }
+
+  void gather(std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i++) {
+      const Particle &p = *particles[i];
+      v3 pos = p.get_position(), vel = p.get_velocity();
+      xs[i] = pos.x;
+      ys[i] = pos.y;
+      zs[i] = pos.z;
+      us[i] = vel.x;
+      vs[i] = vel.y;
+      ws[i] = vel.z;
+      ims[i] = p.get_inverse_mass();
+    }
+  }
+
+  void update_rows(std::size_t begin, std::size_t end) {
+    for (auto b = begin; b < end; b += BLOCK) {
+      auto e = std::min(end, b + BLOCK);
+      gather(b, e);
+      force_rows(b, e, generators, xs.data(), ys.data(),
+                 zs.data(), us.data(), vs.data(),
+                 ws.data(), ims.data(), f0s.data(),
+                 f1s.data(), f2s.data());
+      for (auto i = b; i < e; i++)
+        particles[i]->add_force(
+            v3(f0s[i], f1s[i], f2s[i]));
+    }
+  }
+
+  void integrate_block(std::size_t begin, std::size_t end,
+                       real duration) {
+    gather(begin, end);
+    // the damping of a group is usually shared, pow once
+    // per run of equal values
+    real damping = -1, factor = 0;
+    for (auto i = begin; i < end; i++) {
+      const Particle &p = *particles[i];
+      v3 acc = p.get_acceleration();
+      v3 force = p.get_accumulated_force();
+      gxs[i] = acc.x;
+      gys[i] = acc.y;
+      gzs[i] = acc.z;
+      f0s[i] = force.x;
+      f1s[i] = force.y;
+      f2s[i] = force.z;
+      if (p.get_damping() != damping) {
+        damping = p.get_damping();
+        factor =
+            static_cast<real>(pow(damping, duration));
+      }
+      dfs[i] = factor;
+    }
+    fused_rows(begin, end, duration, generators, xs.data(),
+               ys.data(), zs.data(), us.data(), vs.data(),
+               ws.data(), ims.data(), gxs.data(),
+               gys.data(), gzs.data(), dfs.data(),
+               f0s.data(), f1s.data(), f2s.data());
+    for (auto i = begin; i < end; i++) {
+      // fixed particles keep their state, as in
+      // Particle::integrate
+      if (ims[i] <= 0)
+        continue;
+      Particle &p = *particles[i];
+      p.set_position(xs[i], ys[i], zs[i]);
+      p.set_velocity(us[i], vs[i], ws[i]);
+      p.clear_accumulator();
+    }
+  }
+
+  void integrate_rows(std::size_t begin, std::size_t end,
+                      real duration) {
+    for (auto b = begin; b < end; b += BLOCK)
+      integrate_block(b, std::min(end, b + BLOCK),
+                      duration);
+  }
+
+  /**size the columns, the acceleration ones only when
+   * integrating*/
+  void resize(bool integrating) {
+    auto n = particles.size();
+    for (auto column : {&xs, &ys, &zs, &us, &vs, &ws, &ims,
+                        &f0s, &f1s, &f2s})
+      column->resize(n);
+    if (integrating)
+      for (auto column : {&gxs, &gys, &gzs, &dfs})
+        column->resize(n);
+  }
+
+public:
+  ForcePipeline(const Gens &... gens)
+      : generators(gens...) {}
+
+  /**the I th generator, changes apply from the next
+   * update*/
+  template <std::size_t I> auto &get() {
+    return std::get<I>(generators);
+  }
+
+  /**
+    \brief push the group, split over the pool threads when
+    given
+
+    Each particle receives a single add_force, whatever the
+    number of generators, and the sum does not depend on
+    the thread count. The step length is unused, the
+    supported generators do not depend on it.
+   */
+  void update_forces(real,
+                     ThreadPool *pool = nullptr) override {
+    resize(false);
+    if (pool == nullptr) {
+      update_rows(0, particles.size());
+      return;
+    }
+    parallel_for(pool, size(),
+                 [this](unsigned int begin,
+                        unsigned int end, unsigned int) {
+                   update_rows(begin, end);
+                 });
+  }
+
+  /**
+    \brief push and integrate the group, then clear the
+    accumulators
+
+    Replaces update_forces() followed by the integration
+    of the particles, which then must not be integrated
+    elsewhere. Particles are independent, the result does
+    not depend on the thread count.
+   */
+  void integrate(real duration,
+                 ThreadPool *pool = nullptr) override {
+    D_CHECK_MSG(duration > 0.0,
+                "duration should be bigger than 0");
+    resize(true);
+    if (pool == nullptr) {
+      integrate_rows(0, particles.size(), duration);
+      return;
+    }
+    parallel_for(pool, size(),
+                 [this, duration](unsigned int begin,
+                                  unsigned int end,
+                                  unsigned int) {
+                   integrate_rows(begin, end, duration);
+                 });
+  }
+};
+
+/**make a pipeline owned by a shared pointer, ready for
+ * ParticleForceRegistry::add_pipeline*/
+template <class... Gens>
+std::shared_ptr<ForcePipeline<Gens...>>
+make_force_pipeline(const Gens &... gens) {
+  return std::make_shared<ForcePipeline<Gens...>>(gens...);
+}
+};
@@ -0,0 +1,276 @@
+#pragma once
+// pooled storage for short lived particles
+#include <external.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/particle.hpp>
+#include <vivaphysics/phandle.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**handle to a particle of ParticleWorld or ParticlePool*/
+typedef Handle ParticleHandle;
+
+/**
+  \brief axis aligned box that retires the pooled
+  particles entering it
+
+  The half space helpers cover the usual floor and far
+  plane cases.
+ */
+struct KillRegion {
+  v3 lo;
+  v3 hi;
+
+  KillRegion() {}
+  KillRegion(const v3 &l, const v3 &h) : lo(l), hi(h) {}
+
+  /**every point with coordinate axis below value*/
+  static KillRegion below(unsigned int axis, real value) {
+    KillRegion r = everywhere();
+    r.hi[axis] = value;
+    return r;
+  }
+  /**every point with coordinate axis above value*/
+  static KillRegion above(unsigned int axis, real value) {
+    KillRegion r = everywhere();
+    r.lo[axis] = value;
+    return r;
+  }
+  static KillRegion everywhere() {
+    const real inf = std::numeric_limits<real>::infinity();
+    return KillRegion(v3(-inf, -inf, -inf),
+                      v3(inf, inf, inf));
+  }
+};
+
+/**
+  \brief particles stored by value, packed and recycled
+
+  Meant for projectiles, debris and sparks: particles that
+  are spawned and despawned constantly and are only moved by
+  their own acceleration. Live particles are kept contiguous
+  in [begin(), end()), despawning moves the last one into
+  the hole. Freed slots are reused through the free list of
+  the handle table, so once the pool is reserved spawning
+  and despawning are O(1) and never allocate.
+
+  Each particle may have a lifetime, retire() ages them and
+  drops the expired ones along with those inside kill
+  regions in one sweep.
+ */
+class ParticlePool {
+protected:
+  std::vector<Particle> live;
+  /**seconds left to live, infinite by default*/
+  std::vector<real> life;
+  HandleTable handles;
+
+  // retire() scratch, kept to avoid allocating
+  std::vector<real> xs, ys, zs;
+  std::vector<std::uint8_t> kill;
+
+  /**age the particles and flag the expired ones*/
+  static void
+  expire_rows(std::size_t begin, std::size_t end,
+              real duration, real *__restrict left,
+              std::uint8_t *__restrict dead) {
+    for (std::size_t i = begin; i < end; i++) {
+      left[i] -= duration;
+      dead[i] = left[i] <= 0;
+    }
+  }
+
+  /**flag the particles inside [lo, hi]*/
+  static void
+  inside_rows(std::size_t begin, std::size_t end,
+              const real *__restrict x,
+              const real *__restrict y,
+              const real *__restrict z, const v3 &lo,
+              const v3 &hi, std::uint8_t *__restrict dead) {
+    const real lx = lo.x, ly = lo.y, lz = lo.z;
+    const real hx = hi.x, hy = hi.y, hz = hi.z;
+    // no short circuit, a branch would stop the
+    // vectorizer
+    for (std::size_t i = begin; i < end; i++) {
+      int in = (x[i] >= lx) & (x[i] <= hx) & (y[i] >= ly) &
+               (y[i] <= hy) & (z[i] >= lz) & (z[i] <= hz);
+      dead[i] = dead[i] | static_cast<std::uint8_t>(in);
+    }
+  }
+
+public:
+  static constexpr real FOREVER =
+      std::numeric_limits<real>::infinity();
+
+  ParticlePool() {}
+  ParticlePool(unsigned int capacity) { reserve(capacity); }
+
+  /**room for n live particles, spawning past it
+   * reallocates*/
+  void reserve(unsigned int n) {
+    live.reserve(n);
+    life.reserve(n);
+    handles.reserve(n);
+    xs.reserve(n);
+    ys.reserve(n);
+    zs.reserve(n);
+    kill.reserve(n);
+  }
+
+  unsigned int size() const {
+    return static_cast<unsigned int>(live.size());
+  }
+  unsigned int capacity() const {
+    return static_cast<unsigned int>(live.capacity());
+  }
+  bool empty() const { return live.empty(); }
+
+  /**the particle retires after lifetime seconds*/
+  ParticleHandle spawn(const Particle &p,
+                       real lifetime = FOREVER) {
+    live.push_back(p);
+    life.push_back(lifetime);
+    return handles.push_back();
+  }
+
+  /**seconds left to the i th live particle*/
+  real lifetime(unsigned int i) const { return life[i]; }
+
+  bool contains(ParticleHandle h) const {
+    return handles.contains(h);
+  }
+
+  /**false when the particle was despawned already*/
+  bool despawn(ParticleHandle h) {
+    if (!handles.contains(h))
+      return false;
+    despawn_index(handles.index(h));
+    return true;
+  }
+
+  /**
+    \brief despawn the i th live particle
+
+    The last particle takes index i, so walk the live range
+    backwards when despawning during a traversal. Arrays
+    kept beside the pool follow with swap_and_pop.
+   */
+  void despawn_index(unsigned int i) {
+    handles.erase_index(i);
+    swap_and_pop(live, i);
+    swap_and_pop(life, i);
+  }
+
+  /**despawn every particle matching pred, returns how many
+   * went*/
+  template <class Pred> unsigned int despawn_if(Pred pred) {
+    unsigned int nb = 0;
+    for (auto i = size(); i-- > 0;) {
+      if (pred(live[i])) {
+        despawn_index(i);
+        nb++;
+      }
+    }
+    return nb;
+  }
+
+  /**every handle goes stale*/
+  void clear() {
+    live.clear();
+    life.clear();
+    handles.clear();
+  }
+
+  /**
+    \brief age every particle by duration and despawn the
+    expired ones and those inside a region
+
+    Unlike despawn the survivors keep their order: the flags
+    are computed by contiguous loops over the lifetimes and
+    a copy of the positions, then the live range is stream
+    compacted once. Returns the number retired.
+   */
+  unsigned int
+  retire(real duration,
+         const std::vector<KillRegion> &regions) {
+    auto n = size();
+    if (n == 0)
+      return 0;
+    kill.resize(n);
+    expire_rows(0, n, duration, life.data(), kill.data());
+    if (!regions.empty()) {
+      xs.resize(n);
+      ys.resize(n);
+      zs.resize(n);
+      for (unsigned int i = 0; i < n; i++) {
+        v3 pos = live[i].get_position();
+        xs[i] = pos.x;
+        ys[i] = pos.y;
+        zs[i] = pos.z;
+      }
+      for (const auto &r : regions)
+        inside_rows(0, n, xs.data(), ys.data(), zs.data(),
+                    r.lo, r.hi, kill.data());
+    }
+    unsigned int nb_dead = 0;
+    for (unsigned int i = 0; i < n; i++)
+      nb_dead += kill[i];
+    if (nb_dead == 0)
+      return 0;
+    handles.compact(kill.data());
+    compact_array(live, kill.data());
+    compact_array(life, kill.data());
+    return nb_dead;
+  }
+
+  /**particle of a live handle, throws on a stale one*/
+  Particle &get(ParticleHandle h) {
+    return live[handles.index(h)];
+  }
+  const Particle &get(ParticleHandle h) const {
+    return live[handles.index(h)];
+  }
+  ParticleHandle handle(unsigned int i) const {
+    return handles.handle(i);
+  }
+
+  Particle &operator[](unsigned int i) { return live[i]; }
+  const Particle &operator[](unsigned int i) const {
+    return live[i];
+  }
+  Particle *data() { return live.data(); }
+  std::vector<Particle>::iterator begin() {
+    return live.begin();
+  }
+  std::vector<Particle>::iterator end() {
+    return live.end();
+  }
+  std::vector<Particle>::const_iterator begin() const {
+    return live.begin();
+  }
+  std::vector<Particle>::const_iterator end() const {
+    return live.end();
+  }
+
+  /**integrate the live range, split over the pool threads
+   * when given*/
+  void integrate(real duration,
+                 ThreadPool *pool = nullptr) {
+    if (pool == nullptr) {
+      for (auto &p : live)
+        p.integrate(duration);
+      return;
+    }
+    parallel_for(pool, size(),
+                 [this, duration](unsigned int begin,
+                                  unsigned int end,
+                                  unsigned int) {
+                   for (unsigned int i = begin; i < end;
+                        i++)
+                     live[i].integrate(duration);
+                 });
+  }
+};
+};
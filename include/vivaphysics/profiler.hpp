@@ -0,0 +1,295 @@
+#pragma once
+// scoped instrumentation zones for the simulation loop
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <external.hpp>
+#include <mutex>
+
+namespace vivaphysics {
+
+/**
+  \brief one closed zone or one counter sample
+
+  Names must outlive the profiler, string literals are what
+  the zone macros pass.
+ */
+struct ProfileEvent {
+  const char *name = nullptr;
+  std::uint64_t start_ns = 0;
+  /**zone duration, unused for counters*/
+  std::uint64_t duration_ns = 0;
+  double value = 0;
+  bool is_counter = false;
+};
+
+/**
+  \brief events written by a single thread
+
+  Only the owning thread writes, the count is published with
+  release semantics so a reader between steps sees complete
+  events without any lock. When full the oldest events are
+  overwritten.
+ */
+struct ProfileBuffer {
+  unsigned int thread_id;
+  std::vector<ProfileEvent> events;
+  std::atomic<std::uint64_t> written;
+
+  ProfileBuffer(unsigned int tid, std::size_t capacity)
+      : thread_id(tid), events(capacity), written(0) {}
+
+  void push(const ProfileEvent &e) {
+    auto n = written.load(std::memory_order_relaxed);
+    events[n % events.size()] = e;
+    written.store(n + 1, std::memory_order_release);
+  }
+};
+
+/** aggregate of every sample recorded under one name */
+struct ZoneStats {
+  std::uint64_t count = 0;
+  double total = 0;
+  double min = 0;
+  double max = 0;
+  /**exponential moving average, same weights as the frame
+   * time average of the demos*/
+  double average = 0;
+  double last = 0;
+
+  void add(double v) {
+    if (count == 0) {
+      min = v;
+      max = v;
+      average = v;
+    } else {
+      min = std::min(min, v);
+      max = std::max(max, v);
+      average = average * 0.99 + v * 0.01;
+    }
+    last = v;
+    total += v;
+    count++;
+  }
+  double mean() const {
+    return count == 0 ? 0 : total / count;
+  }
+};
+
+class Profiler {
+protected:
+  typedef std::chrono::steady_clock Clock;
+
+  Clock::time_point epoch;
+  std::mutex registration;
+  std::vector<std::unique_ptr<ProfileBuffer>> buffers;
+  /**events of each buffer already folded into stats*/
+  std::vector<std::uint64_t> collected;
+  std::map<std::string, ZoneStats> stats;
+  std::size_t capacity;
+
+  Profiler(std::size_t cap = 1 << 16)
+      : epoch(Clock::now()), capacity(cap) {}
+
+  ProfileBuffer *register_thread() {
+    std::lock_guard<std::mutex> lock(registration);
+    auto tid = static_cast<unsigned int>(buffers.size());
+    buffers.push_back(
+        std::make_unique<ProfileBuffer>(tid, capacity));
+    collected.push_back(0);
+    return buffers.back().get();
+  }
+
+  /**oldest event still held by buffer b*/
+  std::uint64_t first_held(const ProfileBuffer &b,
+                           std::uint64_t n) const {
+    return n > b.events.size() ? n - b.events.size() : 0;
+  }
+
+public:
+  static Profiler &get() {
+    static Profiler profiler;
+    return profiler;
+  }
+
+  std::uint64_t now_ns() const {
+    using std::chrono::nanoseconds;
+    auto ns = std::chrono::duration_cast<nanoseconds>(
+        Clock::now() - epoch);
+    return static_cast<std::uint64_t>(ns.count());
+  }
+
+  /**buffer of the calling thread, created on first use*/
+  ProfileBuffer &thread_buffer() {
+    thread_local ProfileBuffer *buffer = nullptr;
+    if (buffer == nullptr)
+      buffer = register_thread();
+    return *buffer;
+  }
+
+  void zone(const char *name, std::uint64_t start,
+            std::uint64_t end) {
+    ProfileEvent e;
+    e.name = name;
+    e.start_ns = start;
+    e.duration_ns = end - start;
+    thread_buffer().push(e);
+  }
+  void counter(const char *name, double value) {
+    ProfileEvent e;
+    e.name = name;
+    e.start_ns = now_ns();
+    e.value = value;
+    e.is_counter = true;
+    thread_buffer().push(e);
+  }
+
+  /**
+    \brief fold events recorded since the last call into the
+    aggregate statistics
+
+    Call it from one thread while no step is running, zone
+    durations are aggregated in nanoseconds.
+   */
+  void collect() {
+    std::lock_guard<std::mutex> lock(registration);
+    for (std::size_t i = 0; i < buffers.size(); i++) {
+      auto &b = *buffers[i];
+      auto n = b.written.load(std::memory_order_acquire);
+      auto k = std::max(collected[i], first_held(b, n));
+      for (; k < n; k++) {
+        auto &e = b.events[k % b.events.size()];
+        stats[e.name].add(e.is_counter
+                              ? e.value
+                              : static_cast<double>(
+                                    e.duration_ns));
+      }
+      collected[i] = n;
+    }
+  }
+
+  const std::map<std::string, ZoneStats> &
+  get_stats() const {
+    return stats;
+  }
+
+  /**drop every recorded event and statistic*/
+  void reset() {
+    std::lock_guard<std::mutex> lock(registration);
+    for (std::size_t i = 0; i < buffers.size(); i++) {
+      buffers[i]->written.store(0,
+                                std::memory_order_release);
+      collected[i] = 0;
+    }
+    stats.clear();
+  }
+
+  /**
+    \brief write the held events in the chrome trace event
+    format, loadable in chrome://tracing or perfetto
+   */
+  void write_chrome_trace(std::ostream &out) {
+    std::lock_guard<std::mutex> lock(registration);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (auto &bptr : buffers) {
+      auto &b = *bptr;
+      auto n = b.written.load(std::memory_order_acquire);
+      for (auto k = first_held(b, n); k < n; k++) {
+        auto &e = b.events[k % b.events.size()];
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"" << e.name << "\",\"pid\":1"
+            << ",\"tid\":" << b.thread_id
+            << ",\"ts\":" << e.start_ns / 1000.0;
+        if (e.is_counter) {
+          out << ",\"ph\":\"C\",\"args\":{\"value\":"
+              << e.value << "}}";
+        } else {
+          out << ",\"ph\":\"X\",\"dur\":"
+              << e.duration_ns / 1000.0 << "}";
+        }
+      }
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\"}" << std::endl;
+  }
+
+  /**one line per zone or counter name*/
+  void write_stats(std::ostream &out) const {
+    for (auto & [ name, s ] : stats) {
+      out << name << " count: " << s.count
+          << " mean: " << s.mean()
+          << " average: " << s.average << " min: " << s.min
+          << " max: " << s.max << std::endl;
+    }
+  }
+};
+
+/** records the time between construction and destruction */
+struct ProfileZone {
+  const char *name;
+  std::uint64_t start;
+  ProfileZone(const char *n)
+      : name(n), start(Profiler::get().now_ns()) {}
+  ~ProfileZone() {
+    auto &profiler = Profiler::get();
+    profiler.zone(name, start, profiler.now_ns());
+  }
+};
+
+/**
+  \brief per category time totals inside one zone
+
+  Used where a zone per item would be too fine, e.g. one
+  total per force generator type over the whole registry.
+  Every member is empty unless profiling is compiled in.
+ */
+template <unsigned int N> struct ProfileTally {
+#ifdef VIVAPHYSICS_PROFILE
+  std::uint64_t ns[N] = {};
+  std::uint64_t mark = 0;
+  void begin() { mark = Profiler::get().now_ns(); }
+  void end(unsigned int k) {
+    ns[k] += Profiler::get().now_ns() - mark;
+  }
+  /**one counter per category that took any time*/
+  void emit(const char *const names[N]) {
+    for (unsigned int k = 0; k < N; k++) {
+      if (ns[k] != 0)
+        Profiler::get().counter(names[k],
+                                static_cast<double>(ns[k]));
+    }
+  }
+#else
+  void begin() {}
+  void end(unsigned int) {}
+  void emit(const char *const *) {}
+#endif
+};
+
+#define VP_CONCAT_IMPL(a, b) a##b
+#define VP_CONCAT(a, b) VP_CONCAT_IMPL(a, b)
+
+/**
+  Zones and counters only exist in builds defining
+  VIVAPHYSICS_PROFILE, otherwise the macros expand to
+  nothing and their arguments are never evaluated.
+ */
+#ifdef VIVAPHYSICS_PROFILE
+#define VP_PROFILE_ZONE(name)                              \
+  vivaphysics::ProfileZone VP_CONCAT(vp_zone_,             \
+                                     __LINE__)(name)
+#define VP_PROFILE_COUNTER(name, value)                    \
+  vivaphysics::Profiler::get().counter(                    \
+      name, static_cast<double>(value))
+#define VP_PROFILE_ENABLED 1
+#else
+#define VP_PROFILE_ZONE(name)                              \
+  do {                                                     \
+  } while (0)
+#define VP_PROFILE_COUNTER(name, value)                    \
+  do {                                                     \
+  } while (0)
+#define VP_PROFILE_ENABLED 0
+#endif
+};
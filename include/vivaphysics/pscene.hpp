@@ -0,0 +1,782 @@
+#pragma once
+// declarative scene description, text and binary forms
+#include <cstdint>
+#include <external.hpp>
+#include <iomanip>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/pimplicit.hpp>
+#include <vivaphysics/pstate.hpp>
+#include <vivaphysics/pworld.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief one force generator attached to one particle
+
+  Parameters follow the fields of
+  ParticleForceGeneratorWrapper: params holds k1 / spring
+  constant / max depth, k2 / rest length / volume, damping /
+  liquid height and liquid density, vec holds gravity or the
+  anchor. Springs and bungees refer to their other end by
+  particle index and act on both ends.
+ */
+struct ForceRecord {
+  std::uint32_t particle = 0;
+  std::uint32_t type = 0;
+  std::uint32_t other = 0;
+  real params[4] = {0, 0, 0, 0};
+  real vec[3] = {0, 0, 0};
+};
+
+/** a rod, cable or anchored constraint */
+struct LinkRecord {
+  std::uint32_t type = 0;
+  std::uint32_t a = 0;
+  /**second particle, unused by constraints*/
+  std::uint32_t b = 0;
+  real length = 0;
+  real restitution = 0;
+  real anchor[3] = {0, 0, 0};
+};
+
+/** ground plane over a range of particles */
+struct ColliderRecord {
+  std::uint32_t type = 0;
+  std::uint32_t first = 0;
+  std::uint32_t count = 0;
+};
+
+struct SceneHeader {
+  static constexpr std::uint32_t MAGIC = 0x4e435356; // VSCN
+  static constexpr std::uint32_t VERSION = 1;
+  /**bits of flags*/
+  static constexpr std::uint32_t IMPLICIT_SPRINGS = 1;
+
+  std::uint32_t magic = MAGIC;
+  std::uint32_t version = VERSION;
+  std::uint32_t real_size = sizeof(real);
+  std::uint32_t max_contacts = 0;
+  std::uint32_t iterations = 0;
+  std::uint32_t flags = 0;
+  std::uint64_t nb_particles = 0;
+  std::uint64_t nb_forces = 0;
+  std::uint64_t nb_links = 0;
+  std::uint64_t nb_colliders = 0;
+};
+
+/**
+  \brief everything needed to build a ParticleWorld
+
+  Scenes are plain arrays of records, so the binary form is
+  the arrays written back to back and loading it is a bulk
+  read followed by a parallel conversion.
+ */
+struct SceneDescription {
+  /**contact buffer size, 0 sizes it from the links and
+   * colliders*/
+  std::uint32_t max_contacts = 0;
+  /**resolver iterations, 0 uses two per contact*/
+  std::uint32_t iterations = 0;
+  /**integrate springs between particles with backward
+   * Euler, see ImplicitSpringNetwork*/
+  bool implicit_springs = false;
+
+  std::vector<ParticleRecord> particles;
+  std::vector<ForceRecord> forces;
+  std::vector<LinkRecord> links;
+  std::vector<ColliderRecord> colliders;
+
+  /**\name builder functions*/
+  /**@{*/
+  std::uint32_t
+  add_particle(const v3 &position, real mass,
+               real damping = 0.99f,
+               const v3 &velocity = v3(0),
+               const v3 &acceleration = v3(0)) {
+    Particle p;
+    p.set_position(position);
+    p.set_velocity(velocity);
+    p.set_acceleration(acceleration);
+    p.clear_accumulator();
+    p.set_mass(mass);
+    p.set_damping(damping);
+    particles.push_back(ParticleRecord(p));
+    return static_cast<std::uint32_t>(particles.size() - 1);
+  }
+  void add_force(std::uint32_t p,
+                 ParticleForceGeneratorType type,
+                 const v3 &vec, real k1 = 0, real k2 = 0,
+                 real k3 = 0, real density = 0,
+                 std::uint32_t other = 0) {
+    ForceRecord f;
+    f.particle = p;
+    f.type = static_cast<std::uint32_t>(type);
+    f.other = other;
+    f.params[0] = k1;
+    f.params[1] = k2;
+    f.params[2] = k3;
+    f.params[3] = density;
+    ParticleRecord::store(f.vec, vec);
+    forces.push_back(f);
+  }
+  void add_gravity(std::uint32_t p, const v3 &g) {
+    add_force(p, ParticleForceGeneratorType::GRAVITY, g);
+  }
+  void add_drag(std::uint32_t p, real k1, real k2) {
+    add_force(p, ParticleForceGeneratorType::DRAG, v3(0),
+              k1, k2);
+  }
+  void add_anchored_spring(std::uint32_t p,
+                           const v3 &anchor, real k,
+                           real rest) {
+    add_force(p,
+              ParticleForceGeneratorType::ANCHORED_SPRING,
+              anchor, k, rest);
+  }
+  void add_spring(std::uint32_t p, std::uint32_t other,
+                  real k, real rest) {
+    add_force(p, ParticleForceGeneratorType::SPRING, v3(0),
+              k, rest, 0, 0, other);
+  }
+  void add_buoyancy(std::uint32_t p, real max_depth,
+                    real volume, real liquid_height,
+                    real density = 1000.0f) {
+    add_force(p, ParticleForceGeneratorType::BUOYANCY,
+              v3(0), max_depth, volume, liquid_height,
+              density);
+  }
+  void add_link(ParticleContactGeneratorType type,
+                std::uint32_t a, std::uint32_t b,
+                real length, real restitution = 0,
+                const v3 &anchor = v3(0)) {
+    LinkRecord l;
+    l.type = static_cast<std::uint32_t>(type);
+    l.a = a;
+    l.b = b;
+    l.length = length;
+    l.restitution = restitution;
+    ParticleRecord::store(l.anchor, anchor);
+    links.push_back(l);
+  }
+  /**rod keeping the current distance of a and b*/
+  void add_rod(std::uint32_t a, std::uint32_t b) {
+    v3 d = ParticleRecord::load(particles[a].position) -
+           ParticleRecord::load(particles[b].position);
+    add_link(ParticleContactGeneratorType::ROD, a, b,
+             d.magnitude());
+  }
+  void add_ground(std::uint32_t first,
+                  std::uint32_t count) {
+    ColliderRecord c;
+    c.type = static_cast<std::uint32_t>(
+        ParticleContactGeneratorType::GROUND);
+    c.first = first;
+    c.count = count;
+    colliders.push_back(c);
+  }
+  void add_ground() {
+    add_ground(
+        0, static_cast<std::uint32_t>(particles.size()));
+  }
+  /**@}*/
+
+  /**throws if a record refers to a missing particle*/
+  void validate() const {
+    auto n = particles.size();
+    for (auto &f : forces) {
+      COMP_CHECK_MSG(f.particle < n, f.particle, n,
+                     "force refers to a missing particle");
+      COMP_CHECK_MSG(f.other < n, f.other, n,
+                     "spring refers to a missing particle");
+      COMP_CHECK_MSG(f.type < NB_FORCE_GENERATOR_TYPES,
+                     f.type, NB_FORCE_GENERATOR_TYPES,
+                     "unknown force type");
+    }
+    for (auto &l : links) {
+      COMP_CHECK_MSG(l.a < n && l.b < n, l.a, l.b,
+                     "link refers to a missing particle");
+      auto ground = static_cast<std::uint32_t>(
+          ParticleContactGeneratorType::GROUND);
+      COMP_CHECK_MSG(l.type < ground, l.type, ground,
+                     "unknown link type");
+    }
+    for (auto &c : colliders) {
+      COMP_CHECK_MSG(c.first + std::uint64_t(c.count) <= n,
+                     c.first, c.count,
+                     "collider range out of bounds");
+    }
+  }
+
+  std::uint32_t default_max_contacts() const {
+    std::uint64_t n = links.size();
+    for (auto &c : colliders)
+      n += c.count;
+    return static_cast<std::uint32_t>(
+        std::max<std::uint64_t>(n, 1));
+  }
+};
+
+/**springs and bungees between two particles*/
+inline bool is_pair_spring(const ForceRecord &f) {
+  auto type =
+      static_cast<ParticleForceGeneratorType>(f.type);
+  return type == ParticleForceGeneratorType::SPRING ||
+         type == ParticleForceGeneratorType::BUNGEE;
+}
+
+/**
+  wrapper of a force acting on one particle. Pair springs
+  are built by build_world, see is_pair_spring
+ */
+inline ParticleForceGeneratorWrapper
+make_force_wrapper(const ForceRecord &f) {
+  auto type =
+      static_cast<ParticleForceGeneratorType>(f.type);
+  v3 vec = ParticleRecord::load(f.vec);
+  switch (type) {
+  case ParticleForceGeneratorType::GRAVITY:
+    return ParticleForceGeneratorWrapper(
+        ParticleGravity(vec));
+  case ParticleForceGeneratorType::DRAG:
+    return ParticleForceGeneratorWrapper(
+        ParticleDrag(f.params[0], f.params[1]));
+  case ParticleForceGeneratorType::ANCHORED_SPRING:
+    return ParticleForceGeneratorWrapper(
+        ParticleAnchoredSpring(vec, f.params[0],
+                               f.params[1]));
+  case ParticleForceGeneratorType::ANCHORED_BUNGEE:
+    return ParticleForceGeneratorWrapper(
+        ParticleAnchoredBungee(vec, f.params[0],
+                               f.params[1]));
+  case ParticleForceGeneratorType::FAKE_SPRING:
+    return ParticleForceGeneratorWrapper(
+        ParticleFakeSpring(vec, f.params[0], f.params[2]));
+  case ParticleForceGeneratorType::SPRING:
+  case ParticleForceGeneratorType::BUNGEE:
+    break;
+  case ParticleForceGeneratorType::BUOYANCY:
+    return ParticleForceGeneratorWrapper(ParticleBuoyancy(
+        f.params[0], f.params[1], f.params[2],
+        f.params[3]));
+  }
+  return ParticleForceGeneratorWrapper();
+}
+
+inline ParticleContactWrapper
+make_link_wrapper(const LinkRecord &l,
+                  const Particles &particles) {
+  ParticleContactWrapper w;
+  w.type =
+      static_cast<ParticleContactGeneratorType>(l.type);
+  w.length_max_length = l.length;
+  w.restitution = l.restitution;
+  w.anchor = ParticleRecord::load(l.anchor);
+  switch (w.type) {
+  case ParticleContactGeneratorType::CABLE:
+  case ParticleContactGeneratorType::ROD:
+    w.contact_ps = ContactParticles(
+        Particles{particles[l.a], particles[l.b]}, true);
+    break;
+  default:
+    w.contact_ps =
+        ContactParticles(Particles{particles[l.a]});
+    break;
+  }
+  return w;
+}
+
+/**
+  \brief build the world described by the scene
+
+  Particles live in one block allocated up front and are
+  filled in parallel; the shared pointers handed to the
+  world alias that block instead of allocating one particle
+  at a time. The world must be empty.
+ */
+inline void build_world(const SceneDescription &scene,
+                        ParticleWorld &world,
+                        ThreadPool *pool = nullptr) {
+  scene.validate();
+  D_CHECK_MSG(world.particles.empty(),
+              "scene must be built into an empty world");
+  auto n =
+      static_cast<unsigned int>(scene.particles.size());
+  std::shared_ptr<Particle> block(
+      new Particle[std::max(n, 1u)],
+      std::default_delete<Particle[]>());
+  Particle *base = block.get();
+  parallel_for(pool, n,
+               [&](unsigned int begin, unsigned int end,
+                   unsigned int) {
+                 for (unsigned int i = begin; i < end; i++)
+                   scene.particles[i].apply(base[i]);
+               });
+  world.particles.resize(n);
+  for (unsigned int i = 0; i < n; i++)
+    world.particles[i] =
+        std::shared_ptr<Particle>(block, base + i);
+  world.sync_particle_handles();
+
+  // force generators
+  auto nb_forces =
+      static_cast<unsigned int>(scene.forces.size());
+  std::vector<ParticleForceGeneratorWrapper> wrappers(
+      nb_forces);
+  parallel_for(pool, nb_forces,
+               [&](unsigned int begin, unsigned int end,
+                   unsigned int) {
+                 for (unsigned int i = begin; i < end; i++)
+                   wrappers[i] =
+                       make_force_wrapper(scene.forces[i]);
+               });
+  world.registry.reserve(nb_forces);
+  for (unsigned int i = 0; i < nb_forces; i++) {
+    if (is_pair_spring(scene.forces[i]))
+      continue;
+    world.registry.add(
+        world.particles[scene.forces[i].particle],
+        wrappers[i]);
+  }
+
+  // a ParticleSpring holds a copy of its other end, so
+  // pair springs go to one network that reads both ends
+  // every step
+  std::shared_ptr<ImplicitSpringNetwork> net;
+  std::vector<unsigned int> bodies;
+  auto body = [&](std::uint32_t i) {
+    if (bodies[i] == ImplicitSpringNetwork::ANCHOR)
+      bodies[i] = net->add_body(world.particles[i]);
+    return bodies[i];
+  };
+  for (auto &f : scene.forces) {
+    if (!is_pair_spring(f))
+      continue;
+    if (!net) {
+      net = std::make_shared<ImplicitSpringNetwork>();
+      net->implicit = scene.implicit_springs;
+      bodies.assign(n, ImplicitSpringNetwork::ANCHOR);
+    }
+    auto a = body(f.particle), b = body(f.other);
+    if (f.type == static_cast<std::uint32_t>(
+                      ParticleForceGeneratorType::SPRING))
+      net->add_spring(a, b, f.params[0], f.params[1]);
+    else
+      net->add_bungee(a, b, f.params[0], f.params[1]);
+  }
+  if (net)
+    world.registry.add_spring_network(net);
+
+  // links then colliders, in that order
+  auto &gens = world.contact_generators;
+  auto nb_links =
+      static_cast<unsigned int>(scene.links.size());
+  auto offset = static_cast<unsigned int>(gens.size());
+  gens.resize(offset + nb_links +
+              static_cast<unsigned int>(
+                  scene.colliders.size()));
+  parallel_for(pool, nb_links,
+               [&](unsigned int begin, unsigned int end,
+                   unsigned int) {
+                 for (unsigned int i = begin; i < end; i++)
+                   gens.contact_data[offset + i] =
+                       make_link_wrapper(scene.links[i],
+                                         world.particles);
+               });
+  for (std::size_t i = 0; i < scene.colliders.size(); i++) {
+    auto &c = scene.colliders[i];
+    auto first = world.particles.begin() + c.first;
+    Particles ps(first, first + c.count);
+    gens.contact_data[offset + nb_links + i] =
+        ParticleContactWrapper(GroundContacts(ps));
+  }
+
+  auto max_contacts = scene.max_contacts;
+  if (max_contacts == 0)
+    max_contacts = scene.default_max_contacts();
+  world.set_max_contacts(max_contacts);
+  world.compute_iterations = scene.iterations == 0;
+  world.resolver.set_iterations(scene.iterations);
+}
+
+/**\name binary form*/
+/**@{*/
+template <class T>
+void write_records(std::ostream &out,
+                   const std::vector<T> &records) {
+  out.write(reinterpret_cast<const char *>(records.data()),
+            records.size() * sizeof(T));
+}
+
+inline void
+write_scene_binary(const SceneDescription &scene,
+                   std::ostream &out) {
+  SceneHeader h;
+  h.max_contacts = scene.max_contacts;
+  h.iterations = scene.iterations;
+  if (scene.implicit_springs)
+    h.flags |= SceneHeader::IMPLICIT_SPRINGS;
+  h.nb_particles = scene.particles.size();
+  h.nb_forces = scene.forces.size();
+  h.nb_links = scene.links.size();
+  h.nb_colliders = scene.colliders.size();
+  out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  write_records(out, scene.particles);
+  write_records(out, scene.forces);
+  write_records(out, scene.links);
+  write_records(out, scene.colliders);
+  D_CHECK_MSG(out.good(), "failed to write scene");
+}
+
+/**
+  \brief read a binary scene with one bulk read per array
+
+  The counts of the header are checked against the bytes
+  left before anything is allocated. Streams that can not
+  tell their size are read in slices.
+ */
+inline SceneDescription
+read_scene_binary(std::istream &in) {
+  SceneHeader h;
+  in.read(reinterpret_cast<char *>(&h), sizeof(h));
+  D_CHECK_MSG(!in.fail() && in.gcount() == sizeof(h),
+              "truncated scene header");
+  D_CHECK_MSG(h.magic == SceneHeader::MAGIC,
+              "not a binary scene file");
+  D_CHECK_MSG(h.version == SceneHeader::VERSION,
+              "unsupported scene version " << h.version);
+  D_CHECK_MSG(h.real_size == sizeof(real),
+              "scene was written with a different real");
+  SceneDescription scene;
+  scene.max_contacts = h.max_contacts;
+  scene.iterations = h.iterations;
+  scene.implicit_springs =
+      (h.flags & SceneHeader::IMPLICIT_SPRINGS) != 0;
+
+  // corrupt counts must not size the allocations
+  auto left = remaining_bytes(in);
+  if (left >= 0) {
+    auto budget = static_cast<std::uint64_t>(left);
+    auto fits = [&budget](std::uint64_t n,
+                          std::uint64_t size) {
+      if (n > budget / size)
+        return false;
+      budget -= n * size;
+      return true;
+    };
+    bool fit =
+        fits(h.nb_particles, sizeof(ParticleRecord)) &&
+        fits(h.nb_forces, sizeof(ForceRecord)) &&
+        fits(h.nb_links, sizeof(LinkRecord)) &&
+        fits(h.nb_colliders, sizeof(ColliderRecord));
+    D_CHECK_MSG(fit,
+                "truncated scene, " << left
+                                    << " bytes of records");
+  }
+  read_record_slices(in, scene.particles, h.nb_particles,
+                     left, "scene");
+  read_record_slices(in, scene.forces, h.nb_forces, left,
+                     "scene");
+  read_record_slices(in, scene.links, h.nb_links, left,
+                     "scene");
+  read_record_slices(in, scene.colliders, h.nb_colliders,
+                     left, "scene");
+  return scene;
+}
+/**@}*/
+
+/**\name text form
+
+  One record per line, # starts a comment:
+
+      contacts n
+      iterations n
+      implicit_springs
+      particle px py pz mass damping [vx vy vz [ax ay az]]
+      gravity p gx gy gz
+      drag p k1 k2
+      anchored_spring p ax ay az k rest
+      anchored_bungee p ax ay az k rest
+      fake_spring p ax ay az k damping
+      spring a b k rest
+      bungee a b k rest
+      buoyancy p max_depth volume liquid_height density
+      rod a b length
+      cable a b max_length restitution
+      rod_constraint a ax ay az length
+      cable_constraint a ax ay az max_length restitution
+      ground [first count]
+
+  Particles are numbered from 0 in order of appearance,
+  a mass of inf makes an immovable particle. A spring or
+  bungee between a and b pulls both, bungees only when
+  longer than their rest length.
+ */
+/**@{*/
+inline const char *force_keyword(std::uint32_t type) {
+  static const char
+      *const names[NB_FORCE_GENERATOR_TYPES] = {
+      "gravity",     "drag",   "anchored_spring",
+      "anchored_bungee", "fake_spring", "spring",
+      "bungee",      "buoyancy"};
+  return names[type];
+}
+inline const char *link_keyword(std::uint32_t type) {
+  static const char *const names[4] = {
+      "cable", "rod", "cable_constraint", "rod_constraint"};
+  return names[type];
+}
+
+inline SceneDescription read_scene_text(std::istream &in) {
+  SceneDescription scene;
+  std::string line;
+  unsigned int line_nb = 0;
+  bool ground_all = false;
+  while (std::getline(in, line)) {
+    line_nb++;
+    auto hash = line.find('#');
+    if (hash != std::string::npos)
+      line.erase(hash);
+    std::istringstream ls(line);
+    std::string key;
+    if (!(ls >> key))
+      continue;
+    auto fail = [&]() {
+      D_CHECK_MSG(false, "scene line " << line_nb << ": "
+                                       << line);
+    };
+    auto read_v3 = [&](v3 &v) {
+      if (!(ls >> v.x >> v.y >> v.z))
+        fail();
+    };
+    if (key == "contacts") {
+      ls >> scene.max_contacts;
+    } else if (key == "iterations") {
+      ls >> scene.iterations;
+    } else if (key == "implicit_springs") {
+      scene.implicit_springs = true;
+    } else if (key == "particle") {
+      v3 pos, vel(0), acc(0);
+      std::string mass_word;
+      real mass, damping;
+      read_v3(pos);
+      if (!(ls >> mass_word >> damping))
+        fail();
+      std::istringstream ms(mass_word);
+      if (mass_word == "inf")
+        mass = std::numeric_limits<real>::infinity();
+      else if (!(ms >> mass))
+        fail();
+      ls >> vel.x >> vel.y >> vel.z;
+      ls >> acc.x >> acc.y >> acc.z;
+      scene.add_particle(pos, mass, damping, vel, acc);
+    } else if (key == "ground") {
+      std::uint32_t first, count;
+      if (ls >> first >> count)
+        scene.add_ground(first, count);
+      else
+        ground_all = true;
+    } else {
+      bool found = false;
+      for (std::uint32_t t = 0;
+           t < NB_FORCE_GENERATOR_TYPES; t++) {
+        if (key != force_keyword(t))
+          continue;
+        found = true;
+        ForceRecord f;
+        f.type = t;
+        if (!(ls >> f.particle))
+          fail();
+        auto type =
+            static_cast<ParticleForceGeneratorType>(t);
+        v3 vec(0);
+        switch (type) {
+        case ParticleForceGeneratorType::GRAVITY:
+          read_v3(vec);
+          break;
+        case ParticleForceGeneratorType::DRAG:
+          ls >> f.params[0] >> f.params[1];
+          break;
+        case ParticleForceGeneratorType::ANCHORED_SPRING:
+        case ParticleForceGeneratorType::ANCHORED_BUNGEE:
+          read_v3(vec);
+          ls >> f.params[0] >> f.params[1];
+          break;
+        case ParticleForceGeneratorType::FAKE_SPRING:
+          read_v3(vec);
+          ls >> f.params[0] >> f.params[2];
+          break;
+        case ParticleForceGeneratorType::SPRING:
+        case ParticleForceGeneratorType::BUNGEE:
+          ls >> f.other >> f.params[0] >> f.params[1];
+          break;
+        case ParticleForceGeneratorType::BUOYANCY:
+          ls >> f.params[0] >> f.params[1] >> f.params[2] >>
+              f.params[3];
+          break;
+        }
+        if (ls.fail())
+          fail();
+        ParticleRecord::store(f.vec, vec);
+        scene.forces.push_back(f);
+      }
+      for (std::uint32_t t = 0; t < 4 && !found; t++) {
+        if (key != link_keyword(t))
+          continue;
+        found = true;
+        LinkRecord l;
+        l.type = t;
+        auto type =
+            static_cast<ParticleContactGeneratorType>(t);
+        v3 anchor(0);
+        switch (type) {
+        case ParticleContactGeneratorType::CABLE:
+          ls >> l.a >> l.b >> l.length >> l.restitution;
+          break;
+        case ParticleContactGeneratorType::ROD:
+          ls >> l.a >> l.b >> l.length;
+          break;
+        case ParticleContactGeneratorType::CABLE_CONSTRAINT:
+          ls >> l.a;
+          read_v3(anchor);
+          ls >> l.length >> l.restitution;
+          break;
+        default:
+          ls >> l.a;
+          read_v3(anchor);
+          ls >> l.length;
+          break;
+        }
+        if (ls.fail())
+          fail();
+        ParticleRecord::store(l.anchor, anchor);
+        scene.links.push_back(l);
+      }
+      if (!found)
+        fail();
+    }
+  }
+  if (ground_all)
+    scene.add_ground();
+  return scene;
+}
+
+inline void write_scene_text(const SceneDescription &scene,
+                             std::ostream &out) {
+  out << std::setprecision(
+      std::numeric_limits<real>::max_digits10);
+  if (scene.max_contacts != 0)
+    out << "contacts " << scene.max_contacts << "\n";
+  if (scene.iterations != 0)
+    out << "iterations " << scene.iterations << "\n";
+  if (scene.implicit_springs)
+    out << "implicit_springs\n";
+  auto v = [&out](const real r[3]) {
+    out << " " << r[0] << " " << r[1] << " " << r[2];
+  };
+  for (auto &p : scene.particles) {
+    out << "particle";
+    v(p.position);
+    // streams write an infinite mass they can not read
+    if (p.inverse_mass == 0)
+      out << " inf";
+    else
+      out << " " << real(1.0 / p.inverse_mass);
+    out << " " << p.damping;
+    v(p.velocity);
+    v(p.acceleration);
+    out << "\n";
+  }
+  for (auto &f : scene.forces) {
+    out << force_keyword(f.type) << " " << f.particle;
+    auto type =
+        static_cast<ParticleForceGeneratorType>(f.type);
+    switch (type) {
+    case ParticleForceGeneratorType::GRAVITY:
+      v(f.vec);
+      break;
+    case ParticleForceGeneratorType::DRAG:
+      out << " " << f.params[0] << " " << f.params[1];
+      break;
+    case ParticleForceGeneratorType::ANCHORED_SPRING:
+    case ParticleForceGeneratorType::ANCHORED_BUNGEE:
+      v(f.vec);
+      out << " " << f.params[0] << " " << f.params[1];
+      break;
+    case ParticleForceGeneratorType::FAKE_SPRING:
+      v(f.vec);
+      out << " " << f.params[0] << " " << f.params[2];
+      break;
+    case ParticleForceGeneratorType::SPRING:
+    case ParticleForceGeneratorType::BUNGEE:
+      out << " " << f.other << " " << f.params[0] << " "
+          << f.params[1];
+      break;
+    case ParticleForceGeneratorType::BUOYANCY:
+      out << " " << f.params[0] << " " << f.params[1] << " "
+          << f.params[2] << " " << f.params[3];
+      break;
+    }
+    out << "\n";
+  }
+  for (auto &l : scene.links) {
+    out << link_keyword(l.type) << " " << l.a;
+    auto type =
+        static_cast<ParticleContactGeneratorType>(l.type);
+    switch (type) {
+    case ParticleContactGeneratorType::CABLE:
+      out << " " << l.b << " " << l.length << " "
+          << l.restitution;
+      break;
+    case ParticleContactGeneratorType::ROD:
+      out << " " << l.b << " " << l.length;
+      break;
+    case ParticleContactGeneratorType::CABLE_CONSTRAINT:
+      v(l.anchor);
+      out << " " << l.length << " " << l.restitution;
+      break;
+    default:
+      v(l.anchor);
+      out << " " << l.length;
+      break;
+    }
+    out << "\n";
+  }
+  for (auto &c : scene.colliders)
+    out << "ground " << c.first << " " << c.count << "\n";
+}
+/**@}*/
+
+/**read a scene file, binary or text is told by the first
+ * bytes*/
+inline SceneDescription
+load_scene(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  D_CHECK_MSG(in.is_open(), "can not open scene " << path);
+  std::uint32_t magic = 0;
+  in.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  in.clear();
+  in.seekg(0);
+  if (magic == SceneHeader::MAGIC)
+    return read_scene_binary(in);
+  return read_scene_text(in);
+}
+
+/**.scene files are written as text, anything else binary*/
+inline void save_scene(const SceneDescription &scene,
+                       const std::string &path) {
+  const std::string ext = ".scene";
+  bool text = path.size() >= ext.size() &&
+              path.compare(path.size() - ext.size(),
+                           ext.size(), ext) == 0;
+  auto mode = text ? std::ios::out
+                   : std::ios::out | std::ios::binary;
+  std::ofstream out(path, mode);
+  D_CHECK_MSG(out.is_open(), "can not open scene " << path);
+  if (text)
+    write_scene_text(scene, out);
+  else
+    write_scene_binary(scene, out);
+}
+};
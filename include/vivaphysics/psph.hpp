@@ -0,0 +1,382 @@
+#pragma once
+// smoothed particle hydrodynamics
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/particle.hpp>
+#include <vivaphysics/profiler.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief pressure and viscosity forces of a liquid made of
+  the given particles
+
+  Uses the kernels of Muller et al. 2003: poly6 for the
+  density, the spiky gradient for the pressure and the
+  viscosity laplacian, all with support radius h. Each
+  update sorts the bodies into a hashed grid of cells of
+  width h, copies them in cell order and runs a density
+  pass and a force pass over the 27 surrounding cells, read
+  as nine contiguous ranges.
+  The passes split the bodies over the pool threads and
+  each sum runs over fixed lanes in a fixed order, so the
+  forces do not depend on the thread count.
+
+  The forces go to the particle accumulators, the world
+  integrates them as any other force. Bodies of infinite
+  mass are ignored.
+ */
+class ParticleSPHFluid {
+public:
+  /**sums are split over this many independent lanes*/
+  static constexpr unsigned int LANES = 8;
+
+  Particles bodies;
+  /**support radius of the kernels*/
+  real h;
+  real rest_density;
+  /**pressure per unit of density above rest*/
+  real stiffness;
+  real viscosity;
+
+protected:
+  /**body index of each active body, in cell order*/
+  std::vector<unsigned int> order;
+  /**
+    cells are grouped in rows along x, hashed into buckets;
+    bodies of bucket b are [row_start[b], row_start[b + 1])
+    sorted by cell x, so the three cells around a body on
+    one row form a single range
+   */
+  std::vector<unsigned int> row_start;
+  std::vector<std::uint32_t> row_of;
+  std::vector<unsigned int> cursor;
+  std::vector<std::pair<std::int32_t, unsigned int>>
+      entries;
+  std::vector<std::int32_t> cell_x;
+  std::uint32_t row_mask = 0;
+
+  /**active bodies in cell order*/
+  std::vector<real> xs, ys, zs, vxs, vys, vzs, ms;
+  std::vector<real> density, pressure;
+  /**mass over density, the volume of each body*/
+  std::vector<real> volume;
+
+  static std::int32_t cell(real v, real inv_h) {
+    return static_cast<std::int32_t>(std::floor(v * inv_h));
+  }
+  std::uint32_t row(std::int32_t cy,
+                    std::int32_t cz) const {
+    auto y = static_cast<std::uint32_t>(cy) * 73856093u;
+    auto z = static_cast<std::uint32_t>(cz) * 19349663u;
+    return (y ^ z) & row_mask;
+  }
+
+  /**
+    \brief ranges of the bodies in the 27 cells around a
+    position, returns how many
+
+    Rows sharing a bucket are visited once, bodies of other
+    rows in the range are rejected by the distance test.
+   */
+  unsigned int
+  neighbor_ranges(real x, real y, real z,
+                  unsigned int (&lo)[9],
+                  unsigned int (&hi)[9]) const {
+    const real inv_h = 1 / h;
+    auto cx = cell(x, inv_h), cy = cell(y, inv_h),
+         cz = cell(z, inv_h);
+    std::uint32_t rows[9];
+    unsigned int nb = 0;
+    for (int dy = -1; dy <= 1; dy++)
+      for (int dz = -1; dz <= 1; dz++)
+        rows[nb++] = row(cy + dy, cz + dz);
+    std::sort(rows, rows + nb);
+    nb = static_cast<unsigned int>(
+        std::unique(rows, rows + nb) - rows);
+    auto first = cell_x.begin();
+    for (unsigned int r = 0; r < nb; r++) {
+      auto begin = first + row_start[rows[r]];
+      auto end = first + row_start[rows[r] + 1];
+      lo[r] = static_cast<unsigned int>(
+          std::lower_bound(begin, end, cx - 1) - first);
+      hi[r] = static_cast<unsigned int>(
+          std::upper_bound(begin, end, cx + 1) - first);
+    }
+    return nb;
+  }
+
+  /**
+    \brief density at (px, py, pz) from bodies
+    [begin, end), over LANES partial sums
+
+    The lanes are summed in a fixed order so the result
+    does not depend on how the compiler vectorizes.
+   */
+  static void density_rows(std::size_t begin,
+                           std::size_t end, real px,
+                           real py, real pz, real h2,
+                           const real *__restrict x,
+                           const real *__restrict y,
+                           const real *__restrict z,
+                           const real *__restrict m,
+                           real *__restrict lanes) {
+    std::size_t j = begin;
+    for (; j + LANES <= end; j += LANES) {
+      for (unsigned int l = 0; l < LANES; l++) {
+        real dx = x[j + l] - px, dy = y[j + l] - py,
+             dz = z[j + l] - pz;
+        real q = h2 - (dx * dx + dy * dy + dz * dz);
+        q = q > 0 ? q : 0;
+        lanes[l] += m[j + l] * q * q * q;
+      }
+    }
+    for (unsigned int l = 0; j < end; j++, l++) {
+      real dx = x[j] - px, dy = y[j] - py, dz = z[j] - pz;
+      real q = h2 - (dx * dx + dy * dy + dz * dz);
+      q = q > 0 ? q : 0;
+      lanes[l] += m[j] * q * q * q;
+    }
+  }
+
+  /**
+    \brief pressure and viscosity force density on body k
+    from bodies [begin, end), over LANES partial sums
+
+    lanes holds three rows of LANES sums, one per axis.
+   */
+  static void
+  force_rows(std::size_t begin, std::size_t end,
+             std::size_t k, real h, real k_pressure,
+             real k_viscosity, const real *__restrict x,
+             const real *__restrict y,
+             const real *__restrict z,
+             const real *__restrict vx,
+             const real *__restrict vy,
+             const real *__restrict vz,
+             const real *__restrict vol,
+             const real *__restrict p,
+             real *__restrict lanes) {
+    const real px = x[k], py = y[k], pz = z[k];
+    const real ux = vx[k], uy = vy[k], uz = vz[k];
+    const real pk = p[k];
+    const real h2 = h * h;
+    // the tail runs as one more block of inactive lanes
+    for (std::size_t j = begin; j < end; j += LANES) {
+      auto width = std::min<std::size_t>(LANES, end - j);
+      if (width == LANES) {
+        for (unsigned int l = 0; l < LANES; l++) {
+          std::size_t i = j + l;
+          real dx = px - x[i], dy = py - y[i],
+               dz = pz - z[i];
+          real r2 = dx * dx + dy * dy + dz * dz;
+          bool in = (r2 < h2) & (r2 > 1e-12f);
+          real r = std::sqrt(r2);
+          real inv_r = in ? 1 / r : 0;
+          real w = in ? h - r : 0;
+          real mi = vol[i];
+          real fp =
+              k_pressure * mi * (pk + p[i]) * w * w * inv_r;
+          real fv = k_viscosity * mi * w;
+          lanes[l] += fp * dx + fv * (vx[i] - ux);
+          lanes[LANES + l] += fp * dy + fv * (vy[i] - uy);
+          lanes[2 * LANES + l] +=
+              fp * dz + fv * (vz[i] - uz);
+        }
+        continue;
+      }
+      for (unsigned int l = 0; l < width; l++) {
+        std::size_t i = j + l;
+        real dx = px - x[i], dy = py - y[i], dz = pz - z[i];
+        real r2 = dx * dx + dy * dy + dz * dz;
+        if (r2 >= h2 || r2 <= 1e-12f)
+          continue;
+        real r = std::sqrt(r2);
+        real inv_r = 1 / r;
+        real w = h - r;
+        real mi = vol[i];
+        real fp =
+            k_pressure * mi * (pk + p[i]) * w * w * inv_r;
+        real fv = k_viscosity * mi * w;
+        lanes[l] += fp * dx + fv * (vx[i] - ux);
+        lanes[LANES + l] += fp * dy + fv * (vy[i] - uy);
+        lanes[2 * LANES + l] += fp * dz + fv * (vz[i] - uz);
+      }
+    }
+  }
+
+  static real sum_lanes(const real *lanes) {
+    real s = 0;
+    for (unsigned int l = 0; l < LANES; l++)
+      s += lanes[l];
+    return s;
+  }
+
+  /**counting sort of the bodies by row bucket, then by
+   * cell x and body index within each bucket*/
+  void sort_bodies(ThreadPool *pool) {
+    order.clear();
+    for (unsigned int i = 0; i < bodies.size(); i++)
+      if (bodies[i]->get_inverse_mass() > 0)
+        order.push_back(i);
+    auto n = static_cast<unsigned int>(order.size());
+    std::uint32_t nb_rows = 1;
+    while (nb_rows < n / 2)
+      nb_rows *= 2;
+    row_mask = nb_rows - 1;
+    row_start.assign(nb_rows + 1, 0);
+    row_of.resize(n);
+    cell_x.resize(n);
+    const real inv_h = 1 / h;
+    for (unsigned int k = 0; k < n; k++) {
+      v3 pos = bodies[order[k]]->get_position();
+      row_of[k] =
+          row(cell(pos.y, inv_h), cell(pos.z, inv_h));
+      cell_x[k] = cell(pos.x, inv_h);
+      row_start[row_of[k] + 1]++;
+    }
+    for (std::uint32_t b = 0; b < nb_rows; b++)
+      row_start[b + 1] += row_start[b];
+    cursor.assign(row_start.begin(), row_start.end() - 1);
+    entries.resize(n);
+    for (unsigned int k = 0; k < n; k++)
+      entries[cursor[row_of[k]]++] =
+          std::make_pair(cell_x[k], order[k]);
+    parallel_for(pool, nb_rows,
+                 [this](unsigned int begin,
+                        unsigned int end, unsigned int) {
+                   auto first = entries.begin();
+                   for (auto b = begin; b < end; b++)
+                     std::sort(first + row_start[b],
+                               first + row_start[b + 1]);
+                 });
+    for (unsigned int k = 0; k < n; k++) {
+      cell_x[k] = entries[k].first;
+      order[k] = entries[k].second;
+    }
+  }
+
+  void gather(ThreadPool *pool) {
+    auto n = static_cast<unsigned int>(order.size());
+    for (auto *v : {&xs, &ys, &zs, &vxs, &vys, &vzs, &ms,
+                    &density, &pressure, &volume})
+      v->resize(n);
+    parallel_for(pool, n,
+                 [this](unsigned int begin,
+                        unsigned int end, unsigned int) {
+                   for (unsigned int k = begin; k < end;
+                        k++) {
+                     const auto &b = bodies[order[k]];
+                     v3 pos = b->get_position();
+                     v3 vel = b->get_velocity();
+                     xs[k] = pos.x;
+                     ys[k] = pos.y;
+                     zs[k] = pos.z;
+                     vxs[k] = vel.x;
+                     vys[k] = vel.y;
+                     vzs[k] = vel.z;
+                     ms[k] = b->get_mass();
+                   }
+                 });
+  }
+
+  void density_pass(ThreadPool *pool) {
+    const real pi = static_cast<real>(3.14159265358979);
+    const real h2 = h * h;
+    const real poly6 =
+        315 / (64 * pi * std::pow(h, static_cast<real>(9)));
+    auto n = static_cast<unsigned int>(order.size());
+    parallel_for(
+        pool, n,
+        [this, h2, poly6](unsigned int begin,
+                          unsigned int end, unsigned int) {
+          unsigned int lo[9], hi[9];
+          for (unsigned int k = begin; k < end; k++) {
+            real lanes[LANES] = {0};
+            auto nb = neighbor_ranges(xs[k], ys[k],
+                                      zs[k], lo, hi);
+            for (unsigned int c = 0; c < nb; c++)
+              density_rows(lo[c], hi[c],
+                           xs[k], ys[k], zs[k], h2,
+                           xs.data(), ys.data(), zs.data(),
+                           ms.data(), lanes);
+            density[k] = poly6 * sum_lanes(lanes);
+            volume[k] = ms[k] / density[k];
+            real p =
+                stiffness * (density[k] - rest_density);
+            pressure[k] = p > 0 ? p : 0;
+          }
+        });
+  }
+
+  void force_pass(ThreadPool *pool) {
+    const real pi = static_cast<real>(3.14159265358979);
+    const real grad =
+        45 / (pi * std::pow(h, static_cast<real>(6)));
+    const real k_pressure = grad / 2;
+    const real k_viscosity = viscosity * grad;
+    auto n = static_cast<unsigned int>(order.size());
+    parallel_for(
+        pool, n,
+        [this, k_pressure, k_viscosity](unsigned int begin,
+                                        unsigned int end,
+                                        unsigned int) {
+          unsigned int lo[9], hi[9];
+          for (unsigned int k = begin; k < end; k++) {
+            real lanes[3 * LANES] = {0};
+            auto nb = neighbor_ranges(xs[k], ys[k],
+                                      zs[k], lo, hi);
+            for (unsigned int c = 0; c < nb; c++)
+              force_rows(lo[c], hi[c], k, h,
+                         k_pressure, k_viscosity, xs.data(),
+                         ys.data(), zs.data(), vxs.data(),
+                         vys.data(), vzs.data(),
+                         volume.data(), pressure.data(),
+                         lanes);
+            // force density to force
+            real scale = volume[k];
+            v3 f(sum_lanes(lanes), sum_lanes(lanes + LANES),
+                 sum_lanes(lanes + 2 * LANES));
+            bodies[order[k]]->add_force(f * scale);
+          }
+        });
+  }
+
+public:
+  ParticleSPHFluid(real radius = 0.1f,
+                   real rest = 1000.0f, real k = 20.0f,
+                   real mu = 1.0f)
+      : h(radius), rest_density(rest), stiffness(k),
+        viscosity(mu) {}
+  ParticleSPHFluid(const Particles &ps, real radius = 0.1f,
+                   real rest = 1000.0f, real k = 20.0f,
+                   real mu = 1.0f)
+      : bodies(ps), h(radius), rest_density(rest),
+        stiffness(k), viscosity(mu) {}
+
+  /**densities of the last update, in cell order*/
+  const std::vector<real> &get_densities() const {
+    return density;
+  }
+
+  /**sort, then add pressure and viscosity forces, the
+   * duration is not used*/
+  void update_forces(real, ThreadPool *pool = nullptr) {
+    VP_PROFILE_ZONE("force/sph");
+    {
+      VP_PROFILE_ZONE("sph/sort");
+      sort_bodies(pool);
+      gather(pool);
+    }
+    {
+      VP_PROFILE_ZONE("sph/density");
+      density_pass(pool);
+    }
+    VP_PROFILE_ZONE("sph/forces");
+    force_pass(pool);
+  }
+};
+};
@@ -0,0 +1,244 @@
+#pragma once
+// binary snapshots of the particle world
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/pworld.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief flat copy of the state of one particle
+
+  Snapshots store these records back to back in native
+  byte order, so a snapshot is read with a single bulk read.
+ */
+struct ParticleRecord {
+  real position[3] = {};
+  real velocity[3] = {};
+  real acceleration[3] = {};
+  real accumulated_force[3] = {};
+  real inverse_mass = 0;
+  real damping = 0;
+
+  ParticleRecord() {}
+  ParticleRecord(const Particle &p) {
+    store(position, p.get_position());
+    store(velocity, p.get_velocity());
+    store(acceleration, p.get_acceleration());
+    store(accumulated_force, p.get_accumulated_force());
+    inverse_mass = p.get_inverse_mass();
+    damping = p.get_damping();
+  }
+  void apply(Particle &p) const {
+    p.set_position(load(position));
+    p.set_velocity(load(velocity));
+    p.set_acceleration(load(acceleration));
+    p.set_accumulated_force(load(accumulated_force));
+    p.set_inverse_mass(inverse_mass);
+    p.set_damping(damping);
+  }
+  static void store(real out[3], const v3 &v) {
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+  }
+  static v3 load(const real in[3]) {
+    return v3(in[0], in[1], in[2]);
+  }
+};
+
+/** header of a snapshot file */
+struct SnapshotHeader {
+  static constexpr std::uint32_t MAGIC = 0x50535056; // VPSP
+  static constexpr std::uint32_t VERSION = 1;
+  /**world has a ground contact generator over all its
+   * particles*/
+  static constexpr std::uint32_t HAS_GROUND = 1;
+
+  std::uint32_t magic = MAGIC;
+  std::uint32_t version = VERSION;
+  std::uint32_t real_size = sizeof(real);
+  std::uint32_t flags = 0;
+  std::uint64_t nb_particles = 0;
+  std::uint64_t step_count = 0;
+  std::uint64_t state_checksum = 0;
+};
+
+/**
+  \brief write the particle state of the world
+
+  Force generators and links are not part of a snapshot,
+  restoring one needs a world built with the same topology.
+ */
+inline void save_snapshot(const ParticleWorld &world,
+                          std::ostream &out,
+                          std::uint32_t flags = 0) {
+  SnapshotHeader header;
+  header.flags = flags;
+  header.nb_particles = world.particles.size();
+  header.step_count = world.step_count;
+  header.state_checksum = world.state_checksum;
+  out.write(reinterpret_cast<const char *>(&header),
+            sizeof(header));
+  std::vector<ParticleRecord> records;
+  records.reserve(world.particles.size());
+  for (auto &particle_ptr : world.particles)
+    records.push_back(ParticleRecord(*particle_ptr));
+  out.write(reinterpret_cast<const char *>(records.data()),
+            records.size() * sizeof(ParticleRecord));
+  D_CHECK_MSG(out.good(), "failed to write snapshot");
+}
+
+inline void save_snapshot(const ParticleWorld &world,
+                          const std::string &path,
+                          std::uint32_t flags = 0) {
+  std::ofstream out(path, std::ios::binary);
+  D_CHECK_MSG(out.is_open(),
+              "can not open snapshot file " << path);
+  save_snapshot(world, out, flags);
+}
+
+/**bytes left in a seekable stream, -1 when it can not
+ * tell*/
+inline std::streamoff remaining_bytes(std::istream &in) {
+  auto here = in.tellg();
+  if (here == std::streampos(-1))
+    return -1;
+  in.seekg(0, std::ios::end);
+  auto end = in.tellg();
+  in.seekg(here);
+  if (end == std::streampos(-1) || !in.good())
+    return -1;
+  return end - here;
+}
+
+/**
+  read n records of T. left is remaining_bytes() of the
+  stream; when it is negative the size is unknown and the
+  records are read in slices, so the memory follows the
+  data actually present. what names the file in errors
+ */
+template <class T>
+void read_record_slices(std::istream &in,
+                        std::vector<T> &records,
+                        std::uint64_t n,
+                        std::streamoff left,
+                        const char *what) {
+  const std::uint64_t slice = 4096;
+  std::uint64_t nb_read = 0;
+  records.clear();
+  while (nb_read < n) {
+    auto count = n - nb_read;
+    if (left < 0)
+      count = std::min(count, slice);
+    records.resize(nb_read + count);
+    auto bytes =
+        static_cast<std::streamsize>(count * sizeof(T));
+    in.read(reinterpret_cast<char *>(&records[nb_read]),
+            bytes);
+    D_CHECK_MSG(!in.fail() && in.gcount() == bytes,
+                "truncated " << what);
+    nb_read += count;
+  }
+}
+
+/**
+  \brief read a snapshot into the world
+
+  An empty world gets one new particle per record, otherwise
+  the records overwrite the existing particles in order and
+  the counts must match.
+ */
+inline SnapshotHeader load_snapshot(ParticleWorld &world,
+                                    std::istream &in) {
+  SnapshotHeader header;
+  in.read(reinterpret_cast<char *>(&header),
+          sizeof(header));
+  D_CHECK_MSG(!in.fail() && in.gcount() == sizeof(header),
+              "truncated snapshot header");
+  D_CHECK_MSG(header.magic == SnapshotHeader::MAGIC,
+              "not a snapshot file");
+  D_CHECK_MSG(header.version == SnapshotHeader::VERSION,
+              "unsupported snapshot version "
+                  << header.version);
+  D_CHECK_MSG(header.real_size == sizeof(real),
+              "snapshot was written with a different real");
+
+  // a corrupt count must not size the allocation
+  auto left = remaining_bytes(in);
+  D_CHECK_MSG(left < 0 ||
+                  header.nb_particles <=
+                      std::uint64_t(left) /
+                          sizeof(ParticleRecord),
+              "truncated snapshot, " << header.nb_particles
+                                     << " particles");
+  std::vector<ParticleRecord> records;
+  read_record_slices(in, records, header.nb_particles, left,
+                     "snapshot");
+
+  if (world.particles.empty()) {
+    world.particles.reserve(records.size());
+    for (auto &record : records) {
+      auto particle_ptr = std::make_shared<Particle>();
+      record.apply(*particle_ptr);
+      world.particles.push_back(particle_ptr);
+    }
+  } else {
+    COMP_CHECK_MSG(
+        world.particles.size() == records.size(),
+        world.particles.size(), records.size(),
+        "snapshot does not match the world");
+    for (std::size_t i = 0; i < records.size(); i++)
+      records[i].apply(*world.particles[i]);
+  }
+  world.step_count = header.step_count;
+  world.state_checksum = header.state_checksum;
+  return header;
+}
+
+inline SnapshotHeader
+load_snapshot(ParticleWorld &world,
+              const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  D_CHECK_MSG(in.is_open(),
+              "can not open snapshot file " << path);
+  return load_snapshot(world, in);
+}
+
+/**
+  \brief appends particle positions to a trajectory file
+
+  Each frame is the step number, the particle count and
+  the positions as packed reals.
+ */
+class TrajectoryRecorder {
+protected:
+  std::ofstream out;
+  std::vector<real> frame;
+
+public:
+  TrajectoryRecorder(const std::string &path)
+      : out(path, std::ios::binary) {
+    D_CHECK_MSG(out.is_open(),
+                "can not open trajectory file " << path);
+  }
+  void record(const ParticleWorld &world) {
+    std::uint64_t header[2] = {
+        world.step_count,
+        static_cast<std::uint64_t>(world.particles.size())};
+    frame.resize(world.particles.size() * 3);
+    for (std::size_t i = 0; i < world.particles.size();
+         i++) {
+      ParticleRecord::store(
+          &frame[i * 3],
+          world.particles[i]->get_position());
+    }
+    out.write(reinterpret_cast<const char *>(header),
+              sizeof(header));
+    out.write(reinterpret_cast<const char *>(frame.data()),
+              frame.size() * sizeof(real));
+  }
+};
+};
@@ -0,0 +1,411 @@
+#pragma once
+// factored solver for rigid rod structures
+#include <cstdint>
+#include <external.hpp>
+#include <unordered_map>
+#include <vivaphysics/plink.hpp>
+#include <vivaphysics/profiler.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief rods of any topology solved together with a cached
+  sparse LDL^T factorization
+
+  The impulses bringing every rod to its target solve
+  A l = c with A = J W J^T: the diagonal holds the inverse
+  masses of both ends of each rod, rods sharing a particle
+  p are coupled by +-w_p n_k.n_l. These dot products do not
+  change when a structure moves rigidly, so A stays close
+  to the matrix it was factored from for as long as the
+  structure keeps its shape, whatever its motion.
+
+  The rods are ordered by reverse Cuthill-McKee, which
+  keeps the factor of long frames and bridges in a narrow
+  envelope, and A is factored once. Each solve then
+  refines against the current A with the cached factor,
+  two triangular solves per round, and factors again only
+  when that does not reach tolerance within
+  max_refinements rounds, or when the rods change.
+
+  Redundant rods, as in an over-braced frame, make A
+  singular: regularization adds that fraction of the
+  diagonal to it, so conflicting lengths are shared between
+  the rods instead of fought over. Rods between two bodies
+  of infinite mass are ignored.
+ */
+class ParticleStructureSolver {
+public:
+  /**most linearized length corrections per step*/
+  unsigned int position_iterations = 4;
+  /**length error left, relative to the rod length, and
+   * residual left by a solve, relative to its rhs*/
+  real tolerance = 1e-4f;
+  /**refinement rounds before factoring again*/
+  unsigned int max_refinements = 4;
+  real regularization = 1e-2f;
+
+protected:
+  static constexpr unsigned int ANCHOR = ~0u;
+
+  struct Rod {
+    unsigned int a, b;
+    real length;
+    /**other end when b is ANCHOR*/
+    v3 anchor;
+  };
+  /**coupling of rows row > col through a shared node*/
+  struct Coupling {
+    unsigned int row, col, node;
+    real sign;
+  };
+
+  Particles nodes;
+  /**rods in factor order*/
+  std::vector<Rod> rods;
+  std::vector<Coupling> couplings;
+  /**row i of the factor holds columns [first[i], i] at
+   * envelope[start[i]]..*/
+  std::vector<unsigned int> first, start;
+  std::vector<real> envelope;
+  bool factored = false;
+  unsigned int nb_factorizations = 0;
+
+  std::vector<v3> xs, vs, normals;
+  std::vector<real> ws, lengths, diag, coupled;
+  std::vector<real> rhs, lambda, residual, step;
+
+  /**rods sharing a particle, reverse Cuthill-McKee*/
+  static std::vector<unsigned int> order_rods(
+      const std::vector<std::vector<unsigned int>> &adj) {
+    auto n = static_cast<unsigned int>(adj.size());
+    std::vector<unsigned int> order;
+    order.reserve(n);
+    std::vector<std::uint8_t> seen(n, 0);
+    auto degree = [&adj](unsigned int k) {
+      return adj[k].size();
+    };
+    std::vector<unsigned int> by_degree(n);
+    for (unsigned int k = 0; k < n; k++)
+      by_degree[k] = k;
+    std::stable_sort(by_degree.begin(), by_degree.end(),
+                     [&](unsigned int i, unsigned int j) {
+                       return degree(i) < degree(j);
+                     });
+    std::vector<unsigned int> next;
+    for (unsigned int root : by_degree) {
+      if (seen[root])
+        continue;
+      seen[root] = 1;
+      auto head = order.size();
+      order.push_back(root);
+      while (head < order.size()) {
+        unsigned int k = order[head++];
+        next.clear();
+        for (unsigned int l : adj[k])
+          if (!seen[l]) {
+            seen[l] = 1;
+            next.push_back(l);
+          }
+        std::stable_sort(
+            next.begin(), next.end(),
+            [&](unsigned int i, unsigned int j) {
+              return degree(i) < degree(j);
+            });
+        order.insert(order.end(), next.begin(),
+                     next.end());
+      }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+  }
+
+  v3 far_end(const Rod &r) const {
+    return r.b == ANCHOR ? r.anchor : xs[r.b];
+  }
+
+  /**directions, lengths and entries of A at xs*/
+  void assemble() {
+    auto n = static_cast<unsigned int>(rods.size());
+    for (unsigned int k = 0; k < n; k++) {
+      const auto &r = rods[k];
+      v3 d = far_end(r) - xs[r.a];
+      lengths[k] = d.magnitude();
+      normals[k] =
+          lengths[k] > 0 ? d * (1 / lengths[k]) : v3(0);
+      real w = ws[r.a] + (r.b == ANCHOR ? 0 : ws[r.b]);
+      diag[k] = w * (1 + regularization);
+    }
+    for (std::size_t e = 0; e < couplings.size(); e++) {
+      const auto &c = couplings[e];
+      coupled[e] = c.sign * ws[c.node] *
+                   normals[c.row].dot(normals[c.col]);
+    }
+  }
+
+  /**LDL^T of the current A, in place in the envelope*/
+  void factorize() {
+    VP_PROFILE_ZONE("structure/factorize");
+    std::fill(envelope.begin(), envelope.end(), real(0));
+    auto n = static_cast<unsigned int>(rods.size());
+    for (unsigned int i = 0; i < n; i++)
+      envelope[start[i] + i - first[i]] = diag[i];
+    for (std::size_t e = 0; e < couplings.size(); e++) {
+      const auto &c = couplings[e];
+      envelope[start[c.row] + c.col - first[c.row]] +=
+          coupled[e];
+    }
+    auto at = [this](unsigned int i, unsigned int j) {
+      return start[i] + j - first[i];
+    };
+    for (unsigned int i = 0; i < n; i++) {
+      for (unsigned int j = first[i]; j <= i; j++) {
+        real sum = envelope[at(i, j)];
+        for (unsigned int k = std::max(first[i], first[j]);
+             k < j; k++)
+          sum -= envelope[at(i, k)] * envelope[at(j, k)] *
+                 envelope[at(k, k)];
+        if (j < i) {
+          real d = envelope[at(j, j)];
+          envelope[at(i, j)] = d > 0 ? sum / d : 0;
+        } else {
+          envelope[at(i, i)] = sum;
+        }
+      }
+    }
+    factored = true;
+    nb_factorizations++;
+  }
+
+  /**x = (LDL^T)^-1 x with the cached factor*/
+  void back_substitute(std::vector<real> &x) const {
+    auto n = static_cast<unsigned int>(rods.size());
+    for (unsigned int i = 0; i < n; i++) {
+      real sum = x[i];
+      for (unsigned int j = first[i]; j < i; j++)
+        sum -= envelope[start[i] + j - first[i]] * x[j];
+      x[i] = sum;
+    }
+    for (unsigned int i = 0; i < n; i++) {
+      real d = envelope[start[i] + i - first[i]];
+      x[i] = d > 0 ? x[i] / d : 0;
+    }
+    for (unsigned int i = n; i-- > 0;) {
+      for (unsigned int j = first[i]; j < i; j++)
+        x[j] -= envelope[start[i] + j - first[i]] * x[i];
+    }
+  }
+
+  /**residual = rhs - A lambda, returns its norm*/
+  real update_residual() {
+    auto n = static_cast<unsigned int>(rods.size());
+    for (unsigned int k = 0; k < n; k++)
+      residual[k] = rhs[k] - diag[k] * lambda[k];
+    for (std::size_t e = 0; e < couplings.size(); e++) {
+      const auto &c = couplings[e];
+      residual[c.row] -= coupled[e] * lambda[c.col];
+      residual[c.col] -= coupled[e] * lambda[c.row];
+    }
+    real sum = 0;
+    for (real r : residual)
+      sum += r * r;
+    return std::sqrt(sum);
+  }
+
+  /**A lambda = rhs, refined with the cached factor*/
+  void solve_system() {
+    std::fill(lambda.begin(), lambda.end(), real(0));
+    real goal = tolerance * update_residual();
+    if (goal == 0)
+      return;
+    if (factored) {
+      for (unsigned int it = 0; it < max_refinements;
+           it++) {
+        step = residual;
+        back_substitute(step);
+        for (std::size_t k = 0; k < lambda.size(); k++)
+          lambda[k] += step[k];
+        if (update_residual() <= goal)
+          return;
+      }
+    }
+    factorize();
+    lambda = rhs;
+    back_substitute(lambda);
+  }
+
+  /**apply impulses lambda along the rods to out*/
+  void apply(std::vector<v3> &out) const {
+    for (std::size_t k = 0; k < rods.size(); k++) {
+      const auto &r = rods[k];
+      v3 impulse = normals[k] * lambda[k];
+      out[r.a] += impulse * ws[r.a];
+      if (r.b != ANCHOR)
+        out[r.b] -= impulse * ws[r.b];
+    }
+  }
+
+public:
+  unsigned int nb_rods() const {
+    return static_cast<unsigned int>(rods.size());
+  }
+  /**factorizations since the rods were found*/
+  unsigned int get_factorizations() const {
+    return nb_factorizations;
+  }
+
+  /**
+    \brief take the rods and anchored rods of data not yet
+    marked in solved, and mark them
+
+    The rods are ordered and their envelope laid out here,
+    the factorization waits for the first solve.
+   */
+  void
+  build(const std::vector<ParticleContactWrapper> &data,
+        std::vector<std::uint8_t> &solved) {
+    VP_PROFILE_ZONE("structure/build");
+    nodes.clear();
+    rods.clear();
+    couplings.clear();
+    factored = false;
+    nb_factorizations = 0;
+
+    std::unordered_map<Particle *, unsigned int> node_of;
+    auto node = [&](const std::shared_ptr<Particle> &p) {
+      auto it = node_of.find(p.get());
+      if (it != node_of.end())
+        return it->second;
+      auto id = static_cast<unsigned int>(nodes.size());
+      node_of[p.get()] = id;
+      nodes.push_back(p);
+      return id;
+    };
+    std::vector<Rod> found;
+    for (std::size_t i = 0; i < data.size(); i++) {
+      const auto &w = data[i];
+      const auto &ps = w.contact_ps.ps;
+      if (solved[i])
+        continue;
+      if (w.type == ParticleContactGeneratorType::ROD &&
+          ps.size() >= 2 && ps[0] && ps[1] &&
+          ps[0] != ps[1]) {
+        found.push_back({node(ps[0]), node(ps[1]),
+                         w.length_max_length, v3(0)});
+      } else if (w.type == ParticleContactGeneratorType::
+                               ROD_CONSTRAINT &&
+                 !ps.empty() && ps[0]) {
+        found.push_back({node(ps[0]), ANCHOR,
+                         w.length_max_length, w.anchor});
+      } else {
+        continue;
+      }
+      solved[i] = 1;
+    }
+
+    // rods of each node, then rods sharing a node
+    auto nb = static_cast<unsigned int>(found.size());
+    std::vector<std::vector<unsigned int>> of_node(
+        nodes.size());
+    for (unsigned int k = 0; k < nb; k++) {
+      of_node[found[k].a].push_back(k);
+      if (found[k].b != ANCHOR)
+        of_node[found[k].b].push_back(k);
+    }
+    std::vector<std::vector<unsigned int>> adj(nb);
+    for (const auto &ks : of_node)
+      for (unsigned int k : ks)
+        for (unsigned int l : ks)
+          if (k != l)
+            adj[k].push_back(l);
+    auto order = order_rods(adj);
+    std::vector<unsigned int> row_of(nb);
+    for (unsigned int r = 0; r < nb; r++) {
+      row_of[order[r]] = r;
+      rods.push_back(found[order[r]]);
+    }
+
+    auto sign = [](const Rod &r, unsigned int p) {
+      return r.a == p ? real(-1) : real(1);
+    };
+    first.resize(nb);
+    for (unsigned int r = 0; r < nb; r++)
+      first[r] = r;
+    for (unsigned int p = 0; p < of_node.size(); p++) {
+      const auto &ks = of_node[p];
+      for (std::size_t x = 0; x < ks.size(); x++)
+        for (std::size_t y = x + 1; y < ks.size(); y++) {
+          unsigned int i = row_of[ks[x]],
+                       j = row_of[ks[y]];
+          unsigned int row = std::max(i, j),
+                       col = std::min(i, j);
+          couplings.push_back(
+              {row, col, p,
+               sign(rods[row], p) * sign(rods[col], p)});
+          first[row] = std::min(first[row], col);
+        }
+    }
+    start.resize(nb + 1);
+    start[0] = 0;
+    for (unsigned int r = 0; r < nb; r++)
+      start[r + 1] = start[r] + r - first[r] + 1;
+    envelope.resize(start[nb]);
+
+    xs.resize(nodes.size());
+    vs.resize(nodes.size());
+    ws.resize(nodes.size());
+    for (auto *v : {&lengths, &diag, &rhs, &lambda,
+                    &residual, &step})
+      v->resize(nb);
+    normals.resize(nb);
+    coupled.resize(couplings.size());
+  }
+
+  /**lengths then velocities of every rod*/
+  void solve() {
+    if (rods.empty())
+      return;
+    VP_PROFILE_ZONE("structure/solve");
+    for (std::size_t j = 0; j < nodes.size(); j++) {
+      xs[j] = nodes[j]->get_position();
+      vs[j] = nodes[j]->get_velocity();
+      ws[j] = std::max(nodes[j]->get_inverse_mass(),
+                       real(0));
+    }
+    auto n = rods.size();
+    for (unsigned int it = 0; it < position_iterations;
+         it++) {
+      assemble();
+      bool any = false;
+      for (std::size_t k = 0; k < n; k++) {
+        rhs[k] = lengths[k] - rods[k].length;
+        any = any ||
+              std::abs(rhs[k]) > tolerance * rods[k].length;
+      }
+      if (!any)
+        break;
+      solve_system();
+      apply(xs);
+    }
+
+    // velocities along the corrected rods
+    assemble();
+    for (std::size_t k = 0; k < n; k++) {
+      const auto &r = rods[k];
+      v3 far = r.b == ANCHOR ? v3(0) : vs[r.b];
+      rhs[k] = normals[k].dot(far - vs[r.a]);
+    }
+    solve_system();
+    apply(vs);
+
+    for (std::size_t j = 0; j < nodes.size(); j++) {
+      if (ws[j] == 0)
+        continue;
+      nodes[j]->set_position(xs[j]);
+      nodes[j]->set_velocity(vs[j]);
+    }
+  }
+};
+};
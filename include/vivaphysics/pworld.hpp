@@ -2,19 +2,115 @@
 
 // particle links
 #include <external.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/pcache.hpp>
+#include <vivaphysics/pchain.hpp>
+#include <vivaphysics/pcommand.hpp>
 #include <vivaphysics/pcontact.hpp>
+#include <vivaphysics/pemitter.hpp>
+#include <vivaphysics/perfcounters.hpp>
 #include <vivaphysics/pfgen.hpp>
+#include <vivaphysics/phandle.hpp>
+#include <vivaphysics/pimplicit.hpp>
 #include <vivaphysics/plink.hpp>
+#include <vivaphysics/plinkbatch.hpp>
+#include <vivaphysics/pnbody.hpp>
+#include <vivaphysics/ppipeline.hpp>
+#include <vivaphysics/ppool.hpp>
+#include <vivaphysics/profiler.hpp>
+#include <vivaphysics/psph.hpp>
+#include <vivaphysics/pstructure.hpp>
+#include <vivaphysics/rfgen.hpp>
+#include <vivaphysics/statehash.hpp>
 
 using namespace vivaphysics;
 
 namespace vivaphysics {
 
+// ParticleForceRegistry members that run the set
+// generators, complete from here on
+
+inline void
+ParticleForceRegistry::update_sets(real duration,
+                                   ThreadPool *pool) {
+  pipelines.update_forces(duration, pool);
+  nbody.update_forces(duration, pool);
+  fluids.update_forces(duration, pool);
+  spring_networks.update_forces(duration, pool);
+}
+
+inline void
+ParticleForceRegistry::integrate(real duration,
+                                 ThreadPool *pool) {
+  for (auto &net : spring_networks.generators)
+    net->integrate(duration, pool);
+}
+
+inline void
+ParticleForceRegistry::update_forces(real duration) {
+  update_sets(duration, nullptr);
+  ProfileTally<NB_FORCE_GENERATOR_TYPES> tally;
+  for (unsigned int i = 0; i < force_register.size(); i++) {
+    tally.begin();
+    update_entry(i, duration);
+    auto gtype = force_register[i].second.gtype;
+    tally.end(static_cast<unsigned int>(gtype));
+  }
+  tally.emit(force_generator_profile_names());
+}
+
+inline void
+ParticleForceRegistry::update_forces(real duration,
+                                     ThreadPool *pool) {
+  if (pool == nullptr || pool->nb_threads() == 1) {
+    update_forces(duration);
+    return;
+  }
+  update_sets(duration, pool);
+  if (schedule_dirty)
+    build_schedule();
+  auto nb_groups =
+      static_cast<unsigned int>(group_start.size()) - 1;
+  parallel_for(
+      pool, nb_groups,
+      [this, duration](unsigned int begin, unsigned int end,
+                       unsigned int thread_id) {
+        VP_PROFILE_ZONE("update_forces/chunk");
+        VP_PERF_CHUNK(StepPhase::FORCES, thread_id);
+        ProfileTally<NB_FORCE_GENERATOR_TYPES> tally;
+        for (unsigned int g = begin; g < end; g++) {
+          for (unsigned int k = group_start[g];
+               k < group_start[g + 1]; k++) {
+            auto i = group_entries[k];
+            tally.begin();
+            update_entry(i, duration);
+            tally.end(static_cast<unsigned int>(
+                force_register[i].second.gtype));
+          }
+        }
+        tally.emit(force_generator_profile_names());
+      });
+}
+
+/**
+  \brief contact generators with their data
+
+  The two vectors are public and may be appended to
+  directly, such entries get their handle on the next call
+  that needs one. Removal moves the last generator into the
+  hole, which only changes the order contacts are generated
+  in.
+ */
 struct ContactGenerators {
   std::vector<
       ParticleContactGenerator<ParticleContactWrapper>>
       generators;
   std::vector<ParticleContactWrapper> contact_data;
+  HandleTable handles;
+  /**bumped by every change made through the methods, call
+   * changed() after editing contact_data in place*/
+  std::uint64_t revision = 0;
+
   ContactGenerators() {}
   ContactGenerators(
       const std::vector<ParticleContactGenerator<
@@ -25,63 +121,518 @@ struct ContactGenerators {
         generators.size() == contact_data.size(),
         generators.size(), contact_data.size(),
         "vector size must match for the argument");
+    sync_handles();
   }
-  void
+
+  /**handles for entries appended to the vectors directly*/
+  void sync_handles() { handles.grow(size()); }
+
+  void changed() { revision++; }
+
+  LinkHandle
   add(const ParticleContactGenerator<ParticleContactWrapper>
           &pcgen,
       const ParticleContactWrapper &pcw) {
+    sync_handles();
     generators.push_back(pcgen);
     contact_data.push_back(pcw);
+    changed();
+    return handles.push_back();
+  }
+
+  /**resize both vectors, new entries are default*/
+  void resize(unsigned int n) {
+    sync_handles();
+    COMP_CHECK_MSG(n >= size(), n, size(),
+                   "use remove to drop generators");
+    generators.resize(n);
+    contact_data.resize(n);
+    changed();
+    sync_handles();
   }
 
-  unsigned int size() {
+  unsigned int size() const {
     return static_cast<unsigned int>(generators.size());
   }
+
+  bool contains(LinkHandle h) {
+    sync_handles();
+    return handles.contains(h);
+  }
+
+  LinkHandle handle(unsigned int i) {
+    sync_handles();
+    return handles.handle(i);
+  }
+
+  /**removes a generator in O(1), throws on a stale
+   * handle*/
+  void remove(LinkHandle h) {
+    sync_handles();
+    remove_index(handles.index(h));
+  }
+
+  void remove_index(unsigned int i) {
+    handles.erase_index(i);
+    swap_and_pop(generators, i);
+    swap_and_pop(contact_data, i);
+    changed();
+  }
+
+  /**drop links using the particle and take it out of the
+   * ground contacts*/
+  void remove_particle(const std::shared_ptr<Particle> &p) {
+    sync_handles();
+    unsigned int i = 0;
+    while (i < size()) {
+      auto &ps = contact_data[i].contact_ps.ps;
+      if (contact_data[i].type ==
+          ParticleContactGeneratorType::GROUND) {
+        ps.erase(std::remove(ps.begin(), ps.end(), p),
+                 ps.end());
+      } else if (std::find(ps.begin(), ps.end(), p) !=
+                 ps.end()) {
+        remove_index(i);
+        continue;
+      }
+      i++;
+    }
+  }
+};
+
+/**
+  \brief what ParticleWorld::run_within cut to finish a
+  step within its budget
+ */
+struct StepReport {
+  /**seconds allowed and taken*/
+  double budget = 0;
+  double elapsed = 0;
+
+  /**the resolver stopped on the deadline*/
+  bool resolver_cut = false;
+  /**optional_forces were left out*/
+  bool optional_forces_skipped = false;
+  /**aging the pooled particles waits for the next step*/
+  bool retire_deferred = false;
+
+  /**what the resolver achieved*/
+  unsigned int iterations = 0;
+  real velocity_error = 0;
+  real penetration_error = 0;
+
+  bool late() const { return elapsed > budget; }
+  bool degraded() const {
+    return resolver_cut || optional_forces_skipped ||
+           retire_deferred;
+  }
 };
 
 //
 class ParticleWorld {
 public:
-  /**holds the particles*/
+  /**holds the particles, appending directly is fine, use
+   * remove_particle to take one out*/
   Particles particles;
+  HandleTable particle_handles;
+
+  /**particles without force generators or links, spawned
+   * and despawned without allocating. They are integrated
+   * and hashed with the others but not kept in snapshots*/
+  ParticlePool pooled;
+
+  /**groups whose generators are applied while they are
+   * integrated, in one pass. Their particles must stay
+   * out of particles and are not kept in snapshots*/
+  std::vector<std::shared_ptr<ParticleForcePipeline>>
+      fused_pipelines;
+
+  /**spawn into pooled at the start of each step*/
+  std::vector<ParticleEmitter> emitters;
+  /**pooled particles entering one are retired at the end
+   * of the step, as are those whose lifetime ran out*/
+  std::vector<KillRegion> kill_regions;
 
   ContactGenerators contact_generators;
 
+  /**rigid bodies, pushed by rigid_forces and integrated
+   * after the particles. They take no part in contacts*/
+  RigidBodySet rigid_bodies;
+  RigidForceRegistry rigid_forces;
+
+  /**allow twice as many resolver iterations as contacts
+   * each step, the resolver still stops at its tolerances*/
   bool compute_iterations;
 
   ParticleForceRegistry registry;
+  /**forces applied after registry that run_within() may
+   * leave out when the step runs late. Not kept in
+   * snapshots*/
+  ParticleForceRegistry optional_forces;
 
   ParticleContactResolver resolver;
 
+  /**
+    start the resolver from the impulses contacts ended
+    the previous steps with. Off by default: it helps
+    resting stacks and hanging cables, less so rigs of
+    rods, and changes the replayed trajectories
+   */
+  bool warm_start = false;
+  ParticleContactCache contact_cache;
+  /**identity of each generated contact*/
+  std::vector<ContactKey> contact_keys;
+
+  /**
+    solve unbranched chains of rods and cables directly,
+    before the resolver runs on the other contacts. False
+    leaves every link to the resolver
+   */
+  bool solve_chains = true;
+  ParticleChainSolver chains;
+  /**solve the remaining rods with a cached factorization,
+   * after the chains*/
+  bool solve_structures = true;
+  ParticleStructureSolver structures;
+  /**links solved by chains or structures, from the
+   * revision of the contact generators they were found in*/
+  std::vector<std::uint8_t> direct_links;
+  std::uint64_t direct_revision = ~0ull;
+  std::size_t direct_size = 0;
+  unsigned int direct_mode = 0;
+
+  /**
+    evaluate rods, cables and anchored links as columns
+    instead of one generator call each. False runs every
+    generator as it is
+   */
+  bool batch_links = true;
+  ParticleLinkBatch link_batch;
+  std::uint64_t batch_revision = ~0ull;
+  std::size_t batch_size = 0;
+  unsigned int batch_mode = 0;
+
   std::vector<ParticleContact> contacts;
   unsigned int max_contact_nb;
 
+  /**
+    \brief bit reproducible stepping
+
+    Every parallel phase of run() splits work so that each
+    floating point sum is evaluated in the serial order:
+    forces are summed per particle in storage order,
+    particles integrate independently, contacts keep
+    generator order. Results are therefore bit identical for
+    any thread count. In deterministic mode run() also
+    chains a checksum of the particle state after each step
+    into state_checksum, so two runs can be compared step
+    by step without storing their states.
+   */
+  bool deterministic = false;
+
+  /**keep every per step checksum in checksum_history*/
+  bool record_checksums = false;
+
+  std::uint64_t state_checksum = StateHasher::OFFSET;
+  std::vector<std::uint64_t> checksum_history;
+
+  /**changes posted from other threads, applied at the
+   * start of each step*/
+  WorldCommandQueue commands;
+
+  /**number of completed calls to run()*/
+  std::uint64_t step_count = 0;
+
+  /**
+    seconds run_within() expects the phases it can not
+    skip and optional_forces to take, smoothed over the
+    steps. tail_estimate is the part of required_estimate
+    that runs after the resolver, which stops that much
+    before the deadline
+   */
+  double required_estimate = 0;
+  double optional_estimate = 0;
+  double tail_estimate = 0;
+  /**aging deferred by run_within(), done by the next
+   * retire()*/
+  real deferred_retire = 0;
+
+  /**worker threads, shared so the world stays copyable*/
+  std::shared_ptr<ThreadPool> pool;
+
   // constructor
   ParticleWorld(unsigned int max_contacts,
                 unsigned int iterations)
       : compute_iterations(iterations == 0),
-        resolver(iterations),
+        resolver(iterations), contacts(max_contacts),
         max_contact_nb(max_contacts) {}
 
-  void add_contact_generator(
+  /**resize the contact buffer*/
+  void set_max_contacts(unsigned int max_contacts) {
+    max_contact_nb = max_contacts;
+    contacts.resize(max_contacts);
+    link_batch.forget();
+  }
+
+  /**use nb threads for the parallel phases of run(); 0 or
+   * 1 runs everything on the calling thread*/
+  void set_threads(unsigned int nb) {
+    if (nb <= 1) {
+      pool.reset();
+    } else {
+      pool = std::make_shared<ThreadPool>(nb);
+    }
+  }
+  unsigned int get_threads() const {
+    return pool ? pool->nb_threads() : 1;
+  }
+  void set_deterministic(bool d) { deterministic = d; }
+
+  /**restart the checksum chain, e.g. after loading a
+   * state*/
+  void reset_checksum() {
+    state_checksum = StateHasher::OFFSET;
+    checksum_history.clear();
+    step_count = 0;
+  }
+
+  LinkHandle add_contact_generator(
       const ParticleContactGenerator<ParticleContactWrapper>
           &pcgen,
       const ParticleContactWrapper &pcw) {
-    contact_generators.add(pcgen, pcw);
+    return contact_generators.add(pcgen, pcw);
+  }
+
+  /**handles for particles appended to particles directly*/
+  void sync_particle_handles() {
+    particle_handles.grow(
+        static_cast<std::uint32_t>(particles.size()));
+  }
+
+  ParticleHandle add_particle(std::shared_ptr<Particle> p) {
+    sync_particle_handles();
+    particles.push_back(p);
+    return particle_handles.push_back();
+  }
+
+  bool contains(ParticleHandle h) {
+    sync_particle_handles();
+    return particle_handles.contains(h);
+  }
+
+  /**particle of a live handle, throws on a stale one*/
+  std::shared_ptr<Particle> get_particle(ParticleHandle h) {
+    sync_particle_handles();
+    return particles[particle_handles.index(h)];
+  }
+
+  ParticleHandle particle_handle(unsigned int i) {
+    sync_particle_handles();
+    return particle_handles.handle(i);
+  }
+
+  /**
+    \brief removes the particle, its force generators and
+    the links that use it
+
+    The last particle takes the place of the removed one.
+    Finding the generators to drop is a scan of the
+    registry and of the contact generators, remove them by
+    handle when they are known.
+   */
+  void remove_particle(ParticleHandle h) {
+    sync_particle_handles();
+    auto i = particle_handles.erase(h);
+    auto p = particles[i];
+    swap_and_pop(particles, i);
+    registry.remove_particle(p);
+    contact_generators.remove_particle(p);
+  }
+
+  void remove_particle(std::shared_ptr<Particle> p) {
+    sync_particle_handles();
+    auto it =
+        std::find(particles.begin(), particles.end(), p);
+    if (it == particles.end())
+      return;
+    auto i = static_cast<std::uint32_t>(
+        std::distance(particles.begin(), it));
+    remove_particle(particle_handles.handle(i));
+  }
+
+  /**apply the posted commands, called by run() before the
+   * forces*/
+  unsigned int apply_commands() {
+    if (commands.empty())
+      return 0;
+    VP_PROFILE_ZONE("apply_commands");
+    auto n = commands.drain([this](WorldCommand &c) {
+      switch (c.type) {
+      case WorldCommandType::SPAWN:
+        add_particle(c.particle);
+        break;
+      case WorldCommandType::DESPAWN:
+        remove_particle(c.particle);
+        break;
+      case WorldCommandType::ADD_FORCE:
+        registry.add(c.particle, c.force);
+        break;
+      case WorldCommandType::REMOVE_FORCE:
+        if (registry.contains(c.handle))
+          registry.remove(c.handle);
+        break;
+      case WorldCommandType::ADD_CONTACT:
+        contact_generators.add(
+            ParticleContactGenerator<
+                ParticleContactWrapper>(),
+            c.contact);
+        break;
+      case WorldCommandType::REMOVE_CONTACT:
+        if (contact_generators.contains(c.handle))
+          contact_generators.remove(c.handle);
+        break;
+      case WorldCommandType::SET_STATE:
+        *c.particle = c.state;
+        break;
+      }
+    });
+    VP_PROFILE_COUNTER("commands", n);
+    return n;
+  }
+
+  // spawn from the emitters
+  unsigned int emit(real duration) {
+    unsigned int nb = 0;
+    for (auto &emitter : emitters)
+      nb += emitter.emit(duration, pooled);
+    VP_PROFILE_COUNTER("emitted", nb);
+    return nb;
+  }
+
+  // age the pooled particles and drop the retired ones
+  unsigned int retire(real duration) {
+    if (pooled.empty()) {
+      deferred_retire = 0;
+      return 0;
+    }
+    VP_PROFILE_ZONE("retire");
+    auto nb = pooled.retire(duration + deferred_retire,
+                            kill_regions);
+    deferred_retire = 0;
+    VP_PROFILE_COUNTER("retired", nb);
+    return nb;
+  }
+
+  /**find the chains and structures again if the links
+   * or the solve flags changed*/
+  void update_direct_links() {
+    auto &gens = contact_generators;
+    unsigned int mode = (solve_chains ? 1u : 0u) |
+                        (solve_structures ? 2u : 0u);
+    if (direct_revision == gens.revision &&
+        direct_size == gens.contact_data.size() &&
+        direct_mode == mode)
+      return;
+    direct_links.assign(gens.size(), 0);
+    if (solve_chains)
+      chains.build(gens.contact_data, direct_links);
+    else
+      chains = ParticleChainSolver();
+    if (solve_structures)
+      structures.build(gens.contact_data, direct_links);
+    else
+      structures = ParticleStructureSolver();
+    direct_revision = gens.revision;
+    direct_size = gens.contact_data.size();
+    direct_mode = mode;
+  }
+
+  /**rebuild link_batch when the generators or the links
+   * left to them changed*/
+  void update_link_batch() {
+    const auto &gens = contact_generators;
+    if (batch_revision == gens.revision &&
+        batch_size == gens.contact_data.size() &&
+        batch_mode == direct_mode)
+      return;
+    link_batch.build(gens.contact_data, direct_links);
+    batch_revision = gens.revision;
+    batch_size = gens.contact_data.size();
+    batch_mode = direct_mode;
+  }
+
+  /**contact identities for the warm start*/
+  void key_contacts(unsigned int i, unsigned int begin,
+                    unsigned int end) {
+    // links fight each other down a chain, an impulse left
+    // over from the last step is rarely right for them
+    if (contact_generators.contact_data[i].type !=
+        ParticleContactGeneratorType::GROUND) {
+      for (unsigned int k = begin; k < end; k++)
+        contact_keys[k] = ContactKey();
+      return;
+    }
+    auto h = contact_generators.handles.handle(i);
+    auto id =
+        (std::uint64_t(h.generation) << 32) | h.slot;
+    for (unsigned int k = begin; k < end; k++)
+      contact_keys[k] = ContactKey(id, contacts[k]);
   }
 
   // generate particle contacts
   unsigned int generate_contacts() {
+    VP_PROFILE_ZONE("generate_contacts");
+    VP_PERF_PHASE(StepPhase::CONTACTS);
+    VP_PERF_ITEMS(StepPhase::CONTACTS,
+                  contact_generators.size());
+    update_direct_links();
     auto limit = max_contact_nb;
     auto contact_start = 0;
+    if (warm_start) {
+      contact_generators.sync_handles();
+      contact_keys.resize(contacts.size());
+    }
+    if (batch_links) {
+      update_link_batch();
+      link_batch.evaluate(pool.get());
+      for (const auto &entry : link_batch.entries()) {
+        if (limit <= 0)
+          break;
+        auto i = entry.generator;
+        auto &data = contact_generators.contact_data[i];
+        unsigned int used_nb_contacts = 0;
+        if (entry.row != ParticleLinkBatch::NONE) {
+          used_nb_contacts = link_batch.write(
+              entry.row, data, contacts, contact_start);
+        } else {
+          used_nb_contacts =
+              contact_generators.generators[i].add_contact(
+                  data, contacts, contact_start, limit);
+          auto end = contact_start + used_nb_contacts;
+          link_batch.forget(contact_start, end);
+        }
+        if (warm_start)
+          key_contacts(i, contact_start,
+                       contact_start + used_nb_contacts);
+        limit -= used_nb_contacts;
+        contact_start += used_nb_contacts;
+      }
+      return max_contact_nb - limit;
+    }
+    link_batch.forget();
     for (unsigned int i = contact_start;
          i < contact_generators.size(); i++) {
+      if (!direct_links.empty() && direct_links[i])
+        continue;
       auto contact_generator =
           contact_generators.generators[i];
       ParticleContactWrapper wrapper =
           contact_generators.contact_data[i];
       auto used_nb_contacts = contact_generator.add_contact(
           wrapper, contacts, contact_start, limit);
+      if (warm_start)
+        key_contacts(i, contact_start,
+                     contact_start + used_nb_contacts);
       limit -= used_nb_contacts;
       contact_start += used_nb_contacts;
       if (limit <= 0)
@@ -92,28 +643,252 @@ public:
 
   // move particles
   void integrate(real duration) {
-    for (auto &particle_ptr : particles) {
-      particle_ptr->integrate(duration);
+    VP_PROFILE_ZONE("integrate");
+    VP_PERF_PHASE(StepPhase::INTEGRATE);
+    VP_PERF_ITEMS(StepPhase::INTEGRATE,
+                  particles.size() + pooled.size() +
+                      rigid_bodies.size());
+    pooled.integrate(duration, pool.get());
+    if (!rigid_bodies.empty())
+      rigid_bodies.integrate(duration, pool.get());
+    for (auto &pipeline : fused_pipelines)
+      pipeline->integrate(duration, pool.get());
+    if (!pool) {
+      for (auto &particle_ptr : particles) {
+        particle_ptr->integrate(duration);
+      }
+    } else {
+      auto n = static_cast<unsigned int>(particles.size());
+      parallel_for(
+          pool.get(), n,
+          [this, duration](unsigned int begin,
+                           unsigned int end,
+                           unsigned int thread_id) {
+            VP_PROFILE_ZONE("integrate/chunk");
+            VP_PERF_CHUNK(StepPhase::INTEGRATE, thread_id);
+            for (unsigned int i = begin; i < end; i++)
+              particles[i]->integrate(duration);
+          });
+    }
+    registry.integrate(duration, pool.get());
+    optional_forces.integrate(duration, pool.get());
+  }
+
+  // apply the force generators
+  void update_forces(real duration) {
+    update_forces(duration, true);
+  }
+
+  /**the forces, optional_forces only when with_optional
+   * is true*/
+  void update_forces(real duration, bool with_optional) {
+    VP_PROFILE_ZONE("update_forces");
+    VP_PERF_PHASE(StepPhase::FORCES);
+    VP_PERF_ITEMS(StepPhase::FORCES, registry.size());
+    registry.update_forces(duration, pool.get());
+    if (with_optional)
+      optional_forces.update_forces(duration, pool.get());
+    rigid_forces.update_forces(rigid_bodies, duration);
+  }
+
+  // resolve the first nb_contacts generated contacts
+  void resolve_contacts(unsigned int nb_contacts,
+                        real duration) {
+    solve_direct_links();
+    resolve_contacts(nb_contacts, duration, nullptr);
+  }
+
+  /**the chains and structures solved exactly*/
+  void solve_direct_links() {
+    if (chains.nb_chains() != 0)
+      chains.solve(pool.get());
+    structures.solve();
+  }
+
+  /**resolve with the resolver only, stopping at deadline
+   * when one is given, on top of its own limits. The
+   * direct links are left to solve_direct_links()*/
+  void resolve_contacts(
+      unsigned int nb_contacts, real duration,
+      const ParticleContactResolver::Clock::time_point
+          *deadline) {
+    VP_PROFILE_COUNTER("contacts", nb_contacts);
+    if (warm_start)
+      contact_cache.warm(contacts, contact_keys,
+                         nb_contacts);
+    else if (contact_cache.size() != 0)
+      contact_cache.clear();
+    if (nb_contacts != 0) {
+      VP_PROFILE_ZONE("resolve_contacts");
+      VP_PERF_PHASE(StepPhase::RESOLVE);
+      VP_PERF_ITEMS(StepPhase::RESOLVE, nb_contacts);
+      if (compute_iterations) {
+        resolver.set_iterations(nb_contacts * 2);
+      }
+      resolver.accumulated = warm_start;
+      auto time_limit = resolver.time_limit;
+      if (deadline != nullptr) {
+        // at least one iteration, even when already late
+        double left = std::max(
+            std::chrono::duration<double>(
+                *deadline -
+                ParticleContactResolver::Clock::now())
+                .count(),
+            1e-9);
+        if (time_limit <= 0 || left < time_limit)
+          resolver.time_limit = left;
+      }
+      resolver.resolve_contacts(contacts, nb_contacts,
+                                duration);
+      resolver.time_limit = time_limit;
+      VP_PROFILE_COUNTER("iteration_used",
+                         resolver.iteration_used);
+      VP_PROFILE_COUNTER("velocity_error",
+                         resolver.velocity_error);
+      VP_PROFILE_COUNTER("penetration_error",
+                         resolver.penetration_error);
+    } else {
+      resolver.clear_report();
+    }
+    if (warm_start) {
+      contact_cache.store(contacts, contact_keys,
+                          nb_contacts);
+      contact_cache.sweep();
+    }
+  }
+
+  // bookkeeping once the state of the step is final
+  void end_step() {
+    step_count++;
+    if (deterministic) {
+      state_checksum = rolling_state_hash(
+          state_checksum, step_count, particles);
+      if (!pooled.empty()) {
+        StateHasher h(state_checksum);
+        h.add(static_cast<std::uint64_t>(pooled.size()));
+        for (const auto &p : pooled)
+          h.add(p);
+        state_checksum = h.value;
+      }
+      for (const auto &pipeline : fused_pipelines)
+        state_checksum = rolling_state_hash(
+            state_checksum, step_count,
+            pipeline->particles);
+      if (!rigid_bodies.empty())
+        state_checksum = rolling_rigid_hash(state_checksum,
+                                            rigid_bodies);
+      if (record_checksums)
+        checksum_history.push_back(state_checksum);
     }
   }
 
   // run all the physics related operations
   void run(real duration) {
-    // apply the force generators
-    registry.update_forces(duration);
+    VP_PROFILE_ZONE("step");
+    apply_commands();
+    emit(duration);
+    update_forces(duration);
 
     // move particles
     integrate(duration);
 
     //
     auto used_nb_contacts = generate_contacts();
-    if (used_nb_contacts != 0) {
-      if (compute_iterations) {
-        resolver.set_iterations(used_nb_contacts * 2);
+    resolve_contacts(used_nb_contacts, duration);
+    retire(duration);
+    end_step();
+  }
+
+  /**
+    \brief run() within budget seconds, cutting work when
+    the step runs late
+
+    The work goes in this order as time runs out:
+    - the resolver stops early enough for what follows
+      it, retiring and the checksum, to end by the
+      deadline, after at least one iteration
+    - optional_forces are left out when the phases that
+      can not be skipped would not fit otherwise
+    - once past the budget, aging and retiring the pooled
+      particles waits for the next step, which ages them
+      by both durations
+
+    Forces, integration, contact generation and the direct
+    chain and structure solves always run, so a step may
+    still overrun when they alone take longer than the
+    budget. The report tells what was cut and how long
+    the step took.
+   */
+  StepReport run_within(real duration, double budget) {
+    typedef ParticleContactResolver::Clock Clock;
+    auto start = Clock::now();
+    auto deadline =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(budget));
+    auto since = [](Clock::time_point t) {
+      return std::chrono::duration<double>(Clock::now() - t)
+          .count();
+    };
+    auto smooth = [](double &estimate, double sample) {
+      if (estimate == 0)
+        estimate = sample;
+      else
+        estimate += (sample - estimate) * 0.25;
+    };
+    StepReport report;
+    report.budget = budget;
+
+    VP_PROFILE_ZONE("step");
+    apply_commands();
+    emit(duration);
+    update_forces(duration, false);
+    if (optional_forces.size() != 0) {
+      if (since(start) + optional_estimate +
+              required_estimate >
+          budget) {
+        report.optional_forces_skipped = true;
+      } else {
+        auto t = Clock::now();
+        optional_forces.update_forces(duration, pool.get());
+        smooth(optional_estimate, since(t));
       }
-      resolver.resolve_contacts(contacts, used_nb_contacts,
-                                duration);
     }
+
+    auto t = Clock::now();
+    integrate(duration);
+    auto used_nb_contacts = generate_contacts();
+    solve_direct_links();
+    double required = since(t);
+
+    auto resolver_deadline =
+        deadline -
+        std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(tail_estimate));
+    resolve_contacts(used_nb_contacts, duration,
+                     &resolver_deadline);
+    report.resolver_cut = resolver.timed_out;
+    report.iterations = resolver.iteration_used;
+    report.velocity_error = resolver.velocity_error;
+    report.penetration_error = resolver.penetration_error;
+
+    t = Clock::now();
+    if (!pooled.empty() && since(start) > budget) {
+      report.retire_deferred = true;
+      deferred_retire += duration;
+    } else {
+      retire(duration);
+    }
+    end_step();
+    double tail = since(t);
+    // follows a longer tail at once, a step that ends late
+    // costs more than a few resolver iterations
+    if (tail > tail_estimate)
+      tail_estimate = tail;
+    else
+      smooth(tail_estimate, tail);
+    smooth(required_estimate, required + tail);
+    report.elapsed = since(start);
+    return report;
   }
 
   // start physics operations
@@ -122,6 +897,12 @@ public:
     for (auto &particle_ptr : particles) {
       particle_ptr->clear_accumulator();
     }
+    for (auto &p : pooled)
+      p.clear_accumulator();
+    for (auto &pipeline : fused_pipelines)
+      for (auto &particle_ptr : pipeline->particles)
+        particle_ptr->clear_accumulator();
+    rigid_bodies.clear_accumulators();
   }
 
   void get_particles(Particles &ps) { ps = particles; }
@@ -0,0 +1,564 @@
+#pragma once
+// rigid bodies stored as structure of arrays
+#include <array>
+#include <external.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vivaphysics/core.h>
+#include <vivaphysics/debug.hpp>
+#include <vivaphysics/parallel.hpp>
+#include <vivaphysics/phandle.hpp>
+#include <vivaphysics/precision.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**handle to a body of RigidBodySet*/
+typedef Handle RigidBodyHandle;
+
+/**
+  \brief state of one rigid body, used to add bodies to a
+  RigidBodySet and read them back
+
+  The inverse inertia tensor is given in body space, the
+  set keeps its world space copy up to date.
+ */
+struct RigidBody {
+  v3 position;
+  glm::quat orientation = glm::quat(1, 0, 0, 0);
+  v3 velocity;
+  /**angular velocity in world space*/
+  v3 rotation;
+  /**constant acceleration, gravity usually*/
+  v3 acceleration;
+  real inverse_mass = 1;
+  glm::mat3 inverse_inertia = glm::mat3(1);
+  /**fraction of the velocities kept after one second*/
+  real linear_damping = 0.99f;
+  real angular_damping = 0.99f;
+
+  void set_mass(real mass) {
+    D_CHECK_MSG(mass > 0, "mass should be positive");
+    inverse_mass = static_cast<real>(1.0) / mass;
+  }
+
+  /**solid box of the given half sizes*/
+  void set_box_inertia(real mass, const v3 &half) {
+    set_mass(mass);
+    real k = mass / 3.0f;
+    real x = half.x * half.x, y = half.y * half.y,
+         z = half.z * half.z;
+    inverse_inertia = glm::mat3(1);
+    inverse_inertia[0][0] = 1.0f / (k * (y + z));
+    inverse_inertia[1][1] = 1.0f / (k * (x + z));
+    inverse_inertia[2][2] = 1.0f / (k * (x + y));
+  }
+
+  /**solid sphere*/
+  void set_sphere_inertia(real mass, real radius) {
+    set_mass(mass);
+    real i = 0.4f * mass * radius * radius;
+    inverse_inertia = glm::mat3(1.0f / i);
+  }
+};
+
+/**
+  \brief rigid bodies kept column by column
+
+  Every component of every body lives in its own array,
+  so integrate() runs short loops over contiguous reals
+  that the compiler turns into SIMD code, the way
+  ParticlePool's retire() does for its flags. Orientations
+  are unit quaternions, the inverse inertia tensors are
+  symmetric and stored as their six distinct entries, once
+  in body space and once in world space.
+
+  Bodies are addressed by index or by handle. Removal moves
+  the last body into the hole, arrays kept beside the set
+  follow with swap_and_pop.
+
+  Forces and torques accumulate between steps and are
+  cleared by integrate(). Bodies with a zero inverse mass
+  neither move nor turn, their velocities are zeroed.
+ */
+class RigidBodySet {
+public:
+  typedef std::vector<real> Column;
+
+  // linear state
+  Column px, py, pz, vx, vy, vz, ax, ay, az;
+  // orientation and angular velocity
+  Column qw, qx, qy, qz, wx, wy, wz;
+  // accumulators
+  Column fx, fy, fz, tx, ty, tz;
+  Column inverse_mass;
+  /**change through set(), their factors for the step
+   * duration are cached*/
+  Column linear_damping, angular_damping;
+  /**inverse inertia in body space, xx xy xz yy yz zz*/
+  Column bxx, bxy, bxz, byy, byz, bzz;
+  /**inverse inertia in world space, same layout*/
+  Column ixx, ixy, ixz, iyy, iyz, izz;
+
+protected:
+  HandleTable handles;
+  /**damping factors over factor_duration, recomputed
+   * when the duration or a damping changes*/
+  Column linear_factor, angular_factor;
+  real factor_duration = 0;
+
+  static constexpr std::size_t NB_COLUMNS = 37;
+
+  static const std::array<Column RigidBodySet::*,
+                          NB_COLUMNS> &
+  columns() {
+    static const std::array<Column RigidBodySet::*,
+                            NB_COLUMNS>
+        list = {&RigidBodySet::px,
+                &RigidBodySet::py,
+                &RigidBodySet::pz,
+                &RigidBodySet::vx,
+                &RigidBodySet::vy,
+                &RigidBodySet::vz,
+                &RigidBodySet::ax,
+                &RigidBodySet::ay,
+                &RigidBodySet::az,
+                &RigidBodySet::qw,
+                &RigidBodySet::qx,
+                &RigidBodySet::qy,
+                &RigidBodySet::qz,
+                &RigidBodySet::wx,
+                &RigidBodySet::wy,
+                &RigidBodySet::wz,
+                &RigidBodySet::fx,
+                &RigidBodySet::fy,
+                &RigidBodySet::fz,
+                &RigidBodySet::tx,
+                &RigidBodySet::ty,
+                &RigidBodySet::tz,
+                &RigidBodySet::inverse_mass,
+                &RigidBodySet::linear_damping,
+                &RigidBodySet::angular_damping,
+                &RigidBodySet::bxx,
+                &RigidBodySet::bxy,
+                &RigidBodySet::bxz,
+                &RigidBodySet::byy,
+                &RigidBodySet::byz,
+                &RigidBodySet::bzz,
+                &RigidBodySet::ixx,
+                &RigidBodySet::ixy,
+                &RigidBodySet::ixz,
+                &RigidBodySet::iyy,
+                &RigidBodySet::iyz,
+                &RigidBodySet::izz};
+    return list;
+  }
+
+  /**
+    semi implicit Euler on the linear state, in the order
+    of Particle::integrate: the position moves with the
+    velocity of the start of the step
+   */
+  static void linear_rows(
+      std::size_t begin, std::size_t end, real duration,
+      real *__restrict x, real *__restrict y,
+      real *__restrict z, real *__restrict u,
+      real *__restrict v, real *__restrict w,
+      const real *__restrict gx, const real *__restrict gy,
+      const real *__restrict gz, const real *__restrict f0,
+      const real *__restrict f1, const real *__restrict f2,
+      const real *__restrict im,
+      const real *__restrict damp) {
+    for (std::size_t i = begin; i < end; i++) {
+      // fixed bodies have a zero inverse mass and a zero
+      // factor, they stay put with no velocity
+      real live = im[i] > 0 ? 1.0f : 0.0f;
+      x[i] += u[i] * duration * live;
+      y[i] += v[i] * duration * live;
+      z[i] += w[i] * duration * live;
+      real d = damp[i] * live;
+      u[i] = (u[i] + (gx[i] + f0[i] * im[i]) * duration) *
+             d;
+      v[i] = (v[i] + (gy[i] + f1[i] * im[i]) * duration) *
+             d;
+      w[i] = (w[i] + (gz[i] + f2[i] * im[i]) * duration) *
+             d;
+    }
+  }
+
+  /**
+    turn the orientation by the angular velocity of the
+    start of the step, then speed the rotation up by the
+    torque through the world inverse inertia
+   */
+  static void angular_rows(
+      std::size_t begin, std::size_t end, real duration,
+      real *__restrict q0, real *__restrict q1,
+      real *__restrict q2, real *__restrict q3,
+      real *__restrict o0, real *__restrict o1,
+      real *__restrict o2, const real *__restrict t0,
+      const real *__restrict t1, const real *__restrict t2,
+      const real *__restrict i00,
+      const real *__restrict i01,
+      const real *__restrict i02,
+      const real *__restrict i11,
+      const real *__restrict i12,
+      const real *__restrict i22,
+      const real *__restrict im,
+      const real *__restrict damp) {
+    for (std::size_t i = begin; i < end; i++) {
+      real live = im[i] > 0 ? 1.0f : 0.0f;
+      // q += dt / 2 (0, w) q
+      real h = 0.5f * duration * live;
+      real a = o0[i], b = o1[i], c = o2[i];
+      real s = q0[i], x = q1[i], y = q2[i], z = q3[i];
+      s -= h * (a * q1[i] + b * q2[i] + c * q3[i]);
+      x += h * (a * q0[i] + b * q3[i] - c * q2[i]);
+      y += h * (b * q0[i] + c * q1[i] - a * q3[i]);
+      z += h * (c * q0[i] + a * q2[i] - b * q1[i]);
+      real n = 1.0f / std::sqrt(s * s + x * x + y * y +
+                                z * z);
+      q0[i] = s * n;
+      q1[i] = x * n;
+      q2[i] = y * n;
+      q3[i] = z * n;
+
+      real e0 = i00[i] * t0[i] + i01[i] * t1[i] +
+                i02[i] * t2[i];
+      real e1 = i01[i] * t0[i] + i11[i] * t1[i] +
+                i12[i] * t2[i];
+      real e2 = i02[i] * t0[i] + i12[i] * t1[i] +
+                i22[i] * t2[i];
+      real d = damp[i] * live;
+      o0[i] = (a + e0 * duration) * d;
+      o1[i] = (b + e1 * duration) * d;
+      o2[i] = (c + e2 * duration) * d;
+    }
+  }
+
+  /**world inverse inertia R B R^T from the orientation
+   * and the body space tensor B*/
+  static void inertia_rows(
+      std::size_t begin, std::size_t end,
+      const real *__restrict q0, const real *__restrict q1,
+      const real *__restrict q2, const real *__restrict q3,
+      const real *__restrict b00,
+      const real *__restrict b01,
+      const real *__restrict b02,
+      const real *__restrict b11,
+      const real *__restrict b12,
+      const real *__restrict b22, real *__restrict i00,
+      real *__restrict i01, real *__restrict i02,
+      real *__restrict i11, real *__restrict i12,
+      real *__restrict i22) {
+    for (std::size_t i = begin; i < end; i++) {
+      real s = q0[i], x = q1[i], y = q2[i], z = q3[i];
+      // rotation matrix, r<row><column>
+      real r00 = 1 - 2 * (y * y + z * z);
+      real r01 = 2 * (x * y - s * z);
+      real r02 = 2 * (x * z + s * y);
+      real r10 = 2 * (x * y + s * z);
+      real r11 = 1 - 2 * (x * x + z * z);
+      real r12 = 2 * (y * z - s * x);
+      real r20 = 2 * (x * z - s * y);
+      real r21 = 2 * (y * z + s * x);
+      real r22 = 1 - 2 * (x * x + y * y);
+      // m = R B
+      real m00 = r00 * b00[i] + r01 * b01[i] + r02 * b02[i];
+      real m01 = r00 * b01[i] + r01 * b11[i] + r02 * b12[i];
+      real m02 = r00 * b02[i] + r01 * b12[i] + r02 * b22[i];
+      real m10 = r10 * b00[i] + r11 * b01[i] + r12 * b02[i];
+      real m11 = r10 * b01[i] + r11 * b11[i] + r12 * b12[i];
+      real m12 = r10 * b02[i] + r11 * b12[i] + r12 * b22[i];
+      real m20 = r20 * b00[i] + r21 * b01[i] + r22 * b02[i];
+      real m21 = r20 * b01[i] + r21 * b11[i] + r22 * b12[i];
+      real m22 = r20 * b02[i] + r21 * b12[i] + r22 * b22[i];
+      // m R^T, symmetric
+      i00[i] = m00 * r00 + m01 * r01 + m02 * r02;
+      i01[i] = m00 * r10 + m01 * r11 + m02 * r12;
+      i02[i] = m00 * r20 + m01 * r21 + m02 * r22;
+      i11[i] = m10 * r10 + m11 * r11 + m12 * r12;
+      i12[i] = m10 * r20 + m11 * r21 + m12 * r22;
+      i22[i] = m20 * r20 + m21 * r21 + m22 * r22;
+    }
+  }
+
+  /**integrate and clear the bodies in [begin, end)*/
+  void integrate_rows(std::size_t begin, std::size_t end,
+                      real duration) {
+    linear_rows(begin, end, duration, px.data(),
+                py.data(), pz.data(), vx.data(), vy.data(),
+                vz.data(), ax.data(), ay.data(), az.data(),
+                fx.data(), fy.data(), fz.data(),
+                inverse_mass.data(), linear_factor.data());
+    angular_rows(begin, end, duration, qw.data(),
+                 qx.data(), qy.data(), qz.data(),
+                 wx.data(), wy.data(), wz.data(),
+                 tx.data(), ty.data(), tz.data(),
+                 ixx.data(), ixy.data(), ixz.data(),
+                 iyy.data(), iyz.data(), izz.data(),
+                 inverse_mass.data(),
+                 angular_factor.data());
+    update_inertia(begin, end);
+    for (auto column : {&fx, &fy, &fz, &tx, &ty, &tz})
+      std::fill(column->begin() + begin,
+                column->begin() + end, 0.0f);
+  }
+
+  void update_factors(real duration) {
+    if (factor_duration == duration)
+      return;
+    for (std::size_t i = 0; i < size(); i++) {
+      linear_factor[i] = static_cast<real>(
+          pow(linear_damping[i], duration));
+      angular_factor[i] = static_cast<real>(
+          pow(angular_damping[i], duration));
+    }
+    factor_duration = duration;
+  }
+
+  void update_inertia(std::size_t begin, std::size_t end) {
+    inertia_rows(begin, end, qw.data(), qx.data(),
+                 qy.data(), qz.data(), bxx.data(),
+                 bxy.data(), bxz.data(), byy.data(),
+                 byz.data(), bzz.data(), ixx.data(),
+                 ixy.data(), ixz.data(), iyy.data(),
+                 iyz.data(), izz.data());
+  }
+
+public:
+  RigidBodySet() {}
+  RigidBodySet(unsigned int capacity) {
+    reserve(capacity);
+  }
+
+  void reserve(unsigned int n) {
+    for (auto column : columns())
+      (this->*column).reserve(n);
+    linear_factor.reserve(n);
+    angular_factor.reserve(n);
+    handles.reserve(n);
+  }
+
+  unsigned int size() const {
+    return static_cast<unsigned int>(px.size());
+  }
+  bool empty() const { return px.empty(); }
+
+  RigidBodyHandle add(const RigidBody &body) {
+    D_CHECK_MSG(body.inverse_mass >= 0,
+                "inverse mass should not be negative");
+    glm::quat q = glm::normalize(body.orientation);
+    const glm::mat3 &b = body.inverse_inertia;
+    real values[NB_COLUMNS] = {
+        body.position.x,     body.position.y,
+        body.position.z,     body.velocity.x,
+        body.velocity.y,     body.velocity.z,
+        body.acceleration.x, body.acceleration.y,
+        body.acceleration.z, q.w,
+        q.x,                 q.y,
+        q.z,                 body.rotation.x,
+        body.rotation.y,     body.rotation.z,
+        0,                   0,
+        0,                   0,
+        0,                   0,
+        body.inverse_mass,   body.linear_damping,
+        body.angular_damping, b[0][0],
+        b[1][0],             b[2][0],
+        b[1][1],             b[2][1],
+        b[2][2],             0,
+        0,                   0,
+        0,                   0,
+        0};
+    for (std::size_t c = 0; c < NB_COLUMNS; c++)
+      (this->*columns()[c]).push_back(values[c]);
+    linear_factor.push_back(0);
+    angular_factor.push_back(0);
+    factor_duration = 0;
+    update_inertia(size() - 1, size());
+    return handles.push_back();
+  }
+
+  /**the state of the i th body, inertia in body space*/
+  RigidBody get(unsigned int i) const {
+    RigidBody body;
+    body.position = v3(px[i], py[i], pz[i]);
+    body.orientation = get_orientation(i);
+    body.velocity = v3(vx[i], vy[i], vz[i]);
+    body.rotation = v3(wx[i], wy[i], wz[i]);
+    body.acceleration = v3(ax[i], ay[i], az[i]);
+    body.inverse_mass = inverse_mass[i];
+    body.linear_damping = linear_damping[i];
+    body.angular_damping = angular_damping[i];
+    glm::mat3 &b = body.inverse_inertia;
+    b[0][0] = bxx[i];
+    b[1][1] = byy[i];
+    b[2][2] = bzz[i];
+    b[0][1] = b[1][0] = bxy[i];
+    b[0][2] = b[2][0] = bxz[i];
+    b[1][2] = b[2][1] = byz[i];
+    return body;
+  }
+  RigidBody get(RigidBodyHandle h) const {
+    return get(index(h));
+  }
+
+  /**overwrite the state of the i th body, its
+   * accumulators are kept*/
+  void set(unsigned int i, const RigidBody &body) {
+    glm::quat q = glm::normalize(body.orientation);
+    const glm::mat3 &b = body.inverse_inertia;
+    px[i] = body.position.x;
+    py[i] = body.position.y;
+    pz[i] = body.position.z;
+    vx[i] = body.velocity.x;
+    vy[i] = body.velocity.y;
+    vz[i] = body.velocity.z;
+    ax[i] = body.acceleration.x;
+    ay[i] = body.acceleration.y;
+    az[i] = body.acceleration.z;
+    qw[i] = q.w;
+    qx[i] = q.x;
+    qy[i] = q.y;
+    qz[i] = q.z;
+    wx[i] = body.rotation.x;
+    wy[i] = body.rotation.y;
+    wz[i] = body.rotation.z;
+    inverse_mass[i] = body.inverse_mass;
+    linear_damping[i] = body.linear_damping;
+    angular_damping[i] = body.angular_damping;
+    bxx[i] = b[0][0];
+    bxy[i] = b[1][0];
+    bxz[i] = b[2][0];
+    byy[i] = b[1][1];
+    byz[i] = b[2][1];
+    bzz[i] = b[2][2];
+    factor_duration = 0;
+    update_inertia(i, i + 1);
+  }
+
+  bool contains(RigidBodyHandle h) const {
+    return handles.contains(h);
+  }
+  /**index of a live handle, throws on a stale one*/
+  unsigned int index(RigidBodyHandle h) const {
+    return handles.index(h);
+  }
+  RigidBodyHandle handle(unsigned int i) const {
+    return handles.handle(i);
+  }
+
+  /**false when the body was removed already*/
+  bool remove(RigidBodyHandle h) {
+    if (!handles.contains(h))
+      return false;
+    remove_index(handles.index(h));
+    return true;
+  }
+
+  /**remove the i th body, the last one takes its index*/
+  void remove_index(unsigned int i) {
+    handles.erase_index(i);
+    for (auto column : columns())
+      swap_and_pop(this->*column, i);
+    swap_and_pop(linear_factor, i);
+    swap_and_pop(angular_factor, i);
+  }
+
+  /**every handle goes stale*/
+  void clear() {
+    for (auto column : columns())
+      (this->*column).clear();
+    linear_factor.clear();
+    angular_factor.clear();
+    handles.clear();
+  }
+
+  v3 get_position(unsigned int i) const {
+    return v3(px[i], py[i], pz[i]);
+  }
+  v3 get_velocity(unsigned int i) const {
+    return v3(vx[i], vy[i], vz[i]);
+  }
+  v3 get_rotation(unsigned int i) const {
+    return v3(wx[i], wy[i], wz[i]);
+  }
+  glm::quat get_orientation(unsigned int i) const {
+    return glm::quat(qw[i], qx[i], qy[i], qz[i]);
+  }
+
+  /**a point given in the frame of the i th body, in world
+   * space*/
+  v3 to_world(unsigned int i, const v3 &local) const {
+    return get_position(i) +
+           v3(get_orientation(i) * local.to_glm());
+  }
+  /**a direction of the body frame in world space*/
+  v3 direction_to_world(unsigned int i,
+                        const v3 &local) const {
+    return v3(get_orientation(i) * local.to_glm());
+  }
+  /**velocity of a world space point moving with the body*/
+  v3 get_point_velocity(unsigned int i,
+                        const v3 &point) const {
+    return get_velocity(i) + get_rotation(i).cross_product(
+                                 point - get_position(i));
+  }
+
+  /**force through the center of mass*/
+  void add_force(unsigned int i, const v3 &force) {
+    fx[i] += force.x;
+    fy[i] += force.y;
+    fz[i] += force.z;
+  }
+  void add_torque(unsigned int i, const v3 &torque) {
+    tx[i] += torque.x;
+    ty[i] += torque.y;
+    tz[i] += torque.z;
+  }
+  /**world space force at a world space point*/
+  void add_force_at_point(unsigned int i, const v3 &force,
+                          const v3 &point) {
+    add_force(i, force);
+    add_torque(i, (point - get_position(i))
+                      .cross_product(force));
+  }
+  /**world space force at a point of the body frame*/
+  void add_force_at_body_point(unsigned int i,
+                               const v3 &force,
+                               const v3 &local) {
+    add_force_at_point(i, force, to_world(i, local));
+  }
+
+  /**zero the forces and torques*/
+  void clear_accumulators() {
+    for (auto column : {&fx, &fy, &fz, &tx, &ty, &tz})
+      std::fill(column->begin(), column->end(), 0.0f);
+  }
+
+  /**
+    \brief move and turn every body by duration seconds,
+    then clear the accumulators
+
+    Bodies are independent, the set is split into chunks
+    over the pool threads when given and the result does
+    not depend on the thread count.
+   */
+  void integrate(real duration,
+                 ThreadPool *pool = nullptr) {
+    D_CHECK_MSG(duration > 0.0,
+                "duration should be bigger than 0");
+    update_factors(duration);
+    if (pool == nullptr) {
+      integrate_rows(0, size(), duration);
+      return;
+    }
+    parallel_for(pool, size(),
+                 [this, duration](unsigned int begin,
+                                  unsigned int end,
+                                  unsigned int) {
+                   integrate_rows(begin, end, duration);
+                 });
+  }
+};
+};
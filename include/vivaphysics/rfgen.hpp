@@ -0,0 +1,248 @@
+#pragma once
+// force generators acting on rigid bodies
+#include <external.hpp>
+#include <vivaphysics/phandle.hpp>
+#include <vivaphysics/rbody.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+enum class RigidForceGeneratorType {
+  SPRING = 0,
+  ANCHORED_SPRING = 1,
+  THRUST = 2
+};
+
+template <class T> struct RigidForceGenerator {
+  /**Compute the force applied to the i th body of the
+   * set*/
+  void update_force(const T &generator,
+                    RigidBodySet &bodies, unsigned int i,
+                    real duration);
+};
+
+/**spring between a point of the body and a point of
+ * another body, both in their body frames*/
+struct RigidSpring {
+  v3 connection_point;
+  RigidBodyHandle other;
+  v3 other_connection_point;
+  real spring_constant;
+  real rest_length;
+  RigidSpring(const v3 &cp, RigidBodyHandle o,
+              const v3 &ocp, real sc, real rl)
+      : connection_point(cp), other(o),
+        other_connection_point(ocp), spring_constant(sc),
+        rest_length(rl) {}
+};
+
+/**spring between a point of the body and a fixed point
+ * of the world*/
+struct RigidAnchoredSpring {
+  v3 connection_point;
+  point3 anchor;
+  real spring_constant;
+  real rest_length;
+  RigidAnchoredSpring(const v3 &cp, const point3 &a,
+                      real sc, real rl)
+      : connection_point(cp), anchor(a),
+        spring_constant(sc), rest_length(rl) {}
+};
+
+/**force fixed in the body frame, an engine at a point of
+ * the body*/
+struct RigidThrust {
+  v3 application_point;
+  v3 force;
+  RigidThrust(const v3 &ap, const v3 &f)
+      : application_point(ap), force(f) {}
+};
+
+/**pull a towards b with a spring of the given length*/
+inline v3 rigid_spring_force(const v3 &a, const v3 &b,
+                             real spring_constant,
+                             real rest_length) {
+  v3 d = a - b;
+  real length = d.magnitude();
+  if (length <= 0)
+    return v3(0);
+  return d * (-spring_constant * (length - rest_length) /
+              length);
+}
+
+template <> struct RigidForceGenerator<RigidSpring> {
+  void update_force(const RigidSpring &generator,
+                    RigidBodySet &bodies, unsigned int i,
+                    real) {
+    auto j = bodies.index(generator.other);
+    v3 a = bodies.to_world(i, generator.connection_point);
+    v3 b = bodies.to_world(
+        j, generator.other_connection_point);
+    v3 force = rigid_spring_force(
+        a, b, generator.spring_constant,
+        generator.rest_length);
+    // both ends, the registry holds a single entry per
+    // spring
+    bodies.add_force_at_point(i, force, a);
+    bodies.add_force_at_point(j, force * -1.0f, b);
+  }
+};
+
+template <>
+struct RigidForceGenerator<RigidAnchoredSpring> {
+  void update_force(const RigidAnchoredSpring &generator,
+                    RigidBodySet &bodies, unsigned int i,
+                    real) {
+    v3 a = bodies.to_world(i, generator.connection_point);
+    bodies.add_force_at_point(
+        i,
+        rigid_spring_force(a, generator.anchor,
+                           generator.spring_constant,
+                           generator.rest_length),
+        a);
+  }
+};
+
+template <> struct RigidForceGenerator<RigidThrust> {
+  void update_force(const RigidThrust &generator,
+                    RigidBodySet &bodies, unsigned int i,
+                    real) {
+    bodies.add_force_at_body_point(
+        i, bodies.direction_to_world(i, generator.force),
+        generator.application_point);
+  }
+};
+
+/**
+  \brief any rigid force generator, the fields are shared
+  between the types
+
+  point is the connection or application point in the
+  frame of the body, target the point of the other body,
+  the anchor or the thrust.
+ */
+struct RigidForceGeneratorWrapper {
+  RigidForceGeneratorType gtype;
+  v3 point;
+  v3 target;
+  RigidBodyHandle other;
+  real spring_constant = 0;
+  real rest_length = 0;
+
+  RigidForceGeneratorWrapper(const RigidSpring &g)
+      : gtype(RigidForceGeneratorType::SPRING),
+        point(g.connection_point),
+        target(g.other_connection_point), other(g.other),
+        spring_constant(g.spring_constant),
+        rest_length(g.rest_length) {}
+  RigidForceGeneratorWrapper(const RigidAnchoredSpring &g)
+      : gtype(RigidForceGeneratorType::ANCHORED_SPRING),
+        point(g.connection_point), target(g.anchor),
+        spring_constant(g.spring_constant),
+        rest_length(g.rest_length) {}
+  RigidForceGeneratorWrapper(const RigidThrust &g)
+      : gtype(RigidForceGeneratorType::THRUST),
+        point(g.application_point), target(g.force) {}
+
+  RigidSpring to_spring() const {
+    return RigidSpring(point, other, target,
+                       spring_constant, rest_length);
+  }
+  RigidAnchoredSpring to_anchored_spring() const {
+    return RigidAnchoredSpring(point, target,
+                               spring_constant,
+                               rest_length);
+  }
+  RigidThrust to_thrust() const {
+    return RigidThrust(point, target);
+  }
+};
+
+template <>
+struct RigidForceGenerator<RigidForceGeneratorWrapper> {
+  void update_force(
+      const RigidForceGeneratorWrapper &generator,
+      RigidBodySet &bodies, unsigned int i,
+      real duration) {
+    switch (generator.gtype) {
+    case RigidForceGeneratorType::SPRING:
+      RigidForceGenerator<RigidSpring>().update_force(
+          generator.to_spring(), bodies, i, duration);
+      break;
+    case RigidForceGeneratorType::ANCHORED_SPRING:
+      RigidForceGenerator<RigidAnchoredSpring>()
+          .update_force(generator.to_anchored_spring(),
+                        bodies, i, duration);
+      break;
+    case RigidForceGeneratorType::THRUST:
+      RigidForceGenerator<RigidThrust>().update_force(
+          generator.to_thrust(), bodies, i, duration);
+      break;
+    }
+  }
+};
+
+/**handle to a registration of RigidForceRegistry*/
+typedef Handle RigidForceHandle;
+
+/**
+  \brief generators registered against bodies of a
+  RigidBodySet
+
+  Forces are applied serially in registration order, so
+  the sums do not depend on the thread count. Registrations
+  naming a body that was removed since are skipped.
+ */
+class RigidForceRegistry {
+protected:
+  struct Registration {
+    RigidBodyHandle body;
+    RigidForceGeneratorWrapper generator;
+  };
+  std::vector<Registration> registrations;
+  HandleTable handles;
+
+public:
+  RigidForceHandle
+  add(RigidBodyHandle body,
+      const RigidForceGeneratorWrapper &g) {
+    registrations.push_back({body, g});
+    return handles.push_back();
+  }
+
+  /**false when the registration was removed already,
+   * the last one takes its place*/
+  bool remove(RigidForceHandle h) {
+    if (!handles.contains(h))
+      return false;
+    auto i = handles.index(h);
+    handles.erase_index(i);
+    swap_and_pop(registrations, i);
+    return true;
+  }
+
+  unsigned int size() const {
+    return static_cast<unsigned int>(registrations.size());
+  }
+  bool empty() const { return registrations.empty(); }
+  void clear() {
+    registrations.clear();
+    handles.clear();
+  }
+
+  void update_forces(RigidBodySet &bodies, real duration) {
+    RigidForceGenerator<RigidForceGeneratorWrapper> gen;
+    for (const auto &r : registrations) {
+      if (!bodies.contains(r.body))
+        continue;
+      if (r.generator.gtype ==
+              RigidForceGeneratorType::SPRING &&
+          !bodies.contains(r.generator.other))
+        continue;
+      gen.update_force(r.generator, bodies,
+                       bodies.index(r.body), duration);
+    }
+  }
+};
+};
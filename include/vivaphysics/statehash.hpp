@@ -0,0 +1,91 @@
+#pragma once
+// rolling checksum of the simulation state
+#include <cstdint>
+#include <external.hpp>
+#include <vivaphysics/particle.hpp>
+#include <vivaphysics/rbody.hpp>
+
+using namespace vivaphysics;
+
+namespace vivaphysics {
+
+/**
+  \brief FNV-1a hash over the exact bit patterns of the
+  state
+
+  Values are hashed bitwise, so 0.0 and -0.0 or two NaN
+  payloads hash differently: a checksum match means the two
+  runs are bit identical, not just numerically close.
+ */
+struct StateHasher {
+  static constexpr std::uint64_t OFFSET =
+      14695981039346656037ULL;
+  static constexpr std::uint64_t PRIME = 1099511628211ULL;
+
+  std::uint64_t value = OFFSET;
+
+  StateHasher() {}
+  StateHasher(std::uint64_t seed) : value(seed) {}
+
+  void add_bytes(const void *data, std::size_t size) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; i++) {
+      value ^= static_cast<std::uint64_t>(bytes[i]);
+      value *= PRIME;
+    }
+  }
+  void add(real r) { add_bytes(&r, sizeof(real)); }
+  void add(std::uint64_t v) { add_bytes(&v, sizeof(v)); }
+  void add(const v3 &v) {
+    add(v.x);
+    add(v.y);
+    add(v.z);
+  }
+  void add(const Particle &p) {
+    add(p.get_position());
+    add(p.get_velocity());
+    add(p.get_acceleration());
+    add(p.get_inverse_mass());
+    add(p.get_damping());
+  }
+};
+
+/**
+  \brief hash the particles in container order, chained to
+  the checksum of the previous step
+
+  Chaining makes the checksum of step n depend on every step
+  before it, so comparing the last value of two runs is
+  enough to know whether they ever diverged.
+ */
+inline std::uint64_t
+rolling_state_hash(std::uint64_t previous,
+                   std::uint64_t step,
+                   const Particles &particles) {
+  StateHasher h(previous);
+  h.add(step);
+  h.add(static_cast<std::uint64_t>(particles.size()));
+  for (const auto &particle_ptr : particles) {
+    h.add(*particle_ptr);
+  }
+  return h.value;
+}
+
+/**chain the rigid bodies, column by column, into the
+ * checksum of the step*/
+inline std::uint64_t
+rolling_rigid_hash(std::uint64_t previous,
+                   const RigidBodySet &bodies) {
+  StateHasher h(previous);
+  auto n = bodies.size();
+  h.add(static_cast<std::uint64_t>(n));
+  const RigidBodySet::Column *columns[] = {
+      &bodies.px, &bodies.py, &bodies.pz, &bodies.vx,
+      &bodies.vy, &bodies.vz, &bodies.qw, &bodies.qx,
+      &bodies.qy, &bodies.qz, &bodies.wx, &bodies.wy,
+      &bodies.wz};
+  for (auto column : columns)
+    h.add_bytes(column->data(), n * sizeof(real));
+  return h.value;
+}
+};
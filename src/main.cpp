@@ -1,8 +1,296 @@
-// main file
+// headless batch runner
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
 #include <external.hpp>
-#include <vivaphysics/particle.hpp>
+#include <vivaphysics/pscene.hpp>
+#include <vivaphysics/pstate.hpp>
+#include <vivaphysics/pworld.hpp>
 
-int main() {
-  std::cout << "Hello Engine" << std::endl;
+using namespace vivaphysics;
+
+struct RunConfig {
+  std::string scene_path;
+  /**snapshot restoring the particles of a scene file*/
+  std::string resume_path;
+  unsigned int steps = 1000;
+  real duration = 1.0f / 60.0f;
+  unsigned int threads = 1;
+  unsigned int iterations = 0;
+  /**closing velocity and penetration left to the resolver*/
+  real tolerance = 0;
+  /**milliseconds per step for run_within, 0 runs
+   * every step to the end*/
+  double budget_ms = 0;
+  unsigned int max_contacts = 0;
+  bool deterministic = false;
+  /**start the resolver from the previous impulses*/
+  bool warm_start = false;
+  std::string record_path;
+  unsigned int record_every = 1;
+  std::string checkpoint_path;
+  unsigned int checkpoint_every = 0;
+};
+
+void print_usage() {
+  std::cerr
+      << "usage: main.out scene-or-snapshot [--steps n] "
+         "[--dt s] [--threads n] [--iterations n] "
+         "[--tolerance e] [--budget ms] "
+         "[--contacts n] [--resume snapshot] "
+         "[--deterministic] [--warm-start] "
+         "[--record file] "
+         "[--record-every n] [--checkpoint file] "
+         "[--checkpoint-every n]"
+      << std::endl;
+}
+
+/**\name option values, false unless the whole text is a
+ * number of the type*/
+/**@{*/
+bool parse_value(const std::string &text,
+                 unsigned int &out) {
+  if (text.empty() || text[0] == '-')
+    return false;
+  char *end = nullptr;
+  errno = 0;
+  auto value = std::strtoul(text.c_str(), &end, 10);
+  if (errno != 0 || *end != '\0' || value > UINT_MAX)
+    return false;
+  out = static_cast<unsigned int>(value);
+  return true;
+}
+bool parse_value(const std::string &text, double &out) {
+  if (text.empty())
+    return false;
+  char *end = nullptr;
+  errno = 0;
+  auto value = std::strtod(text.c_str(), &end);
+  if (errno != 0 || *end != '\0')
+    return false;
+  out = value;
+  return true;
+}
+bool parse_value(const std::string &text, float &out) {
+  double value;
+  if (!parse_value(text, value))
+    return false;
+  out = static_cast<float>(value);
+  return true;
+}
+/**@}*/
+
+bool parse_args(int argc, char *argv[], RunConfig &config) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--deterministic") {
+      config.deterministic = true;
+      continue;
+    }
+    if (arg == "--warm-start") {
+      config.warm_start = true;
+      continue;
+    }
+    if (arg.rfind("--", 0) != 0) {
+      config.scene_path = arg;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return false;
+    std::string value = argv[++i];
+    bool valid = true;
+    if (arg == "--steps") {
+      valid = parse_value(value, config.steps);
+    } else if (arg == "--dt") {
+      valid = parse_value(value, config.duration);
+    } else if (arg == "--threads") {
+      valid = parse_value(value, config.threads);
+    } else if (arg == "--iterations") {
+      valid = parse_value(value, config.iterations);
+    } else if (arg == "--tolerance") {
+      valid = parse_value(value, config.tolerance);
+    } else if (arg == "--budget") {
+      valid = parse_value(value, config.budget_ms);
+    } else if (arg == "--contacts") {
+      valid = parse_value(value, config.max_contacts);
+    } else if (arg == "--resume") {
+      config.resume_path = value;
+    } else if (arg == "--record") {
+      config.record_path = value;
+    } else if (arg == "--record-every") {
+      valid = parse_value(value, config.record_every);
+    } else if (arg == "--checkpoint") {
+      config.checkpoint_path = value;
+    } else if (arg == "--checkpoint-every") {
+      valid = parse_value(value, config.checkpoint_every);
+    } else {
+      return false;
+    }
+    if (!valid)
+      return false;
+  }
+  return !config.scene_path.empty() && config.duration > 0;
+}
+
+double
+seconds_since(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now() - t)
+      .count();
+}
+
+/**true when the file starts with a snapshot header*/
+bool is_snapshot(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::uint32_t magic = 0;
+  in.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  return in.good() && magic == SnapshotHeader::MAGIC;
+}
+
+/**
+  a snapshot only holds particles, so the ground flag is the
+  whole topology; scene files carry their own
+ */
+std::uint32_t load_world(ParticleWorld &world,
+                         const RunConfig &config) {
+  if (!is_snapshot(config.scene_path)) {
+    build_world(load_scene(config.scene_path), world,
+                world.pool.get());
+    if (config.iterations != 0) {
+      world.compute_iterations = false;
+      world.resolver.set_iterations(config.iterations);
+    }
+    if (config.max_contacts != 0)
+      world.set_max_contacts(config.max_contacts);
+    if (!config.resume_path.empty())
+      load_snapshot(world, config.resume_path);
+    return 0;
+  }
+  auto header = load_snapshot(world, config.scene_path);
+  // every particle can touch the ground once by default
+  unsigned int max_contacts = config.max_contacts;
+  if (max_contacts == 0)
+    max_contacts = static_cast<unsigned int>(
+        std::max<std::size_t>(world.particles.size(), 1));
+  world.set_max_contacts(max_contacts);
+  if (header.flags & SnapshotHeader::HAS_GROUND) {
+    world.add_contact_generator(
+        ParticleContactGenerator<ParticleContactWrapper>(),
+        ParticleContactWrapper(
+            GroundContacts(world.particles)));
+  }
+  return header.flags;
+}
+
+int main(int argc, char *argv[]) {
+  RunConfig config;
+  if (!parse_args(argc, argv, config)) {
+    print_usage();
+    return 1;
+  }
+
+  auto load_start = std::chrono::steady_clock::now();
+  ParticleWorld world(1, config.iterations);
+  world.set_threads(config.threads);
+  std::uint32_t flags = 0;
+  try {
+    flags = load_world(world, config);
+  } catch (const std::runtime_error &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  world.set_deterministic(config.deterministic);
+  world.warm_start = config.warm_start;
+  world.resolver.velocity_tolerance = config.tolerance;
+  world.resolver.penetration_tolerance = config.tolerance;
+  double load_time = seconds_since(load_start);
+
+  std::unique_ptr<TrajectoryRecorder> recorder;
+  if (!config.record_path.empty()) {
+    recorder = std::make_unique<TrajectoryRecorder>(
+        config.record_path);
+  }
+
+  // what the resolver achieved over the run
+  unsigned long nb_iterations = 0, nb_unconverged = 0;
+  real velocity_error = 0, penetration_error = 0;
+  // steps over budget and steps that cut work
+  unsigned long nb_late = 0, nb_degraded = 0;
+  double worst_step = 0;
+  auto run_start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < config.steps; i++) {
+    if (config.budget_ms > 0) {
+      auto report = world.run_within(
+          config.duration, config.budget_ms / 1000.0);
+      nb_late += report.late() ? 1 : 0;
+      nb_degraded += report.degraded() ? 1 : 0;
+      worst_step = std::max(worst_step, report.elapsed);
+    } else {
+      world.run(config.duration);
+    }
+    const auto &resolver = world.resolver;
+    nb_iterations += resolver.iteration_used;
+    nb_unconverged += resolver.converged ? 0 : 1;
+    velocity_error =
+        std::max(velocity_error, resolver.velocity_error);
+    penetration_error = std::max(
+        penetration_error, resolver.penetration_error);
+    if (recorder && config.record_every != 0 &&
+        (i + 1) % config.record_every == 0) {
+      recorder->record(world);
+    }
+    if (!config.checkpoint_path.empty() &&
+        config.checkpoint_every != 0 &&
+        (i + 1) % config.checkpoint_every == 0) {
+      save_snapshot(world, config.checkpoint_path,
+                    flags);
+    }
+  }
+  double run_time = seconds_since(run_start);
+  if (!config.checkpoint_path.empty()) {
+    save_snapshot(world, config.checkpoint_path,
+                  flags);
+  }
+
+  double particle_steps =
+      static_cast<double>(world.particles.size()) *
+      config.steps;
+  std::cout << "particles: " << world.particles.size()
+            << std::endl;
+  std::cout << "threads: " << world.get_threads()
+            << std::endl;
+  std::cout << "load time (ms): " << load_time * 1000.0
+            << std::endl;
+  std::cout << "steps: " << config.steps
+            << " run time (s): " << run_time << std::endl;
+  std::cout << "steps/sec: "
+            << (run_time > 0 ? config.steps / run_time : 0)
+            << std::endl;
+  std::cout << "particle steps/sec: "
+            << (run_time > 0 ? particle_steps / run_time
+                             : 0)
+            << std::endl;
+  std::cout << "resolver iterations/step: "
+            << (config.steps != 0
+                    ? static_cast<double>(nb_iterations) /
+                          config.steps
+                    : 0)
+            << std::endl;
+  std::cout << "resolver max error: velocity "
+            << velocity_error << " penetration "
+            << penetration_error << " unconverged steps "
+            << nb_unconverged << std::endl;
+  if (config.budget_ms > 0) {
+    std::cout << "late steps: " << nb_late
+              << " degraded steps: " << nb_degraded
+              << " worst step (ms): " << worst_step * 1000.0
+              << std::endl;
+  }
+  if (config.deterministic) {
+    std::cout << "checksum: " << std::hex
+              << world.state_checksum << std::dec
+              << std::endl;
+  }
   return 0;
 }